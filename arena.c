@@ -0,0 +1,81 @@
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "util.h"
+
+#define MIN_BLOCK_SIZE 4096
+#define MAX_BLOCK_SIZE (1024 * 1024)
+
+struct arena_block {
+	struct arena_block *next;
+	size_t size, used;
+	alignas(max_align_t) unsigned char data[];
+};
+
+/*
+ * Return size zeroed bytes, aligned for any type. Blocks double in size as
+ * the arena grows, so a large command needs few trips to malloc.
+ */
+void *
+arena_alloc(struct arena *arena, size_t size)
+{
+	size = (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+
+	struct arena_block *block = arena->blocks;
+	if (!block || block->size - block->used < size) {
+		size_t block_size = block ? block->size * 2 : MIN_BLOCK_SIZE;
+		if (block_size > MAX_BLOCK_SIZE) {
+			block_size = MAX_BLOCK_SIZE;
+		}
+		if (block_size < size) {
+			block_size = size;
+		}
+		block = calloc(1, sizeof *block + block_size);
+		if (!block) {
+			die("Failed to allocate %zu bytes\n", size);
+		}
+		block->size = block_size;
+		block->next = arena->blocks;
+		arena->blocks = block;
+		arena->size += sizeof *block + block_size;
+	}
+
+	void *ptr = block->data + block->used;
+	block->used += size;
+	return ptr;
+}
+
+char *
+arena_strdup(struct arena *arena, const char *str)
+{
+	size_t len = strlen(str) + 1;
+	return memcpy(arena_alloc(arena, len), str, len);
+}
+
+/*
+ * Replace a string that came from arena_strdup, in place if it fits, so a
+ * string that keeps changing doesn't keep growing the arena.
+ */
+char *
+arena_strset(struct arena *arena, char *old, const char *str)
+{
+	if (old && strlen(str) <= strlen(old)) {
+		return strcpy(old, str);
+	}
+	return arena_strdup(arena, str);
+}
+
+void
+arena_release(struct arena *arena)
+{
+	struct arena_block *block = arena->blocks;
+	while (block) {
+		struct arena_block *next = block->next;
+		free(block);
+		block = next;
+	}
+	arena->blocks = NULL;
+}
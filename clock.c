@@ -0,0 +1,83 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "clock.h"
+#include "util.h"
+
+// Virtual time between batches, so they still come in order
+#define VIRTUAL_STEP UINT64_C(1000000)
+
+/*
+ * Use the virtual clock if WLRCTL_CLOCK is "virtual", for tests and
+ * benchmarks that compare event streams.
+ */
+void
+clock_init(struct wlrctl_clock *clock)
+{
+	const char *type = getenv("WLRCTL_CLOCK");
+	clock->type = WLRCTL_CLOCK_MONOTONIC;
+	clock->now = 0;
+	if (type && strcmp(type, "virtual") == 0) {
+		clock->type = WLRCTL_CLOCK_VIRTUAL;
+	} else if (type && *type && strcmp(type, "monotonic") != 0) {
+		die("Unknown clock: '%s'\n", type);
+	}
+}
+
+/*
+ * Read the clock for a batch of events and return their timestamp.
+ */
+uint32_t
+clock_begin_batch(struct wlrctl_clock *clock)
+{
+	switch (clock->type) {
+	case WLRCTL_CLOCK_MONOTONIC:
+		clock->now = now_ns();
+		break;
+	case WLRCTL_CLOCK_VIRTUAL:
+		clock->now += VIRTUAL_STEP;
+		break;
+	}
+	return clock_event_time(clock);
+}
+
+/*
+ * Event times are milliseconds that wrap around at 2^32, as the protocol
+ * has it.
+ */
+uint32_t
+clock_event_time(const struct wlrctl_clock *clock)
+{
+	return (uint32_t)(clock->now / 1000000);
+}
+
+uint64_t
+clock_now(const struct wlrctl_clock *clock)
+{
+	return clock->type == WLRCTL_CLOCK_VIRTUAL ? clock->now : now_ns();
+}
+
+/*
+ * Let time pass on the virtual clock. The monotonic clock moves by itself.
+ */
+void
+clock_advance(struct wlrctl_clock *clock, uint64_t ns)
+{
+	if (clock->type == WLRCTL_CLOCK_VIRTUAL) {
+		clock->now += ns;
+	}
+}
+
+/*
+ * Begin a batch after waiting slept_ns since the last one. The virtual
+ * clock moves by exactly that much, so timed input keeps its spacing.
+ */
+uint32_t
+clock_resume(struct wlrctl_clock *clock, uint64_t slept_ns)
+{
+	if (clock->type == WLRCTL_CLOCK_VIRTUAL) {
+		clock->now += slept_ns;
+		return clock_event_time(clock);
+	}
+	return clock_begin_batch(clock);
+}
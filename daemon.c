@@ -0,0 +1,348 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <poll.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <wayland-client.h>
+#include "common.h"
+#include "daemon.h"
+#include "loop.h"
+#include "util.h"
+
+/*
+ * The daemon reads one command per line, quoted like a shell command line,
+ * and runs them one at a time on its own wayland connection. Everything the
+ * command prints goes back to the client, followed by a NUL byte, the exit
+ * status digit and a newline.
+ */
+
+#define MAX_LINE 4096
+
+static bool
+socket_path(struct sockaddr_un *addr)
+{
+	const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+	if (!runtime_dir) {
+		return false;
+	}
+	const char *display = getenv("WAYLAND_DISPLAY");
+	if (!display) {
+		display = "wayland-0";
+	} else if (strrchr(display, '/')) {
+		display = strrchr(display, '/') + 1;
+	}
+
+	addr->sun_family = AF_UNIX;
+	int len = snprintf(addr->sun_path, sizeof addr->sun_path,
+		"%s/wlrctl-%s.sock", runtime_dir, display);
+	return len > 0 && (size_t)len < sizeof addr->sun_path;
+}
+
+static int
+connect_socket(const struct sockaddr_un *addr)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	if (connect(fd, (const struct sockaddr *)addr, sizeof *addr) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int
+listen_socket(const struct sockaddr_un *addr)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		die("Could not create socket: %s\n", strerror(errno));
+	}
+	if (bind(fd, (const struct sockaddr *)addr, sizeof *addr) < 0) {
+		int other = errno == EADDRINUSE ? connect_socket(addr) : -1;
+		if (errno != EADDRINUSE || other >= 0) {
+			die("Could not bind %s: %s\n", addr->sun_path,
+				other >= 0 ? "another daemon is running" : strerror(errno));
+		}
+		// Left behind by a daemon that did not exit cleanly
+		unlink(addr->sun_path);
+		if (bind(fd, (const struct sockaddr *)addr, sizeof *addr) < 0) {
+			die("Could not bind %s: %s\n", addr->sun_path, strerror(errno));
+		}
+	}
+	if (listen(fd, 16) < 0) {
+		die("Could not listen on %s: %s\n", addr->sun_path, strerror(errno));
+	}
+	return fd;
+}
+
+static bool
+execute(struct wlrctl *state, int argc, char *argv[])
+{
+	// None of a command that dies may be left for the next one
+	jmp_buf env;
+	if (setjmp(env)) {
+		set_die_handler(NULL);
+		abandon_command(state);
+		loop_set_timeout(state, 0);
+		state->started = false;
+		state->failed = true;
+		state->cmd = NULL;
+		return false;
+	}
+	set_die_handler(&env);
+
+	if (argc < 0) {
+		die("Malformed command\n");
+	}
+	if (!prepare_command(state, argc, argv)) {
+		die("Unknown command: '%s'\n", argv[0]);
+	}
+	loop_set_timeout(state, state->timeout);
+	run_command(state);
+	loop_set_timeout(state, 0);
+
+	set_die_handler(NULL);
+	return !state->failed;
+}
+
+static void
+handle_line(struct wlrctl *state, int fd, char *line)
+{
+	char *argv[MAX_ARGS];
+	int argc = split_args(line, argv, MAX_ARGS);
+	if (argc == 0) {
+		return;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	int saved_stdout = dup(STDOUT_FILENO);
+	int saved_stderr = dup(STDERR_FILENO);
+	dup2(fd, STDOUT_FILENO);
+	dup2(fd, STDERR_FILENO);
+
+	bool ok = execute(state, argc, argv);
+
+	fflush(stdout);
+	fflush(stderr);
+	dup2(saved_stdout, STDOUT_FILENO);
+	dup2(saved_stderr, STDERR_FILENO);
+	close(saved_stdout);
+	close(saved_stderr);
+
+	const char status[] = {'\0', ok ? '0' : '1', '\n'};
+	if (write(fd, status, sizeof status) < 0) {
+		// The client went away, we notice when reading from it
+	}
+}
+
+/*
+ * Read what is available from the client and run every complete line.
+ * Returns false once the client is done.
+ */
+static bool
+handle_client(struct wlrctl *state, int fd, char buf[], size_t *len)
+{
+	ssize_t n = read(fd, buf + *len, MAX_LINE - *len);
+	if (n < 0 && errno == EINTR) {
+		return true;
+	}
+	if (n <= 0) {
+		// Run an unterminated last line
+		buf[*len] = '\0';
+		handle_line(state, fd, buf);
+		return false;
+	}
+	*len += n;
+
+	char *line = buf, *end;
+	while ((end = memchr(line, '\n', buf + *len - line))) {
+		*end = '\0';
+		handle_line(state, fd, line);
+		line = end + 1;
+		if (wl_display_get_error(state->display)) {
+			return false;
+		}
+	}
+	*len -= line - buf;
+	memmove(buf, line, *len);
+
+	if (*len == MAX_LINE) {
+		const char msg[] = "Command too long\n\0" "1\n";
+		if (write(fd, msg, sizeof msg - 1) < 0) {
+			// Dropping the client anyway
+		}
+		return false;
+	}
+	return true;
+}
+
+int
+run_daemon(struct wlrctl *state)
+{
+	struct sockaddr_un addr = {0};
+	if (!socket_path(&addr)) {
+		die("Could not determine socket path, is XDG_RUNTIME_DIR set?\n");
+	}
+	int listen_fd = listen_socket(&addr);
+	state->daemon = true;
+
+	// SIGINT and SIGTERM are handled by the event loop
+	signal(SIGPIPE, SIG_IGN);
+
+	// Clients are served one at a time, others wait in the listen backlog
+	int client_fd = -1;
+	char buf[MAX_LINE + 1];
+	size_t len = 0;
+
+	int status = EXIT_SUCCESS;
+	while (true) {
+		struct pollfd client = {
+			.fd = client_fd < 0 ? listen_fd : client_fd,
+			.events = POLLIN,
+		};
+		enum loop_status ret = loop_dispatch(state, &client);
+		if (ret == LOOP_INTERRUPTED) {
+			break;
+		} else if (ret == LOOP_ERROR) {
+			fprintf(stderr, "Lost connection to the compositor\n");
+			status = EXIT_FAILURE;
+			break;
+		}
+		if (!client.revents) {
+			continue;
+		}
+		if (client_fd < 0) {
+			client_fd = accept(listen_fd, NULL, NULL);
+			len = 0;
+		} else if (!handle_client(state, client_fd, buf, &len)) {
+			close(client_fd);
+			client_fd = -1;
+		}
+		if (wl_display_get_error(state->display)) {
+			fprintf(stderr, "Lost connection to the compositor\n");
+			status = EXIT_FAILURE;
+			break;
+		}
+		if (state->loop.interrupted) {
+			break;
+		}
+		if (state->running) {
+			fprintf(stderr, "Could not cancel a command that timed out\n");
+			status = EXIT_FAILURE;
+			break;
+		}
+	}
+
+	if (client_fd >= 0) {
+		close(client_fd);
+	}
+	close(listen_fd);
+	unlink(addr.sun_path);
+	return status;
+}
+
+static bool
+write_all(int fd, const char *data, size_t size)
+{
+	while (size > 0) {
+		ssize_t n = write(fd, data, size);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0) {
+			return false;
+		}
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool
+send_command(int fd, int argc, char *argv[])
+{
+	// Single quote every argument, so the daemon sees the same argv
+	for (int i = 0; i < argc; i++) {
+		if (!write_all(fd, i ? " '" : "'", i ? 2 : 1)) {
+			return false;
+		}
+		for (char *p = argv[i], *q; *p; p = q) {
+			q = strchr(p, '\'');
+			if (!q) {
+				q = p + strlen(p);
+			}
+			if (!write_all(fd, p, q - p)) {
+				return false;
+			}
+			if (*q == '\'') {
+				if (!write_all(fd, "'\\''", 4)) {
+					return false;
+				}
+				q++;
+			}
+		}
+		if (!write_all(fd, "'", 1)) {
+			return false;
+		}
+	}
+	return write_all(fd, "\n", 1);
+}
+
+/*
+ * Hand the command to a running daemon and relay its output. Returns false
+ * without side effects if there is no daemon to talk to.
+ */
+bool
+run_client(int argc, char *argv[], int *status)
+{
+	struct sockaddr_un addr = {0};
+	if (!socket_path(&addr)) {
+		return false;
+	}
+	int fd = connect_socket(&addr);
+	if (fd < 0) {
+		return false;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	if (!send_command(fd, argc, argv)) {
+		close(fd);
+		return false;
+	}
+
+	char buf[4096];
+	bool done = false;
+	*status = EXIT_FAILURE;
+	while (true) {
+		ssize_t n = read(fd, buf, sizeof buf);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n <= 0) {
+			break;
+		}
+		if (done) {
+			*status = buf[0] == '0' ? EXIT_SUCCESS : EXIT_FAILURE;
+			break;
+		}
+		char *nul = memchr(buf, '\0', n);
+		fwrite(buf, 1, nul ? nul - buf : n, stdout);
+		if (nul) {
+			done = true;
+			if (nul + 1 < buf + n) {
+				*status = nul[1] == '0' ? EXIT_SUCCESS : EXIT_FAILURE;
+				break;
+			}
+		}
+	}
+	close(fd);
+	return true;
+}
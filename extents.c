@@ -0,0 +1,133 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <wayland-client.h>
+#include "common.h"
+#include "extents.h"
+#include "heads.h"
+#include "loop.h"
+#include "util.h"
+
+#include "wlr-output-management-unstable-v1-client-protocol.h"
+
+struct extents_fetch {
+	struct output_heads heads;
+	bool done;
+};
+
+static void noop() {}
+
+static void
+manager_handle_head(void *data, struct zwlr_output_manager_v1 *manager,
+		struct zwlr_output_head_v1 *head)
+{
+	struct extents_fetch *fetch = data;
+	output_heads_add(&fetch->heads, head);
+}
+
+static void
+manager_handle_done(void *data, struct zwlr_output_manager_v1 *manager,
+		uint32_t serial)
+{
+	struct extents_fetch *fetch = data;
+	fetch->done = true;
+}
+
+static const struct zwlr_output_manager_v1_listener manager_listener = {
+	.head = manager_handle_head,
+	.done = manager_handle_done,
+	.finished = noop,
+};
+
+/*
+ * Where a head is in the layout: its mode, turned by its transform and
+ * shrunk by its scale, as wlroots has it.
+ */
+static bool
+head_box(const struct head_data *h, struct output_box *box)
+{
+	const struct mode_data *m = h->current_mode;
+	if (!m || h->scale <= 0) {
+		return false;
+	}
+	// The odd transforms turn the output on its side
+	bool turned = h->transform % 2 == 1;
+	*box = (struct output_box){
+		.x = h->x,
+		.y = h->y,
+		.width = (turned ? m->height : m->width) / h->scale,
+		.height = (turned ? m->width : m->height) / h->scale,
+		.refresh = m->refresh,
+	};
+	return box->width > 0 && box->height > 0;
+}
+
+/*
+ * Ask the output manager where the outputs are, and return the box around
+ * the enabled ones. Returns false if there is no output manager or no
+ * enabled output.
+ */
+bool
+output_extents_fetch(struct wlrctl *state, struct output_extents *extents)
+{
+	if (!state->output_mgr_name) {
+		return false;
+	}
+	struct zwlr_output_manager_v1 *manager = wl_registry_bind(state->registry,
+		state->output_mgr_name, &zwlr_output_manager_v1_interface, 2);
+	struct extents_fetch fetch = { .done = false };
+	output_heads_init(&fetch.heads);
+	zwlr_output_manager_v1_add_listener(manager, &manager_listener, &fetch);
+	// The heads and their modes come right after the bind
+	if (loop_roundtrip(state) != LOOP_OK) {
+		fetch.done = false;
+	}
+
+	memset(extents, 0, sizeof *extents);
+	int32_t x2 = 0, y2 = 0;
+	struct head_data *h;
+	wl_list_for_each(h, &fetch.heads.heads, link) {
+		struct output_box box;
+		if (!fetch.done || !h->enabled || extents->count == OUTPUT_EXTENTS_MAX_HEADS ||
+				!head_box(h, &box)) {
+			continue;
+		}
+		bool first = extents->count == 0;
+		if (first || box.x < extents->x) {
+			extents->x = box.x;
+		}
+		if (first || box.y < extents->y) {
+			extents->y = box.y;
+		}
+		if (first || box.x + box.width > x2) {
+			x2 = box.x + box.width;
+		}
+		if (first || box.y + box.height > y2) {
+			y2 = box.y + box.height;
+		}
+		extents->heads[extents->count++] = box;
+	}
+	extents->width = x2 - extents->x;
+	extents->height = y2 - extents->y;
+
+	output_heads_finish(&fetch.heads);
+	zwlr_output_manager_v1_stop(manager);
+	zwlr_output_manager_v1_destroy(manager);
+	return extents->count > 0;
+}
+
+/*
+ * The refresh rate of the output at x, y, or 0 if there is none there.
+ */
+int32_t
+output_extents_refresh_at(const struct output_extents *extents, double x, double y)
+{
+	for (size_t i = 0; i < extents->count; i++) {
+		const struct output_box *box = &extents->heads[i];
+		if (x >= box->x && x < box->x + box->width &&
+				y >= box->y && y < box->y + box->height) {
+			return box->refresh;
+		}
+	}
+	return 0;
+}
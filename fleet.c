@@ -0,0 +1,313 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <poll.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <wayland-client.h>
+#include "common.h"
+#include "fleet.h"
+#include "loop.h"
+#include "util.h"
+
+/*
+ * Fleet mode runs one command against many displays at once, each on its
+ * own connection and thread. What every display printed is buffered and
+ * shown once all of them are done, one display after the other, with each
+ * line prefixed by the display name.
+ */
+
+// Plenty for a command, and hundreds of threads stay cheap
+#define STACK_SIZE (256 * 1024)
+
+struct member {
+	char *display;
+	int argc;
+	char *argv[MAX_ARGS];
+	struct wlrctl state;
+	char *out, *err;
+	size_t out_size, err_size;
+	bool failed;
+	pthread_t thread;
+	struct fleet *fleet;
+};
+
+struct fleet {
+	struct member *members;
+	int count;
+	// Closed to stop every member
+	int cancel_fds[2];
+	// Written to by every member that is done
+	int done_fds[2];
+};
+
+static void
+add_member(struct fleet *fleet, const char *display)
+{
+	struct member *members =
+		realloc(fleet->members, (fleet->count + 1) * sizeof *members);
+	if (!members) {
+		die("Failed to allocate fleet\n");
+	}
+	fleet->members = members;
+	memset(&members[fleet->count], 0, sizeof *members);
+	members[fleet->count].display = strdup(display);
+	if (!members[fleet->count].display) {
+		die("Failed to allocate fleet\n");
+	}
+	members[fleet->count].fleet = fleet;
+	fleet->count++;
+}
+
+static bool
+is_socket(const char *path)
+{
+	struct stat st;
+	return stat(path, &st) == 0 && S_ISSOCK(st.st_mode);
+}
+
+/*
+ * Add the displays in a comma separated list. Entries with wildcards are
+ * matched against the sockets in $XDG_RUNTIME_DIR, or against absolute
+ * paths if they start with a '/'.
+ */
+static void
+add_members(struct fleet *fleet, const char *list)
+{
+	const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+	char *entries = strdup(list), *saveptr;
+	if (!entries) {
+		die("Failed to allocate fleet\n");
+	}
+	for (char *entry = strtok_r(entries, ",", &saveptr); entry;
+			entry = strtok_r(NULL, ",", &saveptr)) {
+		if (!strpbrk(entry, "*?[")) {
+			add_member(fleet, entry);
+			continue;
+		}
+
+		char pattern[4096];
+		if (entry[0] == '/') {
+			snprintf(pattern, sizeof pattern, "%s", entry);
+		} else if (runtime_dir) {
+			snprintf(pattern, sizeof pattern, "%s/%s", runtime_dir, entry);
+		} else {
+			die("XDG_RUNTIME_DIR is not set, can't match '%s'\n", entry);
+		}
+
+		glob_t matches;
+		if (glob(pattern, 0, NULL, &matches) != 0) {
+			continue;
+		}
+		for (size_t i = 0; i < matches.gl_pathc; i++) {
+			const char *path = matches.gl_pathv[i];
+			// Skip the lock files next to the sockets
+			if (!is_socket(path)) {
+				continue;
+			}
+			add_member(fleet, entry[0] == '/' ? path : strrchr(path, '/') + 1);
+		}
+		globfree(&matches);
+	}
+	free(entries);
+}
+
+static void *
+run_member(void *data)
+{
+	struct member *member = data;
+	struct wlrctl *state = &member->state;
+	volatile bool loop_ready = false;
+
+	state->out = open_memstream(&member->out, &member->out_size);
+	state->err = open_memstream(&member->err, &member->err_size);
+	if (!state->out || !state->err) {
+		member->failed = true;
+		goto done;
+	}
+	set_die_stream(state->err);
+
+	jmp_buf env;
+	if (setjmp(env)) {
+		// Whatever the connection was doing, it is of no use now
+		member->failed = true;
+		if (state->display) {
+			wl_display_disconnect(state->display);
+		}
+		goto cleanup;
+	}
+	set_die_handler(&env);
+
+	loop_init_shared(state, member->fleet->cancel_fds[0]);
+	loop_ready = true;
+	if (!prepare_command(state, member->argc, member->argv)) {
+		die("Unknown command: '%s'\n", member->argv[0]);
+	}
+	run_oneshot(state, member->display);
+	member->failed = state->failed;
+
+cleanup:
+	set_die_handler(NULL);
+	set_die_stream(NULL);
+	if (loop_ready) {
+		loop_finish(state);
+	}
+done:
+	if (state->out) {
+		fclose(state->out);
+	}
+	if (state->err) {
+		fclose(state->err);
+	}
+	if (write(member->fleet->done_fds[1], "", 1) < 0) {
+		// The main thread joins every member anyway
+	}
+	return NULL;
+}
+
+static void
+print_prefixed(FILE *stream, const char *display, const char *text, size_t size)
+{
+	const char *end = text + size;
+	while (text < end) {
+		const char *eol = memchr(text, '\n', end - text);
+		size_t len = eol ? (size_t)(eol - text) : (size_t)(end - text);
+		fprintf(stream, "%s: %.*s\n", display, (int)len, text);
+		text += len + 1;
+	}
+}
+
+static void
+raise_fd_limit(void)
+{
+	// Every display needs a connection and a few fds for its loop
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+}
+
+/*
+ * Run the command on every display in the list and return the combined exit
+ * status, which is a failure if the command failed on any of them.
+ */
+int
+run_fleet(struct wlrctl *proto, const char *displays, int argc, char *argv[])
+{
+	struct fleet fleet = {0};
+	add_members(&fleet, displays);
+	if (fleet.count == 0) {
+		die("No displays match '%s'\n", displays);
+	}
+	if (argc >= MAX_ARGS) {
+		die("Too many arguments\n");
+	}
+	raise_fd_limit();
+
+	sigset_t mask, saved_mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &mask, &saved_mask);
+	int signal_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+	if (signal_fd < 0 || pipe(fleet.cancel_fds) < 0 || pipe(fleet.done_fds) < 0) {
+		die("Could not set up the fleet: %s\n", strerror(errno));
+	}
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, STACK_SIZE);
+
+	int started = 0;
+	for (int i = 0; i < fleet.count; i++) {
+		struct member *member = &fleet.members[i];
+		// Parsing a command takes its arguments apart
+		member->argc = argc;
+		for (int j = 0; j < argc; j++) {
+			member->argv[j] = strdup(argv[j]);
+			if (!member->argv[j]) {
+				die("Failed to allocate fleet\n");
+			}
+		}
+		member->state.timeout = proto->timeout;
+		member->state.clock = proto->clock;
+
+		int ret = pthread_create(&member->thread, &attr, run_member, member);
+		if (ret != 0) {
+			fprintf(stderr, "%s: could not start a thread: %s\n",
+				member->display, strerror(ret));
+			member->failed = true;
+			member->thread = pthread_self();
+			continue;
+		}
+		started++;
+	}
+	pthread_attr_destroy(&attr);
+
+	// Wait for the members, and stop them all on SIGINT or SIGTERM
+	int done = 0;
+	bool cancelled = false;
+	while (done < started) {
+		struct pollfd fds[] = {
+			{ .fd = fleet.done_fds[0], .events = POLLIN },
+			{ .fd = cancelled ? -1 : signal_fd, .events = POLLIN },
+		};
+		if (poll(fds, 2, -1) < 0) {
+			continue;
+		}
+		if (fds[0].revents) {
+			char buf[256];
+			ssize_t n = read(fleet.done_fds[0], buf, sizeof buf);
+			done += n > 0 ? n : 0;
+		}
+		if (fds[1].revents) {
+			close(fleet.cancel_fds[1]);
+			fleet.cancel_fds[1] = -1;
+			cancelled = true;
+		}
+	}
+
+	int status = EXIT_SUCCESS;
+	for (int i = 0; i < fleet.count; i++) {
+		struct member *member = &fleet.members[i];
+		if (!pthread_equal(member->thread, pthread_self())) {
+			pthread_join(member->thread, NULL);
+		}
+		print_prefixed(stdout, member->display, member->out, member->out_size);
+		print_prefixed(stderr, member->display, member->err, member->err_size);
+		if (member->failed) {
+			if (member->err_size == 0) {
+				fprintf(stderr, "%s: failed\n", member->display);
+			}
+			status = EXIT_FAILURE;
+		}
+		free(member->out);
+		free(member->err);
+		for (int j = 0; j < member->argc; j++) {
+			free(member->argv[j]);
+		}
+		free(member->display);
+	}
+	free(fleet.members);
+
+	if (fleet.cancel_fds[1] >= 0) {
+		close(fleet.cancel_fds[1]);
+	}
+	close(fleet.cancel_fds[0]);
+	close(fleet.done_fds[0]);
+	close(fleet.done_fds[1]);
+	close(signal_fd);
+	pthread_sigmask(SIG_SETMASK, &saved_mask, NULL);
+	return status;
+}
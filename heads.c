@@ -0,0 +1,318 @@
+#include <string.h>
+#include <wayland-client.h>
+#include "arena.h"
+#include "heads.h"
+#include "wlr-output-management-unstable-v1-client-protocol.h"
+
+/*
+ * Keeps track of the heads an output manager announces and their modes, for
+ * the output command and for the pointer's output extents alike.
+ */
+
+static struct mode_data *
+mode_data_create(struct head_data *head_data) {
+	struct mode_data *mode_data =
+		arena_alloc(&head_data->heads->arena, sizeof (struct mode_data));
+	mode_data->head = head_data;
+	wl_list_insert(&head_data->modes, &mode_data->link);
+	return mode_data;
+}
+
+static void
+mode_data_destroy(struct mode_data *mode_data) {
+	// The record itself goes with the arena
+	zwlr_output_mode_v1_destroy(mode_data->mode);
+}
+
+static void
+zwlr_output_mode_v1_handle_size(
+	void *data,
+	struct zwlr_output_mode_v1 *mode,
+	int32_t width, int32_t height
+	)
+{
+	struct mode_data *mode_data = data;
+	mode_data->width = width;
+	mode_data->height = height;
+}
+
+static void
+zwlr_output_mode_v1_handle_refresh(
+	void *data,
+	struct zwlr_output_mode_v1 *mode,
+	int32_t refresh
+	)
+{
+	struct mode_data *mode_data = data;
+	mode_data->refresh = refresh;
+}
+
+static void
+zwlr_output_mode_v1_handle_preferred(
+	void *data,
+	struct zwlr_output_mode_v1 *mode
+	)
+{
+	struct mode_data *mode_data = data;
+	mode_data->preferred = true;
+}
+
+static void
+zwlr_output_mode_v1_handle_finished(
+	void *data,
+	struct zwlr_output_mode_v1 *mode
+	)
+{
+	struct mode_data *mode_data = data;
+	struct mode_data *other, *tmp;
+	wl_list_for_each_safe(other, tmp, &mode_data->head->modes, link) {
+		if (other == mode_data) {
+			wl_list_remove(&other->link);
+			mode_data_destroy(mode_data);
+		}
+	}
+	if (mode_data->head->current_mode == mode_data) {
+		mode_data->head->current_mode = NULL;
+	}
+}
+
+static struct zwlr_output_mode_v1_listener
+zwlr_output_mode_v1_listener = {
+	.size = zwlr_output_mode_v1_handle_size,
+	.refresh = zwlr_output_mode_v1_handle_refresh,
+	.preferred = zwlr_output_mode_v1_handle_preferred,
+	.finished = zwlr_output_mode_v1_handle_finished,
+};
+
+static void
+head_data_destroy(struct head_data *head_data) {
+	struct mode_data *mode_data, *tmp;
+	wl_list_for_each_safe(mode_data, tmp, &head_data->modes, link) {
+		wl_list_remove(&mode_data->link);
+		mode_data_destroy(mode_data);
+	}
+	zwlr_output_head_v1_destroy(head_data->head);
+}
+
+static void
+zwlr_output_head_v1_handle_name(
+	void *data,
+	struct zwlr_output_head_v1 *head,
+	const char *name
+	)
+{
+	struct head_data *head_data = data;
+	strncpy(head_data->name, name, 24);
+	head_data->name[24 - 1] = '\0';
+}
+
+static void
+zwlr_output_head_v1_handle_make(
+	void *data,
+	struct zwlr_output_head_v1 *head,
+	const char *make
+	)
+{
+	struct head_data *head_data = data;
+	strncpy(head_data->make, make, 56);
+	head_data->make[56 - 1] = '\0';
+}
+
+static void
+zwlr_output_head_v1_handle_model(
+	void *data,
+	struct zwlr_output_head_v1 *head,
+	const char *model
+	)
+{
+	struct head_data *head_data = data;
+	strncpy(head_data->model, model, 16);
+	head_data->model[16 - 1] = '\0';
+}
+
+static void
+zwlr_output_head_v1_handle_serial_number(
+	void *data,
+	struct zwlr_output_head_v1 *head,
+	const char *serial
+	)
+{
+	struct head_data *head_data = data;
+	strncpy(head_data->serial, serial, 16);
+	head_data->serial[16 - 1] = '\0';
+}
+
+static void
+wlrctl_output_head_v1_handle_physical_size(
+	void *data,
+	struct zwlr_output_head_v1 *head,
+	int32_t width, int32_t height
+	)
+{
+	struct head_data *head_data = data;
+	head_data->width = width;
+	head_data->height = height;
+}
+
+static void
+wlrctl_output_head_v1_handle_enabled(
+	void *data,
+	struct zwlr_output_head_v1 *head,
+	int32_t enabled
+	)
+{
+	struct head_data *head_data = data;
+	head_data->enabled = enabled;
+}
+
+static void
+wlrctl_output_head_v1_handle_position(
+	void *data,
+	struct zwlr_output_head_v1 *head,
+	int32_t x, int32_t y
+	)
+{
+	struct head_data *head_data = data;
+	head_data->x = x;
+	head_data->y = y;
+}
+
+static void
+wlrctl_output_head_v1_handle_transform(
+	void *data,
+	struct zwlr_output_head_v1 *head,
+	int32_t transform
+	)
+{
+	struct head_data *head_data = data;
+	head_data->transform = transform;
+}
+
+static void
+zwlr_output_head_v1_handle_description(
+	void *data,
+	struct zwlr_output_head_v1 *head,
+	const char *description
+	)
+{
+	struct head_data *head_data = data;
+	head_data->description = arena_strset(&head_data->heads->arena,
+		head_data->description, description);
+}
+
+static void
+zwlr_output_head_v1_handle_scale(
+	void *data,
+	struct zwlr_output_head_v1 *head,
+	wl_fixed_t scale
+	)
+{
+	struct head_data *head_data = data;
+	head_data->scale = wl_fixed_to_double(scale);
+}
+
+static void
+zwlr_output_head_v1_handle_finished(
+	void *data,
+	struct zwlr_output_head_v1 *head
+	)
+{
+	struct head_data *head_data = data;
+	struct head_data *other, *tmp;
+	wl_list_for_each_safe(other, tmp, &head_data->heads->heads, link) {
+		if (other == head_data) {
+			wl_list_remove(&other->link);
+			head_data_destroy(other);
+		}
+	}
+}
+
+static void
+zwlr_output_head_v1_handle_mode(
+	void *data,
+	struct zwlr_output_head_v1 *head,
+	struct zwlr_output_mode_v1 *mode
+	)
+{
+	struct head_data *head_data = data;
+	struct mode_data *mode_data = mode_data_create(head_data);
+	mode_data->mode = mode;
+	zwlr_output_mode_v1_add_listener(
+		mode,
+		&zwlr_output_mode_v1_listener,
+		mode_data
+	);
+}
+
+static void
+zwlr_output_head_v1_handle_current_mode(
+	void *data,
+	struct zwlr_output_head_v1 *head,
+	struct zwlr_output_mode_v1 *mode
+	)
+{
+	struct head_data *head_data = data;
+	struct mode_data *mode_data;
+	wl_list_for_each(mode_data, &head_data->modes, link) {
+		if (mode_data->mode == mode) {
+			head_data->current_mode = mode_data;
+			return;
+		}
+	}
+}
+
+static struct zwlr_output_head_v1_listener
+zwlr_output_head_v1_listener = {
+	.name = zwlr_output_head_v1_handle_name,
+	.description = zwlr_output_head_v1_handle_description,
+	.physical_size = wlrctl_output_head_v1_handle_physical_size,
+	.mode = zwlr_output_head_v1_handle_mode,
+	.enabled = wlrctl_output_head_v1_handle_enabled,
+	.current_mode = zwlr_output_head_v1_handle_current_mode,
+	.position = wlrctl_output_head_v1_handle_position,
+	.transform = wlrctl_output_head_v1_handle_transform,
+	.scale = zwlr_output_head_v1_handle_scale,
+	.finished = zwlr_output_head_v1_handle_finished,
+	.make = zwlr_output_head_v1_handle_make,
+	.model = zwlr_output_head_v1_handle_model,
+	.serial_number = zwlr_output_head_v1_handle_serial_number,
+};
+
+void
+output_heads_init(struct output_heads *heads)
+{
+	wl_list_init(&heads->heads);
+	heads->arena = (struct arena){0};
+}
+
+/*
+ * Follow a head the manager announced, and the modes it comes with.
+ */
+void
+output_heads_add(struct output_heads *heads, struct zwlr_output_head_v1 *head)
+{
+	struct head_data *head_data =
+		arena_alloc(&heads->arena, sizeof (struct head_data));
+	wl_list_init(&head_data->modes);
+	wl_list_insert(&heads->heads, &head_data->link);
+	head_data->heads = heads;
+	head_data->head = head;
+	// Until the compositor says otherwise
+	head_data->scale = 1.0;
+	zwlr_output_head_v1_add_listener(
+		head,
+		&zwlr_output_head_v1_listener,
+		head_data
+	);
+}
+
+void
+output_heads_finish(struct output_heads *heads)
+{
+	struct head_data *data;
+	wl_list_for_each(data, &heads->heads, link) {
+		head_data_destroy(data);
+	}
+	arena_release(&heads->arena);
+	wl_list_init(&heads->heads);
+}
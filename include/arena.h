@@ -0,0 +1,22 @@
+#ifndef WLRCTL_ARENA_H
+#define WLRCTL_ARENA_H
+
+#include <stddef.h>
+
+/*
+ * A bump allocator for records that live as long as a command. There is no
+ * way to free a single allocation, everything goes at once.
+ */
+struct arena {
+	struct arena_block *blocks;
+	// Bytes reserved from the system, which is also the peak, as nothing is
+	// given back before the arena is released
+	size_t size;
+};
+
+void *arena_alloc(struct arena *arena, size_t size);
+char *arena_strdup(struct arena *arena, const char *str);
+char *arena_strset(struct arena *arena, char *old, const char *str);
+void arena_release(struct arena *arena);
+
+#endif
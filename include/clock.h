@@ -0,0 +1,29 @@
+#ifndef WLRCTL_CLOCK_H
+#define WLRCTL_CLOCK_H
+
+#include <stdint.h>
+
+enum wlrctl_clock_type {
+	WLRCTL_CLOCK_MONOTONIC = 0,
+	WLRCTL_CLOCK_VIRTUAL,
+};
+
+/*
+ * The time input events are stamped with. Events sent together form a batch
+ * and share one reading, kept in nanoseconds. The virtual clock starts at
+ * zero and only moves when told to, so the same input always produces the
+ * same events.
+ */
+struct wlrctl_clock {
+	enum wlrctl_clock_type type;
+	uint64_t now; // ns at the start of the current batch
+};
+
+void clock_init(struct wlrctl_clock *clock);
+uint32_t clock_begin_batch(struct wlrctl_clock *clock);
+uint32_t clock_event_time(const struct wlrctl_clock *clock);
+uint64_t clock_now(const struct wlrctl_clock *clock);
+void clock_advance(struct wlrctl_clock *clock, uint64_t ns);
+uint32_t clock_resume(struct wlrctl_clock *clock, uint64_t slept_ns);
+
+#endif
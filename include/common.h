@@ -2,6 +2,11 @@
 #define WLRCTL_COMMON_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "clock.h"
+#include "loop.h"
 
 enum wlrctl_command {
 	WLRCTL_COMMAND_UNSPEC = 0,
@@ -9,6 +14,27 @@ enum wlrctl_command {
 	WLRCTL_COMMAND_POINTER,
 	WLRCTL_COMMAND_TOPLEVEL,
 	WLRCTL_COMMAND_OUTPUT,
+	WLRCTL_COMMAND_REPLAY,
+	// One device of the load generator, never given on the command line
+	WLRCTL_COMMAND_LOAD,
+};
+
+// The keymap the virtual keyboard has
+enum wlrctl_keymap {
+	WLRCTL_KEYMAP_NONE = 0,
+	WLRCTL_KEYMAP_ASCII,
+	WLRCTL_KEYMAP_GENERATED, // wlrctl::generated
+	WLRCTL_KEYMAP_LAYOUT,
+	WLRCTL_KEYMAP_KEYSYMS,
+};
+
+struct wlrctl_timing {
+	uint64_t mark;
+	uint64_t connect, registry, action, drain;
+	// The largest arena a command needed
+	size_t arena_peak;
+	// Keymaps uploaded to type text
+	unsigned int keymap_switches;
 };
 
 struct wlrctl {
@@ -16,15 +42,53 @@ struct wlrctl {
 	struct wl_display *display;
 	struct wl_registry *registry;
 	struct wl_seat *seat;
+	uint32_t seat_caps;
+	bool seat_caps_known;
 	struct zwp_virtual_keyboard_manager_v1 *vkbd_mgr;
 	struct zwlr_foreign_toplevel_manager_v1 *ftl_mgr;
 	struct zwlr_virtual_pointer_manager_v1 *vp_mgr;
 	struct zwlr_output_manager_v1 *output_mgr;
 
+	// Names of the globals that are bound anew for every command
+	uint32_t ftl_mgr_name, output_mgr_name;
+
+	// Virtual devices, created on first use and kept for the session
+	struct zwp_virtual_keyboard_v1 *vkbd;
+	struct zwlr_virtual_pointer_v1 *vptr;
+	enum wlrctl_keymap vkbd_keymap;
+	// The seat keyboard's keymap, as last seen
+	struct layout *layout;
+	// The keymap last made up to type text, kept while it has what's typed
+	struct keymap *generated;
+	// Keys named by keysym, and which of them are held down
+	struct keyboard_keys *keys;
+	// Pointer buttons held down, as bits from BTN_MOUSE
+	uint16_t buttons;
+
 	// State
-	bool running, failed;
+	bool started, running, failed;
+	// More than one command runs on this connection
+	bool persistent;
+	// Input commands leave the sync barrier to the caller
+	bool batch;
+	// Commands come from the daemon's clients, stdin is not theirs
+	bool daemon;
 	enum wlrctl_command cmd_type;
 	void *cmd;
+	// Starts a one shot command as soon as its globals are known
+	struct wlrctl_timer start_timer;
+	struct wlrctl_timing timing;
+	// How long a command may take, 0 for no limit
+	uint64_t timeout;
+	// Where commands print their results and complaints
+	FILE *out, *err;
+	struct wlrctl_clock clock;
+	struct wlrctl_loop loop;
 };
 
+bool prepare_command(struct wlrctl *state, int argc, char *argv[]);
+void run_command(struct wlrctl *state);
+void abandon_command(struct wlrctl *state);
+void run_oneshot(struct wlrctl *state, const char *name);
+
 #endif
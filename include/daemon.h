@@ -0,0 +1,11 @@
+#ifndef WLRCTL_DAEMON_H
+#define WLRCTL_DAEMON_H
+
+#include <stdbool.h>
+
+struct wlrctl;
+
+int run_daemon(struct wlrctl *state);
+bool run_client(int argc, char *argv[], int *status);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef WLRCTL_EXTENTS_H
+#define WLRCTL_EXTENTS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct wlrctl;
+
+#define OUTPUT_EXTENTS_MAX_HEADS 16
+
+struct output_box {
+	int32_t x, y;
+	int32_t width, height;
+	int32_t refresh; // mHz
+};
+
+/*
+ * The box around the enabled outputs, in layout coordinates, which is what
+ * absolute pointer motion is a fraction of, and the outputs in it.
+ */
+struct output_extents {
+	int32_t x, y;
+	int32_t width, height;
+	struct output_box heads[OUTPUT_EXTENTS_MAX_HEADS];
+	size_t count;
+};
+
+bool output_extents_fetch(struct wlrctl *state, struct output_extents *extents);
+int32_t output_extents_refresh_at(const struct output_extents *extents,
+	double x, double y);
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef WLRCTL_FLEET_H
+#define WLRCTL_FLEET_H
+
+int run_fleet(struct wlrctl *proto, const char *displays, int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef WLRCTL_HEADS_H
+#define WLRCTL_HEADS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <wayland-client.h>
+#include "arena.h"
+
+struct zwlr_output_head_v1;
+struct zwlr_output_mode_v1;
+
+/*
+ * The heads of an output manager and their modes, as far as its events
+ * have come.
+ */
+struct output_heads {
+	struct wl_list heads; // head_data::link
+	// Backs the head and mode records and their strings
+	struct arena arena;
+};
+
+struct head_data {
+	char name[24];
+	char model[16];
+	char make[56];
+	char serial[16];
+	char *description;
+	int32_t x, y, width, height;
+	struct wl_list modes;
+	bool enabled;
+	struct mode_data *current_mode;
+	enum wl_output_transform transform;
+	double scale;
+	struct wl_list link;
+	struct output_heads *heads;
+	struct zwlr_output_head_v1 *head;
+};
+
+struct mode_data {
+	int32_t width, height;
+	int32_t refresh;
+	bool preferred;
+	struct head_data *head;
+	struct wl_list link; //head_data::modes
+	struct zwlr_output_mode_v1 *mode;
+};
+
+void output_heads_init(struct output_heads *heads);
+void output_heads_add(struct output_heads *heads, struct zwlr_output_head_v1 *head);
+void output_heads_finish(struct output_heads *heads);
+
+#endif
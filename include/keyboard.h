@@ -1,28 +1,102 @@
 #ifndef WLRCTL_DEV_KEYBOARD_H
 #define WLRCTL_DEV_KEYBOARD_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "keymap.h"
+#include "loop.h"
+
+struct wl_callback;
+
 enum keyboard_action {
 	KEYBOARD_ACTION_UNSPEC = 0,
 	KEYBOARD_ACTION_TYPE,
+	KEYBOARD_ACTION_STREAM,
+	KEYBOARD_ACTION_KEY,
+	KEYBOARD_ACTION_PRESS,
+	KEYBOARD_ACTION_RELEASE,
+};
+
+#define KEYBOARD_STREAM_WINDOW 4
+
+/*
+ * Text typed from a file or stdin, a chunk at a time. Regular files are
+ * mapped, anything else is read as it comes.
+ */
+struct keyboard_stream {
+	char *path; // NULL for stdin
+	int fd;
+	const char *map;
+	size_t map_size;
+	char *buf;
+	size_t buffered;
+	bool readable, eof;
+	// Bytes of text typed so far
+	size_t offset;
+	// Chunks the compositor has not confirmed yet, oldest first
+	struct wl_callback *acks[KEYBOARD_STREAM_WINDOW];
+	int outstanding;
+	// Types the next chunk once one is confirmed
+	struct wlrctl_timer pump;
+	size_t keys;
+	uint64_t start;
+	struct wlrctl_watch watch;
+};
+
+/*
+ * Keys pressed in order, held for a while, then released in reverse order.
+ * The keysyms are a range of wlrctl_keyboard_command::keysyms.
+ */
+struct keyboard_chord {
+	size_t first, count;
+	uint64_t hold; // ns
+};
+
+/*
+ * The keys of the keysym keymap, by keycode from KEYMAP_MIN_KEYCODE. Keys
+ * keep their keycodes for the session, so they can be held down from one
+ * command to the next and released whatever happens in between.
+ */
+struct keyboard_keys {
+	uint32_t keysyms[KEYMAP_KEYS];
+	size_t count;
+	bool held[KEYMAP_KEYS];
+	// Modifiers of the keys held down
+	uint32_t mods;
+	// Keys were added since the keymap was last uploaded
+	bool changed;
 };
 
 struct wlrctl_keyboard_command {
 	enum keyboard_action action;
-	char *text;
+	uint32_t *codepoints;
+	size_t len;
 	int mods_depressed;
+	// Type with the keymap the seat has rather than one of our own
+	bool use_layout;
+	struct keyboard_stream stream;
+	// Keys for key, press and release
+	uint32_t *keysyms;
+	size_t keysym_count;
+	// By keysym, whether this command put the key down
+	bool *pressed;
+	struct keyboard_chord *chords;
+	size_t chord_count;
+	// The chord being played and whether its keys are down
+	size_t chord;
+	bool holding;
+	struct wlrctl_timer timer;
 
 	struct zwp_virtual_keyboard_v1 *device;
-	struct xkb_context *xkb_context;
-	struct {
-		uint32_t format;
-		uint32_t size;
-		int fd;
-	} keymap;
 	struct wlrctl *state;
 };
 
+uint32_t keyboard_parse_modifiers(const char *list);
 void prepare_keyboard(struct wlrctl *state, int argc, char *argv[]);
 void run_keyboard(struct wlrctl *state);
+void cancel_keyboard(struct wlrctl *state);
 void destroy_keyboard(struct wlrctl *state);
+void keyboard_release_all(struct wlrctl *state);
 
 #endif
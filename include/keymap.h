@@ -0,0 +1,41 @@
+#ifndef WLRCTL_KEYMAP_H
+#define WLRCTL_KEYMAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Keycodes up to 255, as far as X11 clients can follow. Keycode 8 would be
+// evdev code 0, which is reserved.
+#define KEYMAP_MIN_KEYCODE 9
+#define KEYMAP_MAX_KEYCODE 255
+#define KEYMAP_KEYS (KEYMAP_MAX_KEYCODE - KEYMAP_MIN_KEYCODE + 1)
+#define KEYMAP_MAX_LEVELS 4
+#define KEYMAP_CAPACITY (KEYMAP_KEYS * KEYMAP_MAX_LEVELS)
+
+/*
+ * A keymap made up for a set of code points, with every code point on a key
+ * of its own, or on a higher level of a key when there are more code points
+ * than keys. The levels are reached through Mod3 and Mod5, which leaves
+ * Shift, Control, Alt and Super for the user.
+ */
+struct keymap {
+	uint32_t *codepoints; // sorted, distinct
+	size_t count;
+	int levels;
+	char *text; // xkb source
+	size_t size; // of the text, with the NUL
+};
+
+bool keymap_generate(struct keymap *keymap, const uint32_t *codepoints, size_t count);
+bool keymap_lookup(const struct keymap *keymap, uint32_t codepoint,
+	uint32_t *keycode, uint32_t *mods);
+bool keymap_generate_keysyms(struct keymap *keymap, const uint32_t *keysyms,
+	size_t count);
+uint32_t keymap_keysym_modifier(uint32_t keysym);
+void keymap_finish(struct keymap *keymap);
+size_t keymap_segment(const uint32_t *codepoints, size_t count);
+int keymap_open(const char *text, size_t size);
+int keymap_open_anonymous(const char *text, size_t size);
+
+#endif
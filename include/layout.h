@@ -0,0 +1,30 @@
+#ifndef WLRCTL_LAYOUT_H
+#define WLRCTL_LAYOUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct layout_key {
+	uint32_t codepoint;
+	uint32_t keycode; // evdev
+	uint32_t mods;
+};
+
+/*
+ * The keymap the seat's keyboard has, and the keys and modifiers that type
+ * each code point in its first layout.
+ */
+struct layout {
+	char *text; // as the compositor sent it
+	size_t size;
+	struct layout_key *keys; // sorted by code point, one per code point
+	size_t count;
+};
+
+bool layout_compile(struct layout *layout, const char *text, size_t size);
+bool layout_lookup(const struct layout *layout, uint32_t codepoint,
+	uint32_t *keycode, uint32_t *mods);
+void layout_finish(struct layout *layout);
+
+#endif
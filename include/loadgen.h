@@ -0,0 +1,49 @@
+#ifndef WLRCTL_LOADGEN_H
+#define WLRCTL_LOADGEN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "loop.h"
+
+// Syncs waiting on the compositor before a device holds back
+#define LOAD_WINDOW 16
+
+/*
+ * One device of the load generator, driven on a connection of its own at a
+ * share of the total rate. Events are sent every tick, as many as are due,
+ * with a sync behind each batch to time the compositor's roundtrip.
+ */
+struct wlrctl_load_command {
+	bool pointer;
+	double rate; // events/s
+	uint64_t duration, tick; // ns
+	uint64_t start;
+	// Events sent, and given up on for being too far behind
+	size_t sent, dropped;
+	// Events sent a tick or more after they were due, and the most owed
+	size_t late, backlog_max;
+	// Flushes the socket was too full for
+	size_t stalls;
+	// Roundtrips of the syncs, in ns
+	uint64_t *rtts;
+	size_t rtt_count, rtt_size;
+	// When the syncs waiting on the compositor were sent, oldest first
+	uint64_t syncs[LOAD_WINDOW];
+	size_t sync_head;
+	int outstanding;
+	// Events still owed after the last tick
+	size_t owed;
+	bool key_down;
+	bool done;
+	uint64_t end, stopped;
+	struct wlrctl_timer timer;
+	struct wlrctl *state;
+};
+
+bool load_ready(struct wlrctl *state);
+void run_load(struct wlrctl *state);
+void cancel_load(struct wlrctl *state);
+int run_loadgen(struct wlrctl *proto, int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef WLRCTL_LOOP_H
+#define WLRCTL_LOOP_H
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <wayland-util.h>
+
+struct wlrctl;
+
+enum loop_status {
+	LOOP_OK = 0,
+	LOOP_ERROR,
+	LOOP_TIMEOUT,
+	LOOP_INTERRUPTED,
+};
+
+typedef void (*wlrctl_timer_func)(struct wlrctl *state, void *data);
+
+/*
+ * A one shot timer, owned by whoever adds it to the loop.
+ */
+struct wlrctl_timer {
+	uint64_t deadline; // now_ns() clock
+	wlrctl_timer_func func;
+	void *data;
+	struct wl_list link; // wlrctl_loop::timers
+};
+
+typedef void (*wlrctl_watch_func)(struct wlrctl *state, void *data);
+
+/*
+ * A file descriptor to wait on along with the display, for the command that
+ * is running. The loop has room for one.
+ */
+struct wlrctl_watch {
+	int fd;
+	short events;
+	wlrctl_watch_func func;
+	void *data;
+};
+
+struct wlrctl_loop {
+	int signal_fd;
+	int deadline_fd;
+	int timer_fd;
+	struct wl_list timers; // wlrctl_timer::link, soonest first
+	struct wlrctl_watch *watch;
+	bool timed_out, interrupted;
+	// One of several loops in the process, see loop_init_shared
+	bool shared;
+};
+
+void loop_init(struct wlrctl *state);
+void loop_init_shared(struct wlrctl *state, int cancel_fd);
+void loop_finish(struct wlrctl *state);
+void loop_set_timeout(struct wlrctl *state, uint64_t timeout_ns);
+void loop_add_timer(struct wlrctl *state, struct wlrctl_timer *timer);
+void loop_remove_timer(struct wlrctl *state, struct wlrctl_timer *timer);
+void loop_clear_timers(struct wlrctl *state);
+void loop_set_watch(struct wlrctl *state, struct wlrctl_watch *watch);
+enum loop_status loop_dispatch(struct wlrctl *state, struct pollfd *extra);
+enum loop_status loop_roundtrip(struct wlrctl *state);
+
+#endif
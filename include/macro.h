@@ -0,0 +1,71 @@
+#ifndef WLRCTL_MACRO_H
+#define WLRCTL_MACRO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "loop.h"
+
+/*
+ * A compiled macro is a header, an array of events, and the keymaps the
+ * events refer to, all in the byte order of the machine that compiled it.
+ * Every event maps onto one request of the virtual devices, or a wait.
+ */
+
+#define MACRO_MAGIC "WLRCTLM"
+#define MACRO_VERSION 2
+
+// Devices a macro uses
+#define MACRO_KEYBOARD (1 << 0)
+#define MACRO_POINTER (1 << 1)
+
+enum macro_op {
+	MACRO_KEYMAP = 1, // a: offset in the file, b: size with the NUL
+	MACRO_KEY, // a: evdev keycode, b: state
+	MACRO_MODIFIERS, // a: depressed
+	MACRO_MOTION, // a, b: dx, dy as wl_fixed_t
+	MACRO_BUTTON, // a: button, b: state
+	MACRO_AXIS_SOURCE, // a: source
+	MACRO_AXIS, // a: axis, b: value as wl_fixed_t
+	MACRO_AXIS_STOP, // a: axis
+	MACRO_FRAME,
+	MACRO_WAIT, // a, b: nanoseconds, low and high half
+};
+
+struct macro_event {
+	uint32_t op;
+	uint32_t a, b;
+};
+
+struct macro_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t devices;
+	uint64_t count; // events, right after the header
+};
+
+struct wlrctl_replay_command {
+	char *path;
+	const unsigned char *map;
+	size_t size;
+	const struct macro_event *events;
+	size_t count, pos;
+	uint32_t devices;
+
+	uint64_t start; // now_ns() when replay began
+	uint64_t elapsed; // total of the waits so far
+	uint64_t slept; // the wait before the current batch
+	uint32_t mods;
+	// Buttons the replay holds down, as bits from BTN_MOUSE
+	uint16_t buttons;
+	struct wlrctl_timer timer;
+	struct wlrctl *state;
+};
+
+int compile_macro(int argc, char *argv[]);
+void prepare_replay(struct wlrctl *state, int argc, char *argv[]);
+void run_replay(struct wlrctl *state);
+void cancel_replay(struct wlrctl *state);
+void destroy_replay(struct wlrctl *state);
+
+#endif
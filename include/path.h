@@ -0,0 +1,39 @@
+#ifndef WLRCTL_PATH_H
+#define WLRCTL_PATH_H
+
+#include <stddef.h>
+
+enum path_curve {
+	PATH_CURVE_UNSPEC = 0,
+	PATH_CURVE_LINEAR,
+	PATH_CURVE_BEZIER,
+	PATH_CURVE_SPLINE,
+};
+
+struct path_point {
+	double x, y;
+};
+
+/*
+ * A curve through or along a few points, walked with t from 0 to 1.
+ * Linear paths go through the points at constant speed, Bezier paths have
+ * them as control points, and splines (Catmull-Rom) go through them with
+ * smooth turns.
+ */
+struct path {
+	enum path_curve curve;
+	struct path_point *points;
+	size_t count;
+	// Linear: distance from the start to each point
+	double *lengths;
+	// Bezier: room for de Casteljau's algorithm
+	struct path_point *scratch;
+};
+
+enum path_curve path_parse_curve(const char *name);
+void path_init(struct path *path, enum path_curve curve,
+	const struct path_point *points, size_t count);
+struct path_point path_eval(const struct path *path, double t);
+void path_finish(struct path *path);
+
+#endif
@@ -1,24 +1,157 @@
 #ifndef WLRCTL_DEV_POINTER_H
 #define WLRCTL_DEV_POINTER_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "extents.h"
+#include "loop.h"
+#include "path.h"
+
 enum pointer_action {
 	POINTER_ACTION_UNSPEC = 0,
 	POINTER_ACTION_CLICK,
 	POINTER_ACTION_MOTION,
 	POINTER_ACTION_SCROLL,
+	POINTER_ACTION_MOVETO,
+	POINTER_ACTION_CLICKAT,
+	POINTER_ACTION_PATH,
+	POINTER_ACTION_STREAM,
+	POINTER_ACTION_DRAG,
+	POINTER_ACTION_PRESS,
+	POINTER_ACTION_RELEASE,
+	POINTER_ACTION_DOUBLECLICK,
+	POINTER_ACTION_TRIPLECLICK,
+	POINTER_ACTION_WHEEL,
+	POINTER_ACTION_KINETIC,
+};
+
+enum pointer_record_type {
+	POINTER_RECORD_MOTION = 1,
+	POINTER_RECORD_BUTTON,
+	POINTER_RECORD_AXIS,
+};
+
+/*
+ * A binary stream record, in native byte order. Motions have dx and dy in
+ * a and b, buttons the evdev code in code and the wl_pointer button state
+ * in a, and axes the wl_pointer axis in code and the value in a. Motions
+ * and axis values are wl_fixed_t.
+ */
+struct pointer_record {
+	uint16_t type;
+	uint16_t code;
+	int32_t a, b;
+};
+
+/*
+ * Scrolling spread over frames at a steady rate: wheel detents, a few to a
+ * frame, or a swipe that slows down to a stop. Frame n, from 1, is due at
+ * start + (n - 1) * period.
+ */
+struct pointer_scroll {
+	// Detents for the wheel, or the distance of the swipe
+	double dy, dx;
+	size_t per_frame;
+	uint64_t duration; // ns, for a swipe
+	double rate; // Hz
+	uint64_t start, period;
+	size_t frame, frames;
+	// Sent so far, in detents for the wheel and wl_fixed_t for a swipe
+	int32_t sent_y, sent_x;
+	struct wlrctl_timer timer;
+};
+
+#define POINTER_STREAM_BUTTONS 16
+#define POINTER_MAX_STEPS 6
+
+/*
+ * A press or release of the command's button, in a frame of its own, at a
+ * time from the start of the command.
+ */
+struct pointer_step {
+	uint64_t at; // ns
+	bool pressed;
+};
+
+/*
+ * Pointer events read from a file or stdin as they come, as text lines or
+ * as binary records.
+ */
+struct pointer_stream {
+	char *path; // NULL for stdin
+	int fd;
+	bool binary;
+	char *buf;
+	size_t buffered;
+	bool readable, eof;
+	size_t line;
+	// Motion to send, with what was lost to wl_fixed_t rounding so far
+	double dx, dy;
+	bool moving;
+	// Buttons the stream pressed, released at the end
+	uint32_t held[POINTER_STREAM_BUTTONS];
+	size_t held_count;
+	// Batches the compositor has not confirmed yet
+	int outstanding;
+	// Sends the next batch once one is confirmed
+	struct wlrctl_timer pump;
+	size_t records, frames;
+	uint64_t start;
+	struct wlrctl_watch watch;
+};
+
+/*
+ * A path the cursor follows one frame at a time, at a steady rate. Frames
+ * are due at start + n * period, so late ones don't push the rest back.
+ */
+struct pointer_path {
+	struct path path;
+	// Held down along the way, for a drag
+	uint32_t button;
+	uint64_t duration; // ns
+	double rate; // Hz, 0 for the refresh rate of the output it starts on
+	uint64_t start, period;
+	// The next frame due, of frames + 1 counting the one at the start
+	size_t frame, frames;
+	size_t sent, dropped;
+	// How late the frames went out, in ns, for the jitter
+	double late_sum, late_sq;
+	uint64_t late_max;
+	uint64_t last;
+	struct wlrctl_timer timer;
 };
 
 struct wlrctl_pointer_command {
 	enum pointer_action action;
 	uint32_t button;
 	wl_fixed_t dx, dy;
+	// Where to move to, in layout coordinates
+	double x, y;
+	struct output_extents extents;
+	struct pointer_path path;
+	struct pointer_stream stream;
+	struct pointer_scroll scroll;
+	// The presses and releases of press and the multi-clicks
+	struct pointer_step steps[POINTER_MAX_STEPS];
+	size_t step_count, step;
+	uint64_t start;
+	uint32_t time;
+	struct wlrctl_timer timer;
+	// The command has its button down, and will let go of it
+	bool holding;
 
 	struct zwlr_virtual_pointer_v1 *device;
 	struct wlrctl *state;
 };
 
+uint32_t pointer_parse_button(const char *button);
+bool pointer_needs_outputs(const struct wlrctl_pointer_command *cmd);
 void prepare_pointer(struct wlrctl *state, int argc, char *argv[]);
 void run_pointer(struct wlrctl *state);
+void cancel_pointer(struct wlrctl *state);
+void pointer_track_button(struct wlrctl *state, uint32_t button, bool pressed);
 void destroy_pointer(struct wlrctl *state);
+void pointer_release_all(struct wlrctl *state);
 
 #endif
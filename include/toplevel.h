@@ -1,6 +1,9 @@
 #ifndef WLRCTL_TOPLEVEL_H
 #define WLRCTL_TOPLEVEL_H
 
+#include <stdint.h>
+#include "arena.h"
+
 enum toplevel_attr {
 	TOPLEVEL_ATTR_UNSPEC     = 0,
 	TOPLEVEL_ATTR_APPID      = 1<<1,
@@ -43,6 +46,9 @@ struct wlrctl_toplevel_command {
 	bool any;
 	bool complete;
 	int waiting;
+	struct wl_callback *sync;
+	// Backs the toplevel records and their strings
+	struct arena arena;
 	struct wlrctl *state;
 };
 
@@ -50,7 +56,8 @@ struct wlrctl_toplevel_command {
 struct toplevel_data {
 	char *app_id;
 	char *title;
-	struct wl_array state;
+	uint32_t state; // bit per zwlr_foreign_toplevel_handle_v1_state
+	struct zwlr_foreign_toplevel_handle_v1 *handle;
 	struct zwlr_foreign_toplevel_handle_v1 *parent;
 	struct wl_list link;
 	struct wlrctl_toplevel_command *cmd;
@@ -60,6 +67,7 @@ struct toplevel_data {
 void prepare_toplevel(struct wlrctl *state, int argc, char **argv);
 void run_toplevel(struct wlrctl *state);
 void stop_toplevel(struct wlrctl *state);
+void cancel_toplevel(struct wlrctl *state);
 void destroy_toplevel(struct wlrctl *state);
 
 #endif
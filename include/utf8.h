@@ -0,0 +1,11 @@
+#ifndef WLRCTL_UTF8_H
+#define WLRCTL_UTF8_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+size_t utf8_decode(const char *str, size_t len, uint32_t *out, size_t *error);
+size_t utf8_decode_scalar(const char *str, size_t len, uint32_t *out, size_t *error);
+size_t utf8_complete(const char *str, size_t len);
+
+#endif
@@ -1,6 +1,10 @@
 #ifndef WLRCTL_UTIL_H
 #define WLRCTL_UTIL_H
 
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+
 struct token {
 	const char *name;
 	int value;
@@ -9,8 +13,16 @@ struct token {
 
 int matchtok(const struct token tokens[], const char *name);
 
-int timestamp();
+#define MAX_ARGS 64
+
+int split_args(char *line, char *argv[], int max);
+
+uint64_t now_ns();
 
 void die(const char *fmt, ...);
 
+jmp_buf *set_die_handler(jmp_buf *env);
+
+void set_die_stream(FILE *stream);
+
 #endif
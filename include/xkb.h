@@ -0,0 +1,32 @@
+#ifndef WLRCTL_XKB_H
+#define WLRCTL_XKB_H
+
+#include <xkbcommon/xkbcommon.h>
+
+#define XKB_FUNCS(X) \
+	X(context_new) \
+	X(context_unref) \
+	X(keymap_new_from_string) \
+	X(keymap_unref) \
+	X(keymap_key_for_each) \
+	X(keymap_num_layouts_for_key) \
+	X(keymap_num_levels_for_key) \
+	X(keymap_key_get_syms_by_level) \
+	X(keymap_key_get_mods_for_level) \
+	X(keysym_from_name) \
+	X(keysym_to_utf32)
+
+/*
+ * The parts of libxkbcommon wlrctl uses. The library is only loaded when a
+ * keymap has to be compiled or a keysym looked up, commands that never do
+ * that don't pay for loading it.
+ */
+struct xkb_api {
+#define X(name) __typeof__(&xkb_##name) name;
+	XKB_FUNCS(X)
+#undef X
+};
+
+const struct xkb_api *xkb_load(void);
+
+#endif
@@ -1,7 +1,9 @@
 #define _GNU_SOURCE
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,64 +12,418 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <wayland-client.h>
-#include <xkbcommon/xkbcommon.h>
+#include "clock.h"
 #include "common.h"
 #include "keyboard.h"
+#include "keymap.h"
+#include "layout.h"
+#include "utf8.h"
 #include "util.h"
+#include "xkb.h"
 
 #include "virtual-keyboard-unstable-v1-client-protocol.h"
 
 extern const char keymap_ascii_raw[];
 
 static void
-get_keymap(struct wlrctl_keyboard_command *cmd)
-{
-	int size = strlen(keymap_ascii_raw) + 1;
-#if defined(MEMFD_CREATE)
-	int fd = memfd_create("keymap", 0);
-#elif defined(__FreeBSD__)
-	// memfd_create on FreeBSD 13 is SHM_ANON without sealing support
-	int fd = shm_open(SHM_ANON, O_RDWR, 0600);
-#else
-	char name[] = "/tmp/keymap-XXXXXX";
-	int fd = mkstemp(name);
-	unlink(name);
-#endif
-	if(ftruncate(fd, size) < 0) {
-		die("Could not allocate shm for keymap\n");
-	};
+send_keymap(struct zwp_virtual_keyboard_v1 *kbd, int fd, size_t size)
+{
+	zwp_virtual_keyboard_v1_keymap(kbd, WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1, fd, size);
+	close(fd);
+}
+
+// For the keymaps worth keeping for the next run
+static void
+upload_keymap(struct zwp_virtual_keyboard_v1 *kbd, const char *keymap, size_t size)
+{
+	send_keymap(kbd, keymap_open(keymap, size), size);
+}
+
+static void
+send_key(struct zwp_virtual_keyboard_v1 *kbd, uint32_t time, char c)
+{
+	zwp_virtual_keyboard_v1_key(kbd, time, c - 8, WL_KEYBOARD_KEY_STATE_PRESSED);
+	zwp_virtual_keyboard_v1_key(kbd, time, c - 8, WL_KEYBOARD_KEY_STATE_RELEASED);
+}
+
+static void
+keyboard_type(struct wlrctl_keyboard_command *cmd, const uint32_t *codepoints,
+		size_t len)
+{
+	uint32_t time = clock_begin_batch(&cmd->state->clock);
+	for (size_t i = 0; i < len; i++) {
+		send_key(cmd->device, time, codepoints[i]);
+	}
+}
+
+/*
+ * Type a segment of text with a keymap made up for it. Shift, Control, Alt
+ * and Super stay as the user asked, the keymap levels only use modifiers of
+ * their own.
+ */
+static void
+type_segment(struct wlrctl_keyboard_command *cmd, uint32_t time,
+		const struct keymap *keymap, const uint32_t *codepoints, size_t len)
+{
+	uint32_t mods = cmd->mods_depressed;
+	for (size_t i = 0; i < len; i++) {
+		uint32_t keycode, level_mods;
+		keymap_lookup(keymap, codepoints[i], &keycode, &level_mods);
+		if ((cmd->mods_depressed | level_mods) != mods) {
+			mods = cmd->mods_depressed | level_mods;
+			zwp_virtual_keyboard_v1_modifiers(cmd->device, mods, 0, 0, 0);
+		}
+		zwp_virtual_keyboard_v1_key(cmd->device, time, keycode, WL_KEYBOARD_KEY_STATE_PRESSED);
+		zwp_virtual_keyboard_v1_key(cmd->device, time, keycode, WL_KEYBOARD_KEY_STATE_RELEASED);
+	}
+	if (mods != (uint32_t)cmd->mods_depressed) {
+		zwp_virtual_keyboard_v1_modifiers(cmd->device, cmd->mods_depressed, 0, 0, 0);
+	}
+}
 
-	void *keymap_data =
-		mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-	strcpy(keymap_data, keymap_ascii_raw);
-	munmap(keymap_data, size);
+/*
+ * How many of the code points, from the first on, the keymap has keys for.
+ */
+static size_t
+keymap_covers(const struct keymap *keymap, const uint32_t *codepoints, size_t len)
+{
+	size_t i = 0;
+	uint32_t keycode, mods;
+	while (i < len && keymap_lookup(keymap, codepoints[i], &keycode, &mods)) {
+		i++;
+	}
+	return i;
+}
 
-	cmd->keymap.format = WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1;
-	cmd->keymap.fd = fd;
-	cmd->keymap.size = size;
+/*
+ * Make a keymap for as much of the text as one can type, and keep it for the
+ * session in place of the last one. Return how many code points it covers.
+ */
+static size_t
+plan_keymap(struct wlrctl *state, const uint32_t *codepoints, size_t len)
+{
+	size_t segment = keymap_segment(codepoints, len);
+	struct keymap keymap;
+	if (!keymap_generate(&keymap, codepoints, segment)) {
+		die("Can't type more than %d distinct characters at once\n",
+			KEYMAP_CAPACITY);
+	}
+	if (!state->generated) {
+		state->generated = malloc(sizeof *state->generated);
+		if (!state->generated) {
+			keymap_finish(&keymap);
+			die("Failed to allocate keymap\n");
+		}
+	} else {
+		keymap_finish(state->generated);
+	}
+	*state->generated = keymap;
+	// The device has the old one, if any
+	if (state->vkbd_keymap == WLRCTL_KEYMAP_GENERATED) {
+		state->vkbd_keymap = WLRCTL_KEYMAP_NONE;
+	}
+	return segment;
 }
 
 static void
-send_key(struct zwp_virtual_keyboard_v1 *kbd, char c)
+use_generated(struct wlrctl_keyboard_command *cmd)
 {
-	zwp_virtual_keyboard_v1_key(kbd, timestamp(), c - 8, WL_KEYBOARD_KEY_STATE_PRESSED);
-	zwp_virtual_keyboard_v1_key(kbd, timestamp(), c - 8, WL_KEYBOARD_KEY_STATE_RELEASED);
+	struct wlrctl *state = cmd->state;
+	if (state->vkbd_keymap != WLRCTL_KEYMAP_GENERATED) {
+		// Made for this text, the cache has no use for it
+		send_keymap(cmd->device, keymap_open_anonymous(state->generated->text,
+			state->generated->size), state->generated->size);
+		state->vkbd_keymap = WLRCTL_KEYMAP_GENERATED;
+		state->timing.keymap_switches++;
+	}
 }
 
+/*
+ * Type text that is not all ASCII. The keymap made for earlier text does as
+ * long as it has every character, a new one is only made for a character it
+ * lacks, and then for as much of the rest as it can hold.
+ */
 static void
-keyboard_type(struct wlrctl_keyboard_command *cmd, const char *text)
+keyboard_type_unicode(struct wlrctl_keyboard_command *cmd,
+		const uint32_t *codepoints, size_t len)
 {
-	int len = strlen(text);
-	for (int i = 0; i < len; i++) {
-		send_key(cmd->device, text[i]);
+	struct wlrctl *state = cmd->state;
+	uint32_t time = clock_begin_batch(&state->clock);
+	size_t pos = 0;
+	while (pos < len) {
+		size_t segment = 0;
+		if (state->generated) {
+			segment = keymap_covers(state->generated, codepoints + pos, len - pos);
+		}
+		if (segment == 0) {
+			segment = plan_keymap(state, codepoints + pos, len - pos);
+		}
+		use_generated(cmd);
+		type_segment(cmd, time, state->generated, codepoints + pos, segment);
+		pos += segment;
+	}
+}
+
+static bool
+is_ascii(const uint32_t codepoints[], size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		if (codepoints[i] >= 0x80) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void
+type_codepoints(struct wlrctl_keyboard_command *cmd, const uint32_t *codepoints,
+		size_t len)
+{
+	struct wlrctl *state = cmd->state;
+	// A generated keymap on the device stays as long as it has every
+	// character, so that a stream of mixed text doesn't switch back and
+	// forth between chunks
+	if (!is_ascii(codepoints, len) ||
+			(state->vkbd_keymap == WLRCTL_KEYMAP_GENERATED &&
+			keymap_covers(state->generated, codepoints, len) == len)) {
+		keyboard_type_unicode(cmd, codepoints, len);
+		return;
+	}
+	// The ASCII keymap stays until something else needs the device
+	if (state->vkbd_keymap != WLRCTL_KEYMAP_ASCII) {
+		upload_keymap(cmd->device, keymap_ascii_raw, strlen(keymap_ascii_raw) + 1);
+		state->vkbd_keymap = WLRCTL_KEYMAP_ASCII;
+	}
+	keyboard_type(cmd, codepoints, len);
+}
+
+static void
+send_mods(struct wlrctl_keyboard_command *cmd, uint32_t *current, uint32_t mods)
+{
+	if (mods != *current) {
+		zwp_virtual_keyboard_v1_modifiers(cmd->device, mods, 0, 0, 0);
+		*current = mods;
+	}
+}
+
+// Modifiers of the keys held down with keyboard press
+static uint32_t
+held_mods(const struct wlrctl *state)
+{
+	return state->keys ? state->keys->mods : 0;
+}
+
+static void
+use_layout(struct wlrctl_keyboard_command *cmd)
+{
+	struct wlrctl *state = cmd->state;
+	if (state->vkbd_keymap != WLRCTL_KEYMAP_LAYOUT) {
+		upload_keymap(cmd->device, state->layout->text, state->layout->size);
+		state->vkbd_keymap = WLRCTL_KEYMAP_LAYOUT;
+	}
+}
+
+/*
+ * Make one generated keymap for every character of the text the layout has
+ * no key for, unless the one from before already has them all, so that each
+ * run of them doesn't need a keymap of its own.
+ */
+static void
+plan_fallback(struct wlrctl *state, const uint32_t *codepoints, size_t len)
+{
+	uint32_t *missing = NULL;
+	size_t count = 0;
+	bool uncovered = false;
+	for (size_t i = 0; i < len; i++) {
+		uint32_t keycode, mods;
+		if (layout_lookup(state->layout, codepoints[i], &keycode, &mods)) {
+			continue;
+		}
+		if (!missing) {
+			missing = malloc(len * sizeof *missing);
+			if (!missing) {
+				die("Failed to allocate text\n");
+			}
+		}
+		missing[count++] = codepoints[i];
+		uncovered |= !state->generated ||
+			!keymap_lookup(state->generated, codepoints[i], &keycode, &mods);
+	}
+	// More than one keymap holds are left to keyboard_type_unicode
+	if (uncovered) {
+		plan_keymap(state, missing, count);
+	}
+	free(missing);
+}
+
+/*
+ * Type with the keymap the seat already has, so that clients don't see the
+ * keymap change. Characters it has no key for are typed through a generated
+ * keymap, and the seat's keymap comes back once they are done.
+ */
+static void
+type_with_layout(struct wlrctl_keyboard_command *cmd, const uint32_t *codepoints,
+		size_t len)
+{
+	const struct layout *layout = cmd->state->layout;
+	if (!layout) {
+		type_codepoints(cmd, codepoints, len);
+		return;
+	}
+
+	plan_fallback(cmd->state, codepoints, len);
+	uint32_t time = clock_begin_batch(&cmd->state->clock);
+	uint32_t mods = cmd->mods_depressed;
+	size_t i = 0;
+	while (i < len) {
+		uint32_t keycode, key_mods;
+		if (layout_lookup(layout, codepoints[i], &keycode, &key_mods)) {
+			use_layout(cmd);
+			send_mods(cmd, &mods, cmd->mods_depressed | key_mods);
+			zwp_virtual_keyboard_v1_key(cmd->device, time, keycode, WL_KEYBOARD_KEY_STATE_PRESSED);
+			zwp_virtual_keyboard_v1_key(cmd->device, time, keycode, WL_KEYBOARD_KEY_STATE_RELEASED);
+			i++;
+			continue;
+		}
+
+		size_t end = i + 1;
+		while (end < len && !layout_lookup(layout, codepoints[end], &keycode, &key_mods)) {
+			end++;
+		}
+		send_mods(cmd, &mods, cmd->mods_depressed);
+		keyboard_type_unicode(cmd, codepoints + i, end - i);
+		i = end;
+	}
+	send_mods(cmd, &mods, cmd->mods_depressed);
+	use_layout(cmd);
+}
+
+/*
+ * The keymap the seat's keyboard sent, mapped as it is. Compiling it may
+ * fail, so that waits until the roundtrip is over.
+ */
+struct layout_fetch {
+	char *text;
+	size_t size;
+};
+
+static void
+layout_keymap(void *data, struct wl_keyboard *keyboard, uint32_t format,
+		int32_t fd, uint32_t size)
+{
+	struct layout_fetch *fetch = data;
+	if (format != WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1 || size == 0) {
+		close(fd);
+		return;
+	}
+	char *text = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (text == MAP_FAILED) {
+		return;
+	}
+	// Only the last one counts
+	if (fetch->text) {
+		munmap(fetch->text, fetch->size);
+	}
+	fetch->text = text;
+	fetch->size = size;
+}
+
+static void noop() {}
+
+static const struct wl_keyboard_listener layout_listener = {
+	.keymap = layout_keymap,
+	.enter = noop,
+	.leave = noop,
+	.key = noop,
+	.modifiers = noop,
+	.repeat_info = noop,
+};
+
+static void
+update_layout(struct wlrctl *state, const char *text, size_t size)
+{
+	// Most of the time, the keymap is the one we already know
+	struct layout *layout = state->layout;
+	if (layout && size >= layout->size - 1 &&
+			memcmp(text, layout->text, layout->size - 1) == 0 &&
+			(size == layout->size - 1 || text[layout->size - 1] == '\0')) {
+		return;
+	}
+
+	struct layout compiled;
+	if (!layout_compile(&compiled, text, size)) {
+		return;
+	}
+	if (!layout) {
+		layout = malloc(sizeof *layout);
+		if (!layout) {
+			layout_finish(&compiled);
+			die("Failed to allocate layout\n");
+		}
+	} else {
+		layout_finish(layout);
+	}
+	*layout = compiled;
+	state->layout = layout;
+	// Whatever the device had, it's not this one
+	if (state->vkbd_keymap == WLRCTL_KEYMAP_LAYOUT) {
+		state->vkbd_keymap = WLRCTL_KEYMAP_NONE;
+	}
+}
+
+/*
+ * Find out which keymap the seat's keyboard has right now. If there is no
+ * keyboard or no keymap to be had, state->layout stays as it was.
+ */
+static void
+fetch_layout(struct wlrctl *state)
+{
+	if (!state->seat_caps_known && loop_roundtrip(state) != LOOP_OK) {
+		return;
+	}
+	if (!(state->seat_caps & WL_SEAT_CAPABILITY_KEYBOARD)) {
+		return;
+	}
+	// Whatever keymap comes, it takes libxkbcommon to read it
+	xkb_load();
+
+	struct layout_fetch fetch = {0};
+	struct wl_keyboard *keyboard = wl_seat_get_keyboard(state->seat);
+	wl_keyboard_add_listener(keyboard, &layout_listener, &fetch);
+	loop_roundtrip(state);
+	if (wl_keyboard_get_version(keyboard) >= WL_KEYBOARD_RELEASE_SINCE_VERSION) {
+		wl_keyboard_release(keyboard);
+	} else {
+		wl_keyboard_destroy(keyboard);
+	}
+
+	if (fetch.text) {
+		update_layout(state, fetch.text, fetch.size);
+		munmap(fetch.text, fetch.size);
+	}
+}
+
+static void
+type_text(struct wlrctl_keyboard_command *cmd, const uint32_t *codepoints, size_t len)
+{
+	if (cmd->use_layout) {
+		type_with_layout(cmd, codepoints, len);
+	} else {
+		type_codepoints(cmd, codepoints, len);
 	}
 }
 
 static void
 complete_keyboard(void *data, struct wl_callback *callback, uint32_t serial)
 {
-	struct wlrctl *state = data;
+	struct wlrctl_keyboard_command *cmd = data;
+	struct wlrctl *state = cmd->state;
 	wl_callback_destroy(callback);
+	if (state->cmd != cmd) {
+		// The command failed and was given up on
+		return;
+	}
 	state->running = false;
 	destroy_keyboard(state);
 }
@@ -76,25 +432,611 @@ static struct wl_callback_listener completed_listener = {
 	.done = complete_keyboard
 };
 
+/*
+ * Streams are typed in chunks of at most STREAM_CHUNK bytes, with up to
+ * STREAM_WINDOW of them waiting for the compositor to catch up. A chunk is
+ * no more than a few dozen KiB of requests, so the window fits the socket
+ * buffer and the connection never has to give up on a full one.
+ */
+#define STREAM_CHUNK 512
+#define STREAM_WINDOW KEYBOARD_STREAM_WINDOW
+
+static void stream_pump(struct wlrctl_keyboard_command *cmd);
+
+static void
+stream_finish(struct wlrctl_keyboard_command *cmd)
+{
+	struct keyboard_stream *stream = &cmd->stream;
+	struct wlrctl *state = cmd->state;
+	double elapsed = (now_ns() - stream->start) / 1e9;
+	fprintf(state->err, "Typed %zu keys in %.3f s, %.0f keys/s\n",
+		stream->keys, elapsed, elapsed > 0 ? stream->keys / elapsed : 0);
+	state->running = false;
+	destroy_keyboard(state);
+}
+
+static void
+stream_acked(void *data, struct wl_callback *callback, uint32_t serial)
+{
+	struct wlrctl_keyboard_command *cmd = data;
+	struct keyboard_stream *stream = &cmd->stream;
+	wl_callback_destroy(callback);
+	if (cmd->state->cmd != cmd) {
+		// The command failed and was given up on
+		return;
+	}
+	// The compositor answers syncs in order
+	stream->outstanding--;
+	memmove(stream->acks, stream->acks + 1, stream->outstanding * sizeof *stream->acks);
+	// The text may be bad, which must not come up in a listener
+	if (wl_list_empty(&stream->pump.link)) {
+		stream->pump.deadline = now_ns();
+		loop_add_timer(cmd->state, &stream->pump);
+	}
+}
+
+static struct wl_callback_listener stream_listener = {
+	.done = stream_acked
+};
+
+static void
+stream_readable(struct wlrctl *state, void *data)
+{
+	struct wlrctl_keyboard_command *cmd = data;
+	cmd->stream.readable = true;
+	stream_pump(cmd);
+}
+
+static void
+stream_pumped(struct wlrctl *state, void *data)
+{
+	stream_pump(data);
+}
+
+/*
+ * Take the next chunk of text, or return false if there is none yet.
+ */
+static bool
+stream_next(struct keyboard_stream *stream, const char **chunk, size_t *len)
+{
+	if (stream->map) {
+		size_t left = stream->map_size - stream->offset;
+		*chunk = stream->map + stream->offset;
+		*len = left < STREAM_CHUNK ? left : utf8_complete(*chunk, STREAM_CHUNK);
+		stream->eof = *len == left;
+		return true;
+	}
+
+	if (!stream->readable) {
+		return false;
+	}
+	stream->readable = false;
+	// There are at most 3 bytes left over from a character cut in half
+	ssize_t n = read(stream->fd, stream->buf + stream->buffered, STREAM_CHUNK);
+	if (n < 0) {
+		if (errno == EINTR || errno == EAGAIN) {
+			return false;
+		}
+		die("Could not read the text: %s\n", strerror(errno));
+	}
+	stream->buffered += n;
+	stream->eof = n == 0;
+	*chunk = stream->buf;
+	*len = stream->eof ? stream->buffered : utf8_complete(stream->buf, stream->buffered);
+	return true;
+}
+
+/*
+ * Type chunks until the window is full or the text runs out, and finish
+ * once the compositor has seen all of it.
+ */
+static void
+stream_pump(struct wlrctl_keyboard_command *cmd)
+{
+	struct keyboard_stream *stream = &cmd->stream;
+	struct wlrctl *state = cmd->state;
+	if (state->cmd != cmd) {
+		// The command failed and was given up on
+		return;
+	}
+
+	const char *chunk;
+	size_t len;
+	while (stream->outstanding < STREAM_WINDOW && !stream->eof &&
+			stream_next(stream, &chunk, &len)) {
+		if (len == 0 && !stream->eof) {
+			// Only part of a character so far
+			continue;
+		}
+		size_t error;
+		size_t count = utf8_decode(chunk, len, cmd->codepoints, &error);
+		if (error != len) {
+			die("Invalid UTF-8 at byte %zu of the text\n", stream->offset + error);
+		}
+		type_text(cmd, cmd->codepoints, count);
+		stream->keys += count;
+		stream->offset += len;
+		if (stream->buf) {
+			stream->buffered -= len;
+			memmove(stream->buf, stream->buf + len, stream->buffered);
+		}
+		if (stream->eof && (uint32_t)cmd->mods_depressed != held_mods(state)) {
+			zwp_virtual_keyboard_v1_modifiers(cmd->device, held_mods(state), 0, 0, 0);
+		}
+
+		struct wl_callback *callback = wl_display_sync(state->display);
+		wl_callback_add_listener(callback, &stream_listener, cmd);
+		stream->acks[stream->outstanding++] = callback;
+		wl_display_flush(state->display);
+	}
+
+	// Stop reading while the compositor is behind
+	bool want_input = !stream->map && !stream->eof &&
+		stream->outstanding < STREAM_WINDOW;
+	loop_set_watch(state, want_input ? &stream->watch : NULL);
+
+	if (stream->eof && stream->outstanding == 0) {
+		stream_finish(cmd);
+	}
+}
+
+/*
+ * Give up on a stream midway: nothing it waits for may call back, and the
+ * modifiers it typed with go back to the ones held down.
+ */
+static void
+stream_stop(struct wlrctl_keyboard_command *cmd)
+{
+	struct keyboard_stream *stream = &cmd->stream;
+	struct wlrctl *state = cmd->state;
+	for (int i = 0; i < stream->outstanding; i++) {
+		wl_callback_destroy(stream->acks[i]);
+	}
+	stream->outstanding = 0;
+	if (!wl_list_empty(&stream->pump.link)) {
+		loop_remove_timer(state, &stream->pump);
+	}
+	loop_set_watch(state, NULL);
+	zwp_virtual_keyboard_v1_modifiers(cmd->device, held_mods(state), 0, 0, 0);
+	wl_display_flush(state->display);
+}
+
+static void
+stream_open(struct wlrctl_keyboard_command *cmd)
+{
+	struct keyboard_stream *stream = &cmd->stream;
+	if (stream->path) {
+		stream->fd = open(stream->path, O_RDONLY | O_CLOEXEC);
+		if (stream->fd < 0) {
+			die("Could not open '%s': %s\n", stream->path, strerror(errno));
+		}
+	} else {
+		stream->fd = STDIN_FILENO;
+	}
+
+	struct stat st;
+	if (fstat(stream->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		stream->map_size = st.st_size;
+		void *map = mmap(NULL, stream->map_size, PROT_READ, MAP_PRIVATE,
+			stream->fd, 0);
+		if (map == MAP_FAILED) {
+			die("Could not map the text: %s\n", strerror(errno));
+		}
+		madvise(map, stream->map_size, MADV_SEQUENTIAL);
+		stream->map = map;
+	} else {
+		stream->buf = malloc(STREAM_CHUNK + 3);
+		if (!stream->buf) {
+			die("Failed to allocate text\n");
+		}
+		stream->watch.fd = stream->fd;
+		stream->watch.events = POLLIN;
+		stream->watch.func = stream_readable;
+		stream->watch.data = cmd;
+	}
+
+	cmd->codepoints = malloc((STREAM_CHUNK + 3) * sizeof *cmd->codepoints);
+	if (!cmd->codepoints) {
+		die("Failed to allocate text\n");
+	}
+	stream->pump.func = stream_pumped;
+	stream->pump.data = cmd;
+	stream->start = now_ns();
+}
+
+// Keys by name
+
+static const struct token key_aliases[] = {
+	{"ctrl", XKB_KEY_Control_L},
+	{"control", XKB_KEY_Control_L},
+	{"shift", XKB_KEY_Shift_L},
+	{"alt", XKB_KEY_Alt_L},
+	{"super", XKB_KEY_Super_L},
+	{"logo", XKB_KEY_Super_L},
+	{"enter", XKB_KEY_Return},
+	{"esc", XKB_KEY_Escape},
+	{"del", XKB_KEY_Delete},
+	{NULL, XKB_KEY_NoSymbol},
+};
+
+static uint32_t
+parse_keysym(const char *name)
+{
+	uint32_t keysym = matchtok(key_aliases, name);
+	if (keysym != XKB_KEY_NoSymbol) {
+		return keysym;
+	}
+	const struct xkb_api *xkb = xkb_load();
+	keysym = xkb->keysym_from_name(name, XKB_KEYSYM_NO_FLAGS);
+	if (keysym == XKB_KEY_NoSymbol) {
+		keysym = xkb->keysym_from_name(name, XKB_KEYSYM_CASE_INSENSITIVE);
+	}
+	if (keysym == XKB_KEY_NoSymbol) {
+		die("Unknown key: '%s'\n", name);
+	}
+	return keysym;
+}
+
+/*
+ * Parse chords like ctrl+shift+t, or super:500 to hold the keys down for
+ * that many milliseconds.
+ */
+static void
+parse_chords(struct wlrctl_keyboard_command *cmd, int argc, char *argv[],
+		bool hold)
+{
+	size_t max = 0;
+	for (int i = 0; i < argc; i++) {
+		max++;
+		for (const char *c = argv[i]; *c; c++) {
+			max += *c == '+';
+		}
+	}
+	cmd->keysyms = malloc((max ? max : 1) * sizeof *cmd->keysyms);
+	cmd->pressed = calloc(max ? max : 1, sizeof *cmd->pressed);
+	cmd->chords = calloc(argc > 0 ? (size_t)argc : 1, sizeof *cmd->chords);
+	if (!cmd->keysyms || !cmd->pressed || !cmd->chords) {
+		die("Failed to allocate keys\n");
+	}
+
+	for (int i = 0; i < argc; i++) {
+		char *keys = strdup(argv[i]);
+		struct keyboard_chord *chord = &cmd->chords[cmd->chord_count++];
+		chord->first = cmd->keysym_count;
+		char *colon = strrchr(keys, ':');
+		if (colon) {
+			char *end;
+			double ms = strtod(colon + 1, &end);
+			if (!hold) {
+				die("Keys can only be held for a while with 'key'\n");
+			} else if (end == colon + 1 || *end || !(ms >= 0)) {
+				die("Invalid hold time: '%s'\n", colon + 1);
+			}
+			chord->hold = ms * 1e6;
+			*colon = '\0';
+		}
+		char *saveptr;
+		for (char *name = strtok_r(keys, "+", &saveptr); name;
+				name = strtok_r(NULL, "+", &saveptr)) {
+			cmd->keysyms[cmd->keysym_count++] = parse_keysym(name);
+		}
+		chord->count = cmd->keysym_count - chord->first;
+		if (chord->count == 0) {
+			die("Missing key in '%s'\n", argv[i]);
+		}
+		free(keys);
+	}
+	if (cmd->keysym_count > KEYMAP_KEYS) {
+		die("Can't use more than %d keys at once\n", KEYMAP_KEYS);
+	}
+}
+
+static int
+find_key(const struct keyboard_keys *keys, uint32_t keysym)
+{
+	for (size_t k = 0; k < keys->count; k++) {
+		if (keys->keysyms[k] == keysym) {
+			return k;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Put every key the command names in the keysym keymap, and make sure the
+ * device has it. Keys keep the keycodes they have, unless the keymap runs
+ * out of room while none are held.
+ */
+static void
+use_keys(struct wlrctl_keyboard_command *cmd)
+{
+	struct wlrctl *state = cmd->state;
+	if (!state->keys) {
+		state->keys = calloc(1, sizeof *state->keys);
+		if (!state->keys) {
+			die("Failed to allocate keys\n");
+		}
+	}
+	struct keyboard_keys *keys = state->keys;
+
+	size_t missing = 0;
+	for (size_t i = 0; i < cmd->keysym_count; i++) {
+		missing += find_key(keys, cmd->keysyms[i]) < 0;
+	}
+	if (keys->count + missing > KEYMAP_KEYS) {
+		for (size_t k = 0; k < keys->count; k++) {
+			if (keys->held[k]) {
+				die("Too many different keys while some are held\n");
+			}
+		}
+		keys->count = 0;
+		keys->changed = true;
+	}
+	for (size_t i = 0; i < cmd->keysym_count; i++) {
+		if (find_key(keys, cmd->keysyms[i]) < 0) {
+			keys->keysyms[keys->count++] = cmd->keysyms[i];
+			keys->changed = true;
+		}
+	}
+
+	if (keys->changed || state->vkbd_keymap != WLRCTL_KEYMAP_KEYSYMS) {
+		struct keymap keymap;
+		keymap_generate_keysyms(&keymap, keys->keysyms, keys->count);
+		upload_keymap(cmd->device, keymap.text, keymap.size);
+		keymap_finish(&keymap);
+		state->vkbd_keymap = WLRCTL_KEYMAP_KEYSYMS;
+		keys->changed = false;
+	}
+}
+
+/*
+ * Press or release key k of the keysym keymap, and the modifiers with it.
+ * Returns false if the key already was that way.
+ */
+static bool
+set_key(struct zwp_virtual_keyboard_v1 *kbd, struct keyboard_keys *keys,
+		uint32_t time, size_t k, bool down)
+{
+	if (keys->held[k] == down) {
+		return false;
+	}
+	keys->held[k] = down;
+	zwp_virtual_keyboard_v1_key(kbd, time, k + KEYMAP_MIN_KEYCODE - 8,
+		down ? WL_KEYBOARD_KEY_STATE_PRESSED : WL_KEYBOARD_KEY_STATE_RELEASED);
+
+	uint32_t mods = 0;
+	for (size_t i = 0; i < keys->count; i++) {
+		if (keys->held[i]) {
+			mods |= keymap_keysym_modifier(keys->keysyms[i]);
+		}
+	}
+	if (mods != keys->mods) {
+		keys->mods = mods;
+		zwp_virtual_keyboard_v1_modifiers(kbd, mods, 0, 0, 0);
+	}
+	return true;
+}
+
+static void
+press_keys(struct wlrctl_keyboard_command *cmd, uint32_t time, size_t first,
+		size_t count)
+{
+	struct keyboard_keys *keys = cmd->state->keys;
+	for (size_t i = first; i < first + count; i++) {
+		size_t k = find_key(keys, cmd->keysyms[i]);
+		cmd->pressed[i] = set_key(cmd->device, keys, time, k, true);
+	}
+}
+
+// Only keys the command put down come up, in reverse order
+static void
+release_keys(struct wlrctl_keyboard_command *cmd, uint32_t time, size_t first,
+		size_t count)
+{
+	struct keyboard_keys *keys = cmd->state->keys;
+	for (size_t i = first + count; i-- > first; ) {
+		if (cmd->pressed[i]) {
+			size_t k = find_key(keys, cmd->keysyms[i]);
+			set_key(cmd->device, keys, time, k, false);
+			cmd->pressed[i] = false;
+		}
+	}
+}
+
+static void finish_keyboard(struct wlrctl_keyboard_command *cmd);
+static void chords_pump(struct wlrctl_keyboard_command *cmd);
+
+static void
+chord_held(struct wlrctl *state, void *data)
+{
+	chords_pump(data);
+}
+
+/*
+ * Play the chords one after the other, sleeping on a timer while keys are
+ * held down.
+ */
+static void
+chords_pump(struct wlrctl_keyboard_command *cmd)
+{
+	struct wlrctl *state = cmd->state;
+	if (state->cmd != cmd) {
+		// The command failed and was given up on
+		return;
+	}
+	uint32_t time = cmd->holding ?
+		clock_resume(&state->clock, cmd->chords[cmd->chord].hold) :
+		clock_begin_batch(&state->clock);
+
+	for (; cmd->chord < cmd->chord_count; cmd->chord++) {
+		const struct keyboard_chord *chord = &cmd->chords[cmd->chord];
+		if (!cmd->holding) {
+			press_keys(cmd, time, chord->first, chord->count);
+			if (chord->hold) {
+				cmd->holding = true;
+				cmd->timer.deadline = now_ns() + chord->hold;
+				cmd->timer.func = chord_held;
+				cmd->timer.data = cmd;
+				loop_add_timer(state, &cmd->timer);
+				wl_display_flush(state->display);
+				return;
+			}
+		}
+		release_keys(cmd, time, chord->first, chord->count);
+		cmd->holding = false;
+	}
+	finish_keyboard(cmd);
+}
+
+static void
+run_keys(struct wlrctl_keyboard_command *cmd)
+{
+	struct wlrctl *state = cmd->state;
+	if (cmd->keysym_count > 0) {
+		use_keys(cmd);
+	}
+
+	switch (cmd->action) {
+	case KEYBOARD_ACTION_KEY:
+		chords_pump(cmd);
+		return;
+	case KEYBOARD_ACTION_PRESS:
+		press_keys(cmd, clock_begin_batch(&state->clock), 0, cmd->keysym_count);
+		break;
+	case KEYBOARD_ACTION_RELEASE:
+		if (cmd->keysym_count == 0) {
+			keyboard_release_all(state);
+			break;
+		}
+		// Release the keys whoever pressed them
+		for (size_t i = 0; i < cmd->keysym_count; i++) {
+			cmd->pressed[i] = true;
+		}
+		release_keys(cmd, clock_begin_batch(&state->clock), 0, cmd->keysym_count);
+		break;
+	default:
+		break;
+	}
+	finish_keyboard(cmd);
+}
+
+/*
+ * Release every key that is held down, so that nothing is left stuck when
+ * wlrctl goes away.
+ */
+void
+keyboard_release_all(struct wlrctl *state)
+{
+	struct keyboard_keys *keys = state->keys;
+	if (!keys || !state->vkbd) {
+		return;
+	}
+	uint32_t time = clock_begin_batch(&state->clock);
+	for (size_t k = keys->count; k-- > 0; ) {
+		set_key(state->vkbd, keys, time, k, false);
+	}
+}
+
+/*
+ * Stop a command that took too long, without leaving the keys it pressed
+ * held down.
+ */
+void
+cancel_keyboard(struct wlrctl *state)
+{
+	struct wlrctl_keyboard_command *cmd = state->cmd;
+	if (!cmd->device) {
+		// It never got to send anything
+		return;
+	}
+	if (cmd->action == KEYBOARD_ACTION_STREAM) {
+		stream_stop(cmd);
+		return;
+	}
+	if (cmd->action != KEYBOARD_ACTION_KEY) {
+		return;
+	}
+	if (!wl_list_empty(&cmd->timer.link)) {
+		loop_remove_timer(state, &cmd->timer);
+	}
+	release_keys(cmd, clock_begin_batch(&state->clock), 0, cmd->keysym_count);
+	wl_display_flush(state->display);
+}
+
 static enum keyboard_action
 parse_action(const char *action)
 {
 	static const struct token actions[] = {
 		{"type", KEYBOARD_ACTION_TYPE},
+		{"stream", KEYBOARD_ACTION_STREAM},
+		{"key", KEYBOARD_ACTION_KEY},
+		{"press", KEYBOARD_ACTION_PRESS},
+		{"release", KEYBOARD_ACTION_RELEASE},
 		{NULL, KEYBOARD_ACTION_UNSPEC}
 	};
 	return matchtok(actions, action);
 }
 
-static bool
-is_ascii(const char str[])
+/*
+ * Parse a comma separated list of modifier names into a modifier mask.
+ */
+uint32_t
+keyboard_parse_modifiers(const char *list)
 {
-	for (int i = 0; str[i] != '\0'; i++) {
-		if (str[i] < 0) {
-			return false;
+	uint32_t mods = 0;
+	char *keys = (char *)malloc(strlen(list) + 1);
+	strcpy(keys, list);
+	char *key;
+	char *saveptr;
+	key = strtok_r(keys, ",", &saveptr);
+	while (key != NULL) {
+		for (size_t i = 0; i < strlen(key); i++) {
+			key[i] = toupper((unsigned char) key[i]);
+		}
+		if (strcmp(key, "SHIFT") == 0) {
+			mods |= 1;
+		} else if (strcmp(key, "CTRL") == 0) {
+			mods |= 4;
+		} else if (strcmp(key, "ALT") == 0) {
+			mods |= 8;
+		} else if (strcmp(key, "SUPER") == 0) {
+			mods |= 64;
+		} else {
+			die("Unsupported modifier: '%s'\n", key);
+		}
+		key = strtok_r(NULL, ",", &saveptr);
+	}
+	free(keys);
+	return mods;
+}
+
+/*
+ * Parse the options that follow the text: modifiers and keymap, each with
+ * a value.
+ */
+static void
+parse_options(struct wlrctl_keyboard_command *cmd, int argc, char *argv[])
+{
+	for (int i = 0; i < argc; i += 2) {
+		if (strcmp(argv[i], "modifiers") == 0) {
+			if (i + 1 == argc) {
+				die("No modifiers provided\n");
+			}
+			cmd->mods_depressed |= keyboard_parse_modifiers(argv[i + 1]);
+		} else if (strcmp(argv[i], "keymap") == 0) {
+			if (i + 1 == argc) {
+				die("No keymap provided\n");
+			} else if (strcmp(argv[i + 1], "seat") == 0) {
+				cmd->use_layout = true;
+			} else if (strcmp(argv[i + 1], "private") == 0) {
+				cmd->use_layout = false;
+			} else {
+				die("Invalid keymap: '%s'\n", argv[i + 1]);
+			}
+		} else {
+			die("Invalid argument: '%s'\n", argv[i]);
 		}
 	}
-	return true;
 }
 
 void
@@ -103,6 +1045,12 @@ prepare_keyboard(struct wlrctl *state, int argc, char *argv[])
 	struct wlrctl_keyboard_command *cmd =
 		calloc(1, sizeof (struct wlrctl_keyboard_command));
 	assert(cmd);
+	// Set up to be destroyed, should the rest fail
+	wl_list_init(&cmd->timer.link);
+	wl_list_init(&cmd->stream.pump.link);
+	cmd->stream.fd = -1;
+	cmd->state = state;
+	state->cmd = cmd;
 
 	if (argc == 0) {
 		die("Missing keyboard action\n");
@@ -116,50 +1064,79 @@ prepare_keyboard(struct wlrctl *state, int argc, char *argv[])
 		if (argc < 2) {
 			die("Missing text to type!\n");
 		}
-		if (is_ascii(argv[1])) {
-			cmd->mods_depressed = 0;
-			cmd->text = strdup(argv[1]);
-		} else {
-			die("Only ascii strings are currently supported\n");
-		}
-		if (argc >= 3 && strcmp(argv[2], "modifiers")) {
-			die("Invalid argument: '%s'\n", argv[2]);
-		} else if (argc == 3) {
-			die("No modifiers provided\n");
-		} else if (argc == 4) {
-			char *keys = (char *)malloc(strlen(argv[3]) + 1);
-			strcpy(keys, argv[3]);
-			char *key;
-			key = strtok(keys, ",");
-			while (key != NULL) {
-				for (size_t i = 0; i < strlen(key); i++) {
-					key[i] = toupper((unsigned char) key[i]);
-				}
-				if (strcmp(key, "SHIFT") == 0) {
-					cmd->mods_depressed |= 1;
-				} else if (strcmp(key, "CTRL") == 0) {
-					cmd->mods_depressed |= 4;
-				} else if (strcmp(key, "ALT") == 0) {
-					cmd->mods_depressed |= 8;
-				} else if (strcmp(key, "SUPER") == 0) {
-					cmd->mods_depressed |= 64;
-				} else {
-					die("Unsupported modifier: '%s'\n", key);
-				}
-				key = strtok(NULL, ",");
+		size_t size = strlen(argv[1]), error;
+		cmd->codepoints = malloc((size ? size : 1) * sizeof *cmd->codepoints);
+		if (!cmd->codepoints) {
+			die("Failed to allocate text\n");
+		}
+		cmd->len = utf8_decode(argv[1], size, cmd->codepoints, &error);
+		if (error != size) {
+			die("Invalid UTF-8 at byte %zu of the text\n", error);
+		}
+		parse_options(cmd, argc - 2, argv + 2);
+		break;
+	case KEYBOARD_ACTION_STREAM:
+		// The file is optional, but can't be called like an option
+		if (argc >= 2 && strcmp(argv[1], "modifiers") && strcmp(argv[1], "keymap")) {
+			if (strcmp(argv[1], "-")) {
+				cmd->stream.path = strdup(argv[1]);
 			}
-			free(keys);
-		} else if (argc >= 5) {
-			die("Invalid argument: '%s'\n", argv[4]);
+			argc--;
+			argv++;
+		}
+		// The daemon's stdin is not the client's
+		if (!cmd->stream.path && state->daemon) {
+			die("A stream needs a file when the daemon runs it\n");
+		}
+		parse_options(cmd, argc - 1, argv + 1);
+		break;
+	case KEYBOARD_ACTION_KEY:
+	case KEYBOARD_ACTION_PRESS:
+		if (argc < 2) {
+			die("Missing keys to %s\n", action);
 		}
+		parse_chords(cmd, argc - 1, argv + 1, cmd->action == KEYBOARD_ACTION_KEY);
+		break;
+	case KEYBOARD_ACTION_RELEASE:
+		// Without keys, all of them
+		parse_chords(cmd, argc - 1, argv + 1, false);
 		break;
 	case KEYBOARD_ACTION_UNSPEC:
 		die("Unknown keyboard action: '%s'\n", action);
 		break;
 	}
+}
 
-	cmd->state = state;
-	state->cmd = cmd;
+/*
+ * End the command once the compositor has seen it, or right away in a batch,
+ * which has a sync barrier of its own.
+ */
+static void
+finish_keyboard(struct wlrctl_keyboard_command *cmd)
+{
+	struct wlrctl *state = cmd->state;
+	if (state->batch) {
+		state->running = false;
+		destroy_keyboard(state);
+		return;
+	}
+	struct wl_callback *callback = wl_display_sync(state->display);
+	wl_callback_add_listener(callback, &completed_listener, cmd);
+}
+
+static void
+ensure_keymap(struct wlrctl_keyboard_command *cmd)
+{
+	struct wlrctl *state = cmd->state;
+	// Nothing can be sent to a device without a keymap
+	if (state->vkbd_keymap == WLRCTL_KEYMAP_NONE) {
+		if (cmd->use_layout && state->layout) {
+			use_layout(cmd);
+		} else {
+			upload_keymap(cmd->device, keymap_ascii_raw, strlen(keymap_ascii_raw) + 1);
+			state->vkbd_keymap = WLRCTL_KEYMAP_ASCII;
+		}
+	}
 }
 
 void
@@ -167,35 +1144,66 @@ run_keyboard(struct wlrctl *state)
 {
 	struct wlrctl_keyboard_command *cmd = state->cmd;
 
-	cmd->device =
-	zwp_virtual_keyboard_manager_v1_create_virtual_keyboard(
-		state->vkbd_mgr, state->seat
-	);
-
-	cmd->xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
-	get_keymap(cmd);
-
-	zwp_virtual_keyboard_v1_keymap(cmd->device,
-		cmd->keymap.format, cmd->keymap.fd, cmd->keymap.size
-	);
-	close(cmd->keymap.fd);
+	if (cmd->use_layout) {
+		fetch_layout(state);
+	}
+	if (!state->vkbd) {
+		state->vkbd =
+		zwp_virtual_keyboard_manager_v1_create_virtual_keyboard(
+			state->vkbd_mgr, state->seat
+		);
+	}
+	cmd->device = state->vkbd;
+	// Keys held down with keyboard press count for the text too
+	uint32_t held = held_mods(state);
+	cmd->mods_depressed |= held;
 
 	switch (cmd->action) {
 	case KEYBOARD_ACTION_TYPE:
+		ensure_keymap(cmd);
 		zwp_virtual_keyboard_v1_modifiers(cmd->device, cmd->mods_depressed, 0, 0, 0);
-		keyboard_type(cmd, cmd->text);
+		type_text(cmd, cmd->codepoints, cmd->len);
+		if ((uint32_t)cmd->mods_depressed != held) {
+			// The device may outlive this command
+			zwp_virtual_keyboard_v1_modifiers(cmd->device, held, 0, 0, 0);
+		}
 		break;
+	case KEYBOARD_ACTION_STREAM:
+		// Even in a batch, the stream is done once the compositor says so
+		ensure_keymap(cmd);
+		stream_open(cmd);
+		zwp_virtual_keyboard_v1_modifiers(cmd->device, cmd->mods_depressed, 0, 0, 0);
+		stream_pump(cmd);
+		return;
+	case KEYBOARD_ACTION_KEY:
+	case KEYBOARD_ACTION_PRESS:
+	case KEYBOARD_ACTION_RELEASE:
+		run_keys(cmd);
+		return;
 	default:
 		break;
 	}
-
-	struct wl_callback *callback = wl_display_sync(state->display);
-	wl_callback_add_listener(callback, &completed_listener, state);
+	finish_keyboard(cmd);
 }
 
 void destroy_keyboard(struct wlrctl *state)
 {
 	struct wlrctl_keyboard_command *cmd = state->cmd;
-	zwp_virtual_keyboard_v1_destroy(cmd->device);
+	struct keyboard_stream *stream = &cmd->stream;
+	if (!wl_list_empty(&stream->pump.link)) {
+		loop_remove_timer(state, &stream->pump);
+	}
+	if (stream->map) {
+		munmap((void *)stream->map, stream->map_size);
+	}
+	if (stream->path && stream->fd >= 0) {
+		close(stream->fd);
+	}
+	free(stream->path);
+	free(stream->buf);
+	free(cmd->codepoints);
+	free(cmd->keysyms);
+	free(cmd->pressed);
+	free(cmd->chords);
 	free(cmd);
 }
@@ -0,0 +1,313 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xkbcommon/xkbcommon-keysyms.h>
+#include "keymap.h"
+#include "util.h"
+
+#define MOD3 (1 << 5)
+#define MOD5 (1 << 7)
+
+static const uint32_t level_mods[KEYMAP_MAX_LEVELS] = {
+	0, MOD3, MOD5, MOD3 | MOD5,
+};
+
+// Keys that hold a modifier down, and the real modifier each one maps to
+static const struct {
+	uint32_t keysym;
+	uint32_t mask;
+	const char *name;
+} modifier_keys[] = {
+	{XKB_KEY_Shift_L, 1 << 0, "Shift"},
+	{XKB_KEY_Shift_R, 1 << 0, "Shift"},
+	{XKB_KEY_Control_L, 1 << 2, "Control"},
+	{XKB_KEY_Control_R, 1 << 2, "Control"},
+	{XKB_KEY_Alt_L, 1 << 3, "Mod1"},
+	{XKB_KEY_Alt_R, 1 << 3, "Mod1"},
+	{XKB_KEY_Meta_L, 1 << 3, "Mod1"},
+	{XKB_KEY_Meta_R, 1 << 3, "Mod1"},
+	{XKB_KEY_Super_L, 1 << 6, "Mod4"},
+	{XKB_KEY_Super_R, 1 << 6, "Mod4"},
+	{XKB_KEY_Hyper_L, 1 << 6, "Mod4"},
+	{XKB_KEY_Hyper_R, 1 << 6, "Mod4"},
+};
+
+static const char keymap_header[] =
+	"xkb_keymap {\n"
+	"xkb_types \"wlrctl\" {\n"
+	"	type \"ONE_LEVEL\" {\n"
+	"		modifiers = none;\n"
+	"		level_name[Level1] = \"Any\";\n"
+	"	};\n"
+	"	type \"WLRCTL\" {\n"
+	"		modifiers = Mod3+Mod5;\n"
+	"		map[Mod3] = Level2;\n"
+	"		map[Mod5] = Level3;\n"
+	"		map[Mod3+Mod5] = Level4;\n"
+	"		level_name[Level1] = \"1\";\n"
+	"		level_name[Level2] = \"2\";\n"
+	"		level_name[Level3] = \"3\";\n"
+	"		level_name[Level4] = \"4\";\n"
+	"	};\n"
+	"};\n";
+
+static const char keymap_compat[] =
+	"xkb_compatibility \"wlrctl\" {\n"
+	"	interpret.repeat = False;\n"
+	"};\n";
+
+// Modifier keys set their modifiers as well
+static const char keysym_compat[] =
+	"xkb_compatibility \"wlrctl\" {\n"
+	"	interpret.repeat = False;\n"
+	"	interpret Any + AnyOf(all) {\n"
+	"		action = SetMods(modifiers = modMapMods);\n"
+	"	};\n"
+	"};\n";
+
+static int
+compare_codepoints(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void
+keysym_name(uint32_t codepoint, char *name, size_t size)
+{
+	switch (codepoint) {
+	case '\b':
+		snprintf(name, size, "BackSpace");
+		break;
+	case '\t':
+		snprintf(name, size, "Tab");
+		break;
+	case '\n':
+		snprintf(name, size, "Return");
+		break;
+	case 0x1b:
+		snprintf(name, size, "Escape");
+		break;
+	case 0x7f:
+		snprintf(name, size, "Delete");
+		break;
+	default:
+		snprintf(name, size, "U%04X", codepoint);
+		break;
+	}
+}
+
+static bool
+is_typeable(uint32_t codepoint)
+{
+	if (codepoint >= 0x20 && codepoint != 0x7f && !(codepoint >= 0x80 && codepoint < 0xa0)) {
+		return true;
+	}
+	return codepoint == '\b' || codepoint == '\t' || codepoint == '\n' ||
+		codepoint == 0x1b || codepoint == 0x7f;
+}
+
+/*
+ * Make up a keymap with every distinct code point in codepoints. Returns
+ * false if there are more than KEYMAP_CAPACITY, and dies on code points no
+ * key can produce.
+ */
+bool
+keymap_generate(struct keymap *keymap, const uint32_t *codepoints, size_t count)
+{
+	memset(keymap, 0, sizeof *keymap);
+	keymap->codepoints = malloc((count ? count : 1) * sizeof *keymap->codepoints);
+	if (!keymap->codepoints) {
+		die("Failed to allocate keymap\n");
+	}
+	memcpy(keymap->codepoints, codepoints, count * sizeof *codepoints);
+	qsort(keymap->codepoints, count, sizeof *keymap->codepoints, compare_codepoints);
+
+	size_t distinct = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (distinct == 0 || keymap->codepoints[distinct - 1] != keymap->codepoints[i]) {
+			keymap->codepoints[distinct++] = keymap->codepoints[i];
+		}
+	}
+	keymap->count = distinct;
+	if (distinct > KEYMAP_CAPACITY) {
+		keymap_finish(keymap);
+		return false;
+	}
+	for (size_t i = 0; i < distinct; i++) {
+		if (!is_typeable(keymap->codepoints[i])) {
+			die("Can't type U+%04X\n", keymap->codepoints[i]);
+		}
+	}
+	keymap->levels = distinct ? (distinct + KEYMAP_KEYS - 1) / KEYMAP_KEYS : 1;
+	size_t keys = distinct < KEYMAP_KEYS ? distinct : KEYMAP_KEYS;
+
+	FILE *text = open_memstream(&keymap->text, &keymap->size);
+	if (!text) {
+		die("Failed to allocate keymap\n");
+	}
+	fputs(keymap_header, text);
+	fputs(keymap_compat, text);
+
+	fputs("xkb_keycodes \"wlrctl\" {\n", text);
+	fprintf(text, "\tminimum = 8;\n\tmaximum = %d;\n", KEYMAP_MAX_KEYCODE);
+	for (size_t k = 0; k < keys; k++) {
+		fprintf(text, "\t<K%zu> = %zu;\n", k, k + KEYMAP_MIN_KEYCODE);
+	}
+	fputs("};\n", text);
+
+	fputs("xkb_symbols \"wlrctl\" {\n", text);
+	for (size_t k = 0; k < keys; k++) {
+		fprintf(text, "\tkey <K%zu> { type = \"%s\", [", k,
+			keymap->levels > 1 ? "WLRCTL" : "ONE_LEVEL");
+		for (int level = 0; level < keymap->levels; level++) {
+			size_t i = level * KEYMAP_KEYS + k;
+			char name[16] = "NoSymbol";
+			if (i < distinct) {
+				keysym_name(keymap->codepoints[i], name, sizeof name);
+			}
+			fprintf(text, "%s %s", level ? "," : "", name);
+		}
+		fputs(" ] };\n", text);
+	}
+	fputs("};\n};\n", text);
+
+	if (fclose(text) != 0) {
+		die("Failed to allocate keymap\n");
+	}
+	keymap->size++;
+	return true;
+}
+
+/*
+ * Find the keycode, in evdev terms, and the modifiers that type codepoint.
+ */
+bool
+keymap_lookup(const struct keymap *keymap, uint32_t codepoint,
+		uint32_t *keycode, uint32_t *mods)
+{
+	const uint32_t *found = bsearch(&codepoint, keymap->codepoints,
+		keymap->count, sizeof codepoint, compare_codepoints);
+	if (!found) {
+		return false;
+	}
+	size_t i = found - keymap->codepoints;
+	*keycode = i % KEYMAP_KEYS + KEYMAP_MIN_KEYCODE - 8;
+	*mods = level_mods[i / KEYMAP_KEYS];
+	return true;
+}
+
+// A power of two with room to spare over KEYMAP_CAPACITY
+#define SEGMENT_SLOTS 2048
+#define SEGMENT_EMPTY UINT32_MAX
+
+/*
+ * Return the length of the longest prefix of codepoints that one keymap can
+ * type. Cutting the text into the longest segments that fit, one after the
+ * other, never takes more keymaps than any other split would: a segment that
+ * ended earlier can only leave more text to the ones after it.
+ */
+size_t
+keymap_segment(const uint32_t *codepoints, size_t count)
+{
+	uint32_t slots[SEGMENT_SLOTS];
+	memset(slots, 0xff, sizeof slots);
+
+	size_t distinct = 0;
+	for (size_t i = 0; i < count; i++) {
+		uint32_t cp = codepoints[i];
+		size_t slot = (cp * 2654435761u) & (SEGMENT_SLOTS - 1);
+		while (slots[slot] != SEGMENT_EMPTY && slots[slot] != cp) {
+			slot = (slot + 1) & (SEGMENT_SLOTS - 1);
+		}
+		if (slots[slot] == cp) {
+			continue;
+		}
+		if (distinct == KEYMAP_CAPACITY) {
+			return i;
+		}
+		slots[slot] = cp;
+		distinct++;
+	}
+	return count;
+}
+
+static int
+find_modifier(uint32_t keysym)
+{
+	for (size_t i = 0; i < sizeof modifier_keys / sizeof modifier_keys[0]; i++) {
+		if (modifier_keys[i].keysym == keysym) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * The modifier mask a key with keysym holds down, 0 for other keys.
+ */
+uint32_t
+keymap_keysym_modifier(uint32_t keysym)
+{
+	int i = find_modifier(keysym);
+	return i < 0 ? 0 : modifier_keys[i].mask;
+}
+
+/*
+ * Make up a keymap with keysyms on keys of their own, in order from
+ * KEYMAP_MIN_KEYCODE, and modifier keys mapped to their modifiers. Returns
+ * false if there are more than KEYMAP_KEYS. There are no code points, so
+ * keymap_lookup finds nothing in it.
+ */
+bool
+keymap_generate_keysyms(struct keymap *keymap, const uint32_t *keysyms, size_t count)
+{
+	memset(keymap, 0, sizeof *keymap);
+	if (count > KEYMAP_KEYS) {
+		return false;
+	}
+	keymap->levels = 1;
+
+	FILE *text = open_memstream(&keymap->text, &keymap->size);
+	if (!text) {
+		die("Failed to allocate keymap\n");
+	}
+	fputs(keymap_header, text);
+	fputs(keysym_compat, text);
+
+	fputs("xkb_keycodes \"wlrctl\" {\n", text);
+	fprintf(text, "\tminimum = 8;\n\tmaximum = %d;\n", KEYMAP_MAX_KEYCODE);
+	for (size_t k = 0; k < count; k++) {
+		fprintf(text, "\t<K%zu> = %zu;\n", k, k + KEYMAP_MIN_KEYCODE);
+	}
+	fputs("};\n", text);
+
+	fputs("xkb_symbols \"wlrctl\" {\n", text);
+	for (size_t k = 0; k < count; k++) {
+		fprintf(text, "\tkey <K%zu> { type = \"ONE_LEVEL\", [ 0x%x ] };\n",
+			k, keysyms[k]);
+		int mod = find_modifier(keysyms[k]);
+		if (mod >= 0) {
+			fprintf(text, "\tmodifier_map %s { <K%zu> };\n",
+				modifier_keys[mod].name, k);
+		}
+	}
+	fputs("};\n};\n", text);
+
+	if (fclose(text) != 0) {
+		die("Failed to allocate keymap\n");
+	}
+	keymap->size++;
+	return true;
+}
+
+void
+keymap_finish(struct keymap *keymap)
+{
+	free(keymap->codepoints);
+	free(keymap->text);
+	memset(keymap, 0, sizeof *keymap);
+}
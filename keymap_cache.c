@@ -0,0 +1,214 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "keymap.h"
+#include "util.h"
+
+/*
+ * Keymaps are handed to the compositor as files. The ones that come back
+ * run after run, the ASCII, keysym and seat keymaps, are kept in
+ * $XDG_RUNTIME_DIR/wlrctl under the hash of their text, read only, so that
+ * the next run with the same keymap opens the file instead of writing it
+ * again. Keymaps made up for one text, and all of them without a runtime
+ * dir, go to a sealed memfd.
+ */
+
+// Enough for the ASCII keymap and the keysym and seat keymaps in use
+#define CACHE_MAX_ENTRIES 64
+#define CACHE_PREFIX "keymap-"
+
+static uint64_t
+hash_text(const char *text, size_t size)
+{
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325;
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ (unsigned char)text[i]) * 0x100000001b3;
+	}
+	return hash;
+}
+
+/*
+ * Return a read only fd holding size bytes of keymap text, for a keymap that
+ * is not worth keeping.
+ */
+int
+keymap_open_anonymous(const char *text, size_t size)
+{
+#if defined(MEMFD_CREATE)
+	int fd = memfd_create("keymap", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#elif defined(__FreeBSD__)
+	// memfd_create on FreeBSD 13 is SHM_ANON without sealing support
+	int fd = shm_open(SHM_ANON, O_RDWR, 0600);
+#else
+	char name[] = "/tmp/keymap-XXXXXX";
+	int fd = mkstemp(name);
+	unlink(name);
+#endif
+	if (fd < 0 || ftruncate(fd, size) < 0) {
+		die("Could not allocate shm for keymap\n");
+	}
+
+	void *keymap_data =
+		mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (keymap_data == MAP_FAILED) {
+		die("Could not map shm for keymap\n");
+	}
+	memcpy(keymap_data, text, size);
+	munmap(keymap_data, size);
+
+#if defined(MEMFD_CREATE) && defined(F_ADD_SEALS)
+	// The compositor can map it without fearing that it changes under it
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+	return fd;
+}
+
+static bool
+write_all(int fd, const char *data, size_t size)
+{
+	while (size > 0) {
+		ssize_t n = write(fd, data, size);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n <= 0) {
+			return false;
+		}
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+/*
+ * Whether the file holds exactly the text, which the hash alone can't tell.
+ */
+static bool
+same_text(int fd, const char *text, size_t size)
+{
+	void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+	bool same = memcmp(data, text, size) == 0;
+	munmap(data, size);
+	return same;
+}
+
+/*
+ * Make room for one more entry by removing the least recently used one.
+ * Hits touch their entry, so the oldest mtime is the one used longest ago.
+ */
+static void
+evict(const char *dir)
+{
+	DIR *entries = opendir(dir);
+	if (!entries) {
+		return;
+	}
+	int count = 0;
+	char oldest[NAME_MAX + 1] = "";
+	struct timespec oldest_time = {0};
+	struct dirent *entry;
+	while ((entry = readdir(entries))) {
+		if (strncmp(entry->d_name, CACHE_PREFIX, strlen(CACHE_PREFIX))) {
+			continue;
+		}
+		struct stat st;
+		if (fstatat(dirfd(entries), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+			continue;
+		}
+		count++;
+		if (!oldest[0] || st.st_mtim.tv_sec < oldest_time.tv_sec ||
+				(st.st_mtim.tv_sec == oldest_time.tv_sec &&
+				st.st_mtim.tv_nsec < oldest_time.tv_nsec)) {
+			snprintf(oldest, sizeof oldest, "%s", entry->d_name);
+			oldest_time = st.st_mtim;
+		}
+	}
+	if (count >= CACHE_MAX_ENTRIES && oldest[0]) {
+		unlinkat(dirfd(entries), oldest, 0);
+	}
+	closedir(entries);
+}
+
+// Whether snprintf had room for all of it
+static bool
+fits(int len, size_t size)
+{
+	return len >= 0 && (size_t)len < size;
+}
+
+static int
+open_cached(const char *runtime_dir, const char *text, size_t size)
+{
+	char dir[PATH_MAX], path[PATH_MAX], tmp[PATH_MAX];
+	// A runtime dir too long for a path leaves the keymap to a memfd
+	if (!fits(snprintf(dir, sizeof dir, "%s/wlrctl", runtime_dir), sizeof dir) ||
+			!fits(snprintf(path, sizeof path, "%s/" CACHE_PREFIX "%016" PRIx64,
+				dir, hash_text(text, size)), sizeof path) ||
+			!fits(snprintf(tmp, sizeof tmp, "%s.XXXXXX", path), sizeof tmp)) {
+		return -1;
+	}
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	if (fd >= 0) {
+		// Only trust what could not have been changed since it was written
+		struct stat st;
+		if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+				st.st_uid == getuid() && !(st.st_mode & 0222) &&
+				(size_t)st.st_size == size && same_text(fd, text, size)) {
+			// The owner may set the times of a read only file
+			futimens(fd, NULL);
+			return fd;
+		}
+		close(fd);
+	}
+
+	if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+		return -1;
+	}
+	evict(dir);
+
+	// Written aside and renamed, so that a concurrent run never sees half of it
+	int tmp_fd = mkstemp(tmp);
+	if (tmp_fd < 0) {
+		return -1;
+	}
+	bool written = write_all(tmp_fd, text, size) &&
+		fchmod(tmp_fd, 0444) == 0 && rename(tmp, path) == 0;
+	close(tmp_fd);
+	if (!written) {
+		unlink(tmp);
+		return -1;
+	}
+	// The compositor gets a read only fd, the cache is shared
+	return open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+}
+
+/*
+ * Return a read only fd holding size bytes of keymap text, the NUL included.
+ */
+int
+keymap_open(const char *text, size_t size)
+{
+	const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+	if (runtime_dir && runtime_dir[0] == '/') {
+		int fd = open_cached(runtime_dir, text, size);
+		if (fd >= 0) {
+			return fd;
+		}
+	}
+	return keymap_open_anonymous(text, size);
+}
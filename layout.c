@@ -0,0 +1,181 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "layout.h"
+#include "util.h"
+#include "xkb.h"
+
+struct collect {
+	const struct xkb_api *xkb;
+	struct layout *layout;
+	size_t capacity;
+};
+
+static void
+add_key(struct collect *collect, uint32_t codepoint, uint32_t keycode, uint32_t mods)
+{
+	struct layout *layout = collect->layout;
+	if (layout->count == collect->capacity) {
+		collect->capacity = collect->capacity ? collect->capacity * 2 : 256;
+		struct layout_key *keys =
+			realloc(layout->keys, collect->capacity * sizeof *keys);
+		if (!keys) {
+			die("Failed to allocate layout\n");
+		}
+		layout->keys = keys;
+	}
+	layout->keys[layout->count++] = (struct layout_key){
+		.codepoint = codepoint,
+		.keycode = keycode,
+		.mods = mods,
+	};
+}
+
+static void
+collect_key(struct xkb_keymap *keymap, xkb_keycode_t key, void *data)
+{
+	struct collect *collect = data;
+	const struct xkb_api *xkb = collect->xkb;
+	// The first 8 keycodes have no evdev code
+	if (key < 8 || xkb->keymap_num_layouts_for_key(keymap, key) == 0) {
+		return;
+	}
+
+	xkb_level_index_t levels = xkb->keymap_num_levels_for_key(keymap, key, 0);
+	for (xkb_level_index_t level = 0; level < levels; level++) {
+		const xkb_keysym_t *syms;
+		if (xkb->keymap_key_get_syms_by_level(keymap, key, 0, level, &syms) != 1) {
+			continue;
+		}
+		uint32_t codepoint = xkb->keysym_to_utf32(syms[0]);
+		if (codepoint == 0) {
+			continue;
+		}
+		xkb_mod_mask_t mods;
+		if (xkb->keymap_key_get_mods_for_level(keymap, key, 0, level, &mods, 1) == 0) {
+			if (level > 0) {
+				continue;
+			}
+			mods = 0;
+		}
+		// Return comes out as a carriage return, but a new line is what's typed
+		if (codepoint == '\r') {
+			codepoint = '\n';
+		}
+		add_key(collect, codepoint, key - 8, mods);
+	}
+}
+
+static int
+popcount(uint32_t mods)
+{
+	int count = 0;
+	for (; mods; mods &= mods - 1) {
+		count++;
+	}
+	return count;
+}
+
+// By code point, then keys X11 clients can see, then the fewest modifiers,
+// then the lowest keycode
+static int
+compare_keys(const void *a, const void *b)
+{
+	const struct layout_key *x = a, *y = b;
+	if (x->codepoint != y->codepoint) {
+		return x->codepoint < y->codepoint ? -1 : 1;
+	}
+	bool x_high = x->keycode + 8 > 255, y_high = y->keycode + 8 > 255;
+	if (x_high != y_high) {
+		return x_high - y_high;
+	}
+	int mods = popcount(x->mods) - popcount(y->mods);
+	if (mods != 0) {
+		return mods;
+	}
+	return (x->keycode > y->keycode) - (x->keycode < y->keycode);
+}
+
+/*
+ * Compile size bytes of keymap text and find out what its keys type.
+ * Returns false if the keymap doesn't compile.
+ */
+bool
+layout_compile(struct layout *layout, const char *text, size_t size)
+{
+	const struct xkb_api *xkb = xkb_load();
+	memset(layout, 0, sizeof *layout);
+
+	layout->text = malloc(size + 1);
+	if (!layout->text) {
+		die("Failed to allocate layout\n");
+	}
+	memcpy(layout->text, text, size);
+	// The size usually covers the NUL already, but nothing says it must
+	layout->text[size] = '\0';
+	layout->size = strlen(layout->text) + 1;
+
+	struct xkb_context *context = xkb->context_new(
+		XKB_CONTEXT_NO_DEFAULT_INCLUDES | XKB_CONTEXT_NO_ENVIRONMENT_NAMES);
+	if (!context) {
+		die("Could not create xkb context\n");
+	}
+	struct xkb_keymap *keymap = xkb->keymap_new_from_string(context,
+		layout->text, XKB_KEYMAP_FORMAT_TEXT_V1, XKB_KEYMAP_COMPILE_NO_FLAGS);
+	if (!keymap) {
+		xkb->context_unref(context);
+		layout_finish(layout);
+		return false;
+	}
+
+	struct collect collect = { .xkb = xkb, .layout = layout };
+	xkb->keymap_key_for_each(keymap, collect_key, &collect);
+	xkb->keymap_unref(keymap);
+	xkb->context_unref(context);
+
+	qsort(layout->keys, layout->count, sizeof *layout->keys, compare_keys);
+	size_t distinct = 0;
+	for (size_t i = 0; i < layout->count; i++) {
+		if (distinct == 0 ||
+				layout->keys[distinct - 1].codepoint != layout->keys[i].codepoint) {
+			layout->keys[distinct++] = layout->keys[i];
+		}
+	}
+	layout->count = distinct;
+	return true;
+}
+
+static int
+compare_codepoint(const void *key, const void *elem)
+{
+	uint32_t codepoint = *(const uint32_t *)key;
+	const struct layout_key *k = elem;
+	return (codepoint > k->codepoint) - (codepoint < k->codepoint);
+}
+
+/*
+ * Find the keycode and modifiers that type codepoint, if any.
+ */
+bool
+layout_lookup(const struct layout *layout, uint32_t codepoint,
+		uint32_t *keycode, uint32_t *mods)
+{
+	const struct layout_key *key = bsearch(&codepoint, layout->keys,
+		layout->count, sizeof *layout->keys, compare_codepoint);
+	if (!key) {
+		return false;
+	}
+	*keycode = key->keycode;
+	*mods = key->mods;
+	return true;
+}
+
+void
+layout_finish(struct layout *layout)
+{
+	free(layout->text);
+	free(layout->keys);
+	memset(layout, 0, sizeof *layout);
+}
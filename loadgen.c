@@ -0,0 +1,523 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+#include <wayland-client.h>
+#include <xkbcommon/xkbcommon-keysyms.h>
+#include "clock.h"
+#include "common.h"
+#include "keymap.h"
+#include "loadgen.h"
+#include "loop.h"
+#include "util.h"
+
+#include "virtual-keyboard-unstable-v1-client-protocol.h"
+#include "wlr-virtual-pointer-unstable-v1-client-protocol.h"
+
+/*
+ * The load generator drives many virtual keyboards and pointers at once,
+ * each on its own connection and thread, as fleet mode drives many
+ * displays. The total rate is shared evenly between the devices. Keyboards
+ * press and release a key with no symbol, and pointers move back and forth
+ * by a pixel, so that the load does as little as possible to the desktop.
+ */
+
+#define STACK_SIZE (256 * 1024)
+#define LOAD_RATE 1000.0
+#define LOAD_DURATION (UINT64_C(10) * 1000000000)
+#define LOAD_TICK (UINT64_C(1) * 1000000)
+// How long the compositor has to confirm the last events
+#define LOAD_DRAIN (UINT64_C(5) * 1000000000)
+// Events in one batch at most, the rest are owed to the next tick
+#define LOAD_BATCH 512
+// How far a device may fall behind, in ticks, before it drops events
+#define LOAD_MAX_BEHIND 100
+
+struct worker {
+	struct wlrctl state;
+	struct wlrctl_load_command cmd;
+	int index;
+	char *err;
+	size_t err_size;
+	bool failed;
+	pthread_t thread;
+	struct loadgen *gen;
+};
+
+struct loadgen {
+	struct worker *workers;
+	int keyboards, pointers;
+	// Closed to stop every worker
+	int cancel_fds[2];
+	// Written to by every worker that is done
+	int done_fds[2];
+};
+
+static void
+load_finish(struct wlrctl_load_command *cmd)
+{
+	cmd->state->running = false;
+}
+
+static void
+load_synced(void *data, struct wl_callback *callback, uint32_t serial)
+{
+	struct wlrctl_load_command *cmd = data;
+	wl_callback_destroy(callback);
+	uint64_t rtt = now_ns() - cmd->syncs[cmd->sync_head];
+	cmd->sync_head = (cmd->sync_head + 1) % LOAD_WINDOW;
+	cmd->outstanding--;
+
+	if (cmd->rtt_count == cmd->rtt_size) {
+		size_t size = cmd->rtt_size ? 2 * cmd->rtt_size : 1024;
+		uint64_t *rtts = realloc(cmd->rtts, size * sizeof *rtts);
+		if (!rtts) {
+			die("Failed to allocate roundtrips\n");
+		}
+		cmd->rtts = rtts;
+		cmd->rtt_size = size;
+	}
+	cmd->rtts[cmd->rtt_count++] = rtt;
+
+	if (cmd->done && cmd->outstanding == 0 && cmd->state->cmd == cmd) {
+		load_finish(cmd);
+	}
+}
+
+static const struct wl_callback_listener sync_listener = {
+	.done = load_synced,
+};
+
+static void
+load_send(struct wlrctl_load_command *cmd, uint32_t time, size_t count)
+{
+	struct wlrctl *state = cmd->state;
+	for (size_t i = 0; i < count; i++) {
+		if (cmd->pointer) {
+			wl_fixed_t dx = wl_fixed_from_int(cmd->sent % 2 ? -1 : 1);
+			zwlr_virtual_pointer_v1_motion(state->vptr, time, dx, 0);
+			zwlr_virtual_pointer_v1_frame(state->vptr);
+		} else {
+			cmd->key_down = !cmd->key_down;
+			// The one key of the keymap, as an evdev code
+			zwp_virtual_keyboard_v1_key(state->vkbd, time, KEYMAP_MIN_KEYCODE - 8,
+				cmd->key_down ? WL_KEYBOARD_KEY_STATE_PRESSED :
+				WL_KEYBOARD_KEY_STATE_RELEASED);
+		}
+		cmd->sent++;
+	}
+}
+
+static void
+load_flush(struct wlrctl_load_command *cmd)
+{
+	if (wl_display_flush(cmd->state->display) < 0 && errno == EAGAIN) {
+		cmd->stalls++;
+	}
+}
+
+static void load_tick(struct wlrctl *state, void *data);
+
+/*
+ * Send the events due by now, unless the compositor is too far behind, and
+ * sleep until the next tick. Events owed for longer than LOAD_MAX_BEHIND
+ * ticks are dropped, so a slow compositor sees the rate it can take rather
+ * than an ever growing pile.
+ */
+static void
+load_tick(struct wlrctl *state, void *data)
+{
+	struct wlrctl_load_command *cmd = data;
+	if (state->cmd != cmd) {
+		// The command failed and was given up on
+		return;
+	}
+
+	uint64_t now = now_ns();
+	uint32_t time = clock_begin_batch(&state->clock);
+	if (now >= cmd->end) {
+		cmd->done = true;
+		cmd->stopped = now;
+		if (cmd->key_down) {
+			zwp_virtual_keyboard_v1_key(state->vkbd, time, KEYMAP_MIN_KEYCODE - 8,
+				WL_KEYBOARD_KEY_STATE_RELEASED);
+			cmd->key_down = false;
+		}
+		load_flush(cmd);
+		if (cmd->outstanding == 0) {
+			load_finish(cmd);
+		}
+		return;
+	}
+
+	size_t due = (now - cmd->start) / 1e9 * cmd->rate;
+	size_t owed = due - cmd->sent - cmd->dropped;
+	size_t behind = cmd->rate * cmd->tick * LOAD_MAX_BEHIND / 1e9;
+	behind = behind > LOAD_BATCH ? behind : LOAD_BATCH;
+	if (owed > behind) {
+		cmd->dropped += owed - behind;
+		owed = behind;
+	}
+	cmd->backlog_max = owed > cmd->backlog_max ? owed : cmd->backlog_max;
+
+	if (owed > 0 && cmd->outstanding < LOAD_WINDOW) {
+		size_t count = owed < LOAD_BATCH ? owed : LOAD_BATCH;
+		// What was owed at the last tick is late by now
+		cmd->late += count < cmd->owed ? count : cmd->owed;
+		load_send(cmd, time, count);
+		owed -= count;
+
+		cmd->syncs[(cmd->sync_head + cmd->outstanding) % LOAD_WINDOW] = now;
+		cmd->outstanding++;
+		struct wl_callback *callback = wl_display_sync(state->display);
+		wl_callback_add_listener(callback, &sync_listener, cmd);
+		load_flush(cmd);
+	}
+	cmd->owed = owed;
+
+	uint64_t ticks = (now - cmd->start) / cmd->tick + 1;
+	cmd->timer.deadline = cmd->start + ticks * cmd->tick;
+	cmd->timer.func = load_tick;
+	cmd->timer.data = cmd;
+	loop_add_timer(state, &cmd->timer);
+}
+
+bool
+load_ready(struct wlrctl *state)
+{
+	const struct wlrctl_load_command *cmd = state->cmd;
+	return state->seat && (cmd->pointer ? state->vp_mgr != NULL :
+		state->vkbd_mgr != NULL);
+}
+
+void
+run_load(struct wlrctl *state)
+{
+	struct wlrctl_load_command *cmd = state->cmd;
+	if (cmd->pointer) {
+		if (!state->vp_mgr) {
+			die("Virtual Pointer interface not found!\n");
+		}
+		state->vptr = zwlr_virtual_pointer_manager_v1_create_virtual_pointer(
+			state->vp_mgr, state->seat);
+	} else {
+		if (!state->vkbd_mgr) {
+			die("Virtual Keyboard interface not found!\n");
+		}
+		state->vkbd = zwp_virtual_keyboard_manager_v1_create_virtual_keyboard(
+			state->vkbd_mgr, state->seat);
+		struct keymap keymap;
+		keymap_generate_keysyms(&keymap, (uint32_t[]){ XKB_KEY_VoidSymbol }, 1);
+		int fd = keymap_open(keymap.text, keymap.size);
+		zwp_virtual_keyboard_v1_keymap(state->vkbd,
+			WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1, fd, keymap.size);
+		close(fd);
+		keymap_finish(&keymap);
+	}
+	wl_list_init(&cmd->timer.link);
+	cmd->start = now_ns();
+	cmd->end = cmd->start + cmd->duration;
+	load_tick(state, cmd);
+}
+
+/*
+ * Stop a device that was interrupted or failed, without leaving its key
+ * held down.
+ */
+void
+cancel_load(struct wlrctl *state)
+{
+	struct wlrctl_load_command *cmd = state->cmd;
+	if (!wl_list_empty(&cmd->timer.link)) {
+		loop_remove_timer(state, &cmd->timer);
+	}
+	if (cmd->key_down) {
+		zwp_virtual_keyboard_v1_key(state->vkbd, clock_begin_batch(&state->clock),
+			KEYMAP_MIN_KEYCODE - 8, WL_KEYBOARD_KEY_STATE_RELEASED);
+		cmd->key_down = false;
+		load_flush(cmd);
+	}
+}
+
+static void *
+run_worker(void *data)
+{
+	struct worker *worker = data;
+	struct wlrctl *state = &worker->state;
+	volatile bool loop_ready = false;
+
+	state->out = stdout;
+	state->err = open_memstream(&worker->err, &worker->err_size);
+	if (!state->err) {
+		worker->failed = true;
+		goto done;
+	}
+	set_die_stream(state->err);
+
+	jmp_buf env;
+	if (setjmp(env)) {
+		worker->failed = true;
+		if (state->display) {
+			wl_display_disconnect(state->display);
+		}
+		goto cleanup;
+	}
+	set_die_handler(&env);
+
+	loop_init_shared(state, worker->gen->cancel_fds[0]);
+	loop_ready = true;
+	state->cmd_type = WLRCTL_COMMAND_LOAD;
+	state->cmd = &worker->cmd;
+	worker->cmd.state = state;
+	run_oneshot(state, NULL);
+	worker->failed = state->failed;
+
+cleanup:
+	// However the worker stopped, its rate is over the time it ran
+	if (worker->cmd.start && !worker->cmd.stopped) {
+		worker->cmd.stopped = now_ns();
+	}
+	set_die_handler(NULL);
+	set_die_stream(NULL);
+	if (loop_ready) {
+		loop_finish(state);
+	}
+done:
+	if (state->err) {
+		fclose(state->err);
+	}
+	if (write(worker->gen->done_fds[1], "", 1) < 0) {
+		// The main thread joins every worker anyway
+	}
+	return NULL;
+}
+
+static int
+compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static double
+percentile_ms(const uint64_t *sorted, size_t count, double p)
+{
+	if (count == 0) {
+		return 0;
+	}
+	size_t i = p * (count - 1) + 0.5;
+	return sorted[i] / 1e6;
+}
+
+static void
+report(struct loadgen *gen, double rate)
+{
+	int count = gen->keyboards + gen->pointers;
+	size_t sent = 0, dropped = 0, late = 0, backlog = 0, stalls = 0, syncs = 0;
+	uint64_t start = UINT64_MAX, stopped = 0;
+	for (int i = 0; i < count; i++) {
+		const struct wlrctl_load_command *cmd = &gen->workers[i].cmd;
+		sent += cmd->sent;
+		dropped += cmd->dropped;
+		late += cmd->late;
+		backlog = cmd->backlog_max > backlog ? cmd->backlog_max : backlog;
+		stalls += cmd->stalls;
+		syncs += cmd->rtt_count;
+		if (cmd->start && cmd->start < start) {
+			start = cmd->start;
+		}
+		if (cmd->stopped > stopped) {
+			stopped = cmd->stopped;
+		}
+	}
+
+	uint64_t *rtts = malloc((syncs ? syncs : 1) * sizeof *rtts);
+	if (!rtts) {
+		die("Failed to allocate roundtrips\n");
+	}
+	size_t n = 0;
+	for (int i = 0; i < count; i++) {
+		const struct wlrctl_load_command *cmd = &gen->workers[i].cmd;
+		memcpy(rtts + n, cmd->rtts, cmd->rtt_count * sizeof *rtts);
+		n += cmd->rtt_count;
+	}
+	qsort(rtts, n, sizeof *rtts, compare_u64);
+
+	double elapsed = stopped > start ? (stopped - start) / 1e9 : 0;
+	printf("devices    %d keyboards, %d pointers\n", gen->keyboards, gen->pointers);
+	printf("events     %zu in %.3f s, %.1f events/s of %.1f requested\n",
+		sent, elapsed, elapsed > 0 ? sent / elapsed : 0, rate);
+	printf("roundtrip  p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms, "
+		"%zu syncs\n", percentile_ms(rtts, n, 0.5), percentile_ms(rtts, n, 0.9),
+		percentile_ms(rtts, n, 0.99), percentile_ms(rtts, n, 1), n);
+	printf("backlog    %zu events late, %zu dropped, %zu owed at most, "
+		"%zu stalled flushes\n", late, dropped, backlog, stalls);
+	free(rtts);
+}
+
+static int
+parse_count(const char *d)
+{
+	char *end;
+	long val = strtol(d, &end, 10);
+	if (end == d || *end || val < 0 || val > 4096) {
+		die("Bad count: '%s'\n", d);
+	}
+	return val;
+}
+
+static double
+parse_positive(const char *d)
+{
+	char *end;
+	double val = strtod(d, &end);
+	if (end == d || *end || !(val > 0)) {
+		die("Bad value: '%s'\n", d);
+	}
+	return val;
+}
+
+/*
+ * Run the load generator and print what the compositor took. Returns the
+ * exit status, a failure if any of the devices failed.
+ */
+int
+run_loadgen(struct wlrctl *proto, int argc, char *argv[])
+{
+	struct loadgen gen = { .keyboards = 1, .pointers = 1 };
+	double rate = LOAD_RATE;
+	uint64_t duration = LOAD_DURATION, tick = LOAD_TICK;
+	for (int i = 1; i < argc; i += 2) {
+		if (i + 1 == argc) {
+			die("Missing value after '%s'\n", argv[i]);
+		}
+		if (strcmp(argv[i], "keyboards") == 0) {
+			gen.keyboards = parse_count(argv[i + 1]);
+		} else if (strcmp(argv[i], "pointers") == 0) {
+			gen.pointers = parse_count(argv[i + 1]);
+		} else if (strcmp(argv[i], "rate") == 0) {
+			rate = parse_positive(argv[i + 1]);
+		} else if (strcmp(argv[i], "duration") == 0) {
+			duration = parse_positive(argv[i + 1]) * 1e9;
+		} else if (strcmp(argv[i], "tick") == 0) {
+			tick = parse_positive(argv[i + 1]) * 1e6;
+		} else {
+			die("Unknown loadgen option: '%s'\n", argv[i]);
+		}
+	}
+	int count = gen.keyboards + gen.pointers;
+	if (count == 0) {
+		die("No devices to drive\n");
+	}
+
+	sigset_t mask, saved_mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &mask, &saved_mask);
+	int signal_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+	if (signal_fd < 0 || pipe(gen.cancel_fds) < 0 || pipe(gen.done_fds) < 0) {
+		die("Could not set up the load generator: %s\n", strerror(errno));
+	}
+	gen.workers = calloc(count, sizeof *gen.workers);
+	if (!gen.workers) {
+		die("Failed to allocate workers\n");
+	}
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, STACK_SIZE);
+
+	int started = 0;
+	for (int i = 0; i < count; i++) {
+		struct worker *worker = &gen.workers[i];
+		worker->gen = &gen;
+		worker->index = i < gen.keyboards ? i + 1 : i - gen.keyboards + 1;
+		worker->cmd.pointer = i >= gen.keyboards;
+		worker->cmd.rate = rate / count;
+		worker->cmd.duration = duration;
+		worker->cmd.tick = tick;
+		worker->state.clock = proto->clock;
+		worker->state.timeout = duration + LOAD_DRAIN;
+
+		int ret = pthread_create(&worker->thread, &attr, run_worker, worker);
+		if (ret != 0) {
+			fprintf(stderr, "Could not start a thread: %s\n", strerror(ret));
+			worker->failed = true;
+			worker->thread = pthread_self();
+			continue;
+		}
+		started++;
+	}
+	pthread_attr_destroy(&attr);
+
+	// Wait for the workers, and stop them all on SIGINT or SIGTERM
+	int done = 0;
+	bool cancelled = false;
+	while (done < started) {
+		struct pollfd fds[] = {
+			{ .fd = gen.done_fds[0], .events = POLLIN },
+			{ .fd = cancelled ? -1 : signal_fd, .events = POLLIN },
+		};
+		if (poll(fds, 2, -1) < 0) {
+			continue;
+		}
+		if (fds[0].revents) {
+			char buf[256];
+			ssize_t n = read(gen.done_fds[0], buf, sizeof buf);
+			done += n > 0 ? n : 0;
+		}
+		if (fds[1].revents) {
+			close(gen.cancel_fds[1]);
+			gen.cancel_fds[1] = -1;
+			cancelled = true;
+		}
+	}
+
+	int status = EXIT_SUCCESS;
+	for (int i = 0; i < count; i++) {
+		struct worker *worker = &gen.workers[i];
+		if (!pthread_equal(worker->thread, pthread_self())) {
+			pthread_join(worker->thread, NULL);
+		}
+		const char *name = worker->cmd.pointer ? "pointer" : "keyboard";
+		const char *text = worker->err, *end = text + worker->err_size;
+		while (text < end) {
+			const char *eol = memchr(text, '\n', end - text);
+			size_t len = eol ? (size_t)(eol - text) : (size_t)(end - text);
+			fprintf(stderr, "%s %d: %.*s\n", name, worker->index, (int)len, text);
+			text += len + 1;
+		}
+		if (worker->failed) {
+			if (worker->err_size == 0) {
+				fprintf(stderr, "%s %d: failed\n", name, worker->index);
+			}
+			status = EXIT_FAILURE;
+		}
+	}
+	// Even when cut short, the load that went out is worth knowing
+	report(&gen, rate);
+
+	for (int i = 0; i < count; i++) {
+		free(gen.workers[i].err);
+		free(gen.workers[i].cmd.rtts);
+	}
+	free(gen.workers);
+	if (gen.cancel_fds[1] >= 0) {
+		close(gen.cancel_fds[1]);
+	}
+	close(gen.cancel_fds[0]);
+	close(gen.done_fds[0]);
+	close(gen.done_fds[1]);
+	close(signal_fd);
+	pthread_sigmask(SIG_SETMASK, &saved_mask, NULL);
+	return status;
+}
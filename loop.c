@@ -0,0 +1,362 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-client.h>
+#include "common.h"
+#include "loop.h"
+#include "util.h"
+
+/*
+ * Everything wlrctl waits for is a file descriptor: the display, SIGINT and
+ * SIGTERM through a signalfd, the --timeout deadline and the timers for
+ * timed actions through timerfds. Timers have nanosecond resolution and are
+ * armed on CLOCK_MONOTONIC, the clock now_ns() reads.
+ */
+
+// The signal mask is per process, so is the loop
+static sigset_t saved_mask;
+
+static void
+arm(int fd, uint64_t deadline)
+{
+	struct itimerspec spec = {
+		.it_value = {
+			.tv_sec = deadline / 1000000000,
+			.tv_nsec = deadline % 1000000000,
+		},
+	};
+	// A zero it_value disarms, and a deadline of 0 is long past anyway
+	if (deadline == 0) {
+		spec.it_value.tv_nsec = 1;
+	}
+	timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+static void
+disarm(int fd)
+{
+	struct itimerspec spec = {0};
+	timerfd_settime(fd, 0, &spec, NULL);
+}
+
+static void
+drain(int fd)
+{
+	uint64_t buf[16];
+	while (read(fd, buf, sizeof buf) > 0) {
+		// Only the wakeup matters
+	}
+}
+
+static void
+create_timers(struct wlrctl_loop *loop)
+{
+	wl_list_init(&loop->timers);
+	loop->watch = NULL;
+	loop->deadline_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	loop->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (loop->signal_fd < 0 || loop->deadline_fd < 0 || loop->timer_fd < 0) {
+		die("Could not set up the event loop: %s\n", strerror(errno));
+	}
+}
+
+void
+loop_init(struct wlrctl *state)
+{
+	struct wlrctl_loop *loop = &state->loop;
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	if (sigprocmask(SIG_BLOCK, &mask, &saved_mask) < 0) {
+		die("Could not block signals: %s\n", strerror(errno));
+	}
+
+	loop->signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	create_timers(loop);
+}
+
+/*
+ * Set up a loop for one of several threads. Only one of them could read a
+ * signal, so the loop stops once cancel_fd becomes readable instead. The
+ * caller blocks SIGINT and SIGTERM before starting the threads.
+ */
+void
+loop_init_shared(struct wlrctl *state, int cancel_fd)
+{
+	struct wlrctl_loop *loop = &state->loop;
+	loop->shared = true;
+	loop->signal_fd = fcntl(cancel_fd, F_DUPFD_CLOEXEC, 0);
+	create_timers(loop);
+}
+
+void
+loop_finish(struct wlrctl *state)
+{
+	struct wlrctl_loop *loop = &state->loop;
+	close(loop->signal_fd);
+	close(loop->deadline_fd);
+	close(loop->timer_fd);
+
+	// Signals that came in since we stopped looking still end the process
+	if (!loop->shared) {
+		sigprocmask(SIG_SETMASK, &saved_mask, NULL);
+	}
+}
+
+/*
+ * Give up waiting timeout_ns from now, or never if timeout_ns is 0.
+ */
+void
+loop_set_timeout(struct wlrctl *state, uint64_t timeout_ns)
+{
+	struct wlrctl_loop *loop = &state->loop;
+	loop->timed_out = false;
+	drain(loop->deadline_fd);
+	if (timeout_ns) {
+		arm(loop->deadline_fd, now_ns() + timeout_ns);
+	} else {
+		disarm(loop->deadline_fd);
+	}
+}
+
+static void
+rearm_timers(struct wlrctl_loop *loop)
+{
+	if (wl_list_empty(&loop->timers)) {
+		disarm(loop->timer_fd);
+		return;
+	}
+	struct wlrctl_timer *first =
+		wl_container_of(loop->timers.next, first, link);
+	arm(loop->timer_fd, first->deadline);
+}
+
+void
+loop_add_timer(struct wlrctl *state, struct wlrctl_timer *timer)
+{
+	struct wlrctl_loop *loop = &state->loop;
+	struct wl_list *pos = &loop->timers;
+	struct wlrctl_timer *other;
+	wl_list_for_each(other, &loop->timers, link) {
+		if (other->deadline > timer->deadline) {
+			pos = &other->link;
+			break;
+		}
+	}
+	wl_list_insert(pos->prev, &timer->link);
+	if (loop->timers.next == &timer->link) {
+		rearm_timers(loop);
+	}
+}
+
+void
+loop_remove_timer(struct wlrctl *state, struct wlrctl_timer *timer)
+{
+	wl_list_remove(&timer->link);
+	wl_list_init(&timer->link);
+	rearm_timers(&state->loop);
+}
+
+/*
+ * Call watch->func whenever watch->fd is ready, until the watch is replaced
+ * or set to NULL.
+ */
+void
+loop_set_watch(struct wlrctl *state, struct wlrctl_watch *watch)
+{
+	state->loop.watch = watch;
+}
+
+/*
+ * Dispatch the events that were read. A listener that dies takes the
+ * process with it: unwinding out of libwayland would leave it in the middle
+ * of the queue, so listeners leave anything that may fail to a timer.
+ */
+static int
+dispatch_pending(struct wl_display *display)
+{
+	jmp_buf *env = set_die_handler(NULL);
+	int ret = wl_display_dispatch_pending(display);
+	set_die_handler(env);
+	return ret;
+}
+
+/*
+ * Drop every timer, for a command that is given up on.
+ */
+void
+loop_clear_timers(struct wlrctl *state)
+{
+	struct wlrctl_loop *loop = &state->loop;
+	while (!wl_list_empty(&loop->timers)) {
+		struct wl_list *link = loop->timers.next;
+		wl_list_remove(link);
+		wl_list_init(link);
+	}
+	rearm_timers(loop);
+}
+
+/*
+ * Whether a timer is already due. Listeners add timers with a deadline of 0
+ * to run something right after the dispatch, without another poll.
+ */
+static bool
+timers_due(struct wlrctl_loop *loop)
+{
+	if (wl_list_empty(&loop->timers)) {
+		return false;
+	}
+	struct wlrctl_timer *first =
+		wl_container_of(loop->timers.next, first, link);
+	return first->deadline <= now_ns();
+}
+
+static void
+run_timers(struct wlrctl *state)
+{
+	struct wlrctl_loop *loop = &state->loop;
+	drain(loop->timer_fd);
+
+	uint64_t now = now_ns();
+	while (!wl_list_empty(&loop->timers)) {
+		struct wlrctl_timer *timer =
+			wl_container_of(loop->timers.next, timer, link);
+		if (timer->deadline > now) {
+			break;
+		}
+		// The callback may add the timer again
+		wl_list_remove(&timer->link);
+		wl_list_init(&timer->link);
+		timer->func(state, timer->data);
+	}
+	rearm_timers(loop);
+}
+
+/*
+ * Flush requests, wait for something to happen and dispatch it. The extra
+ * fd, if any, is polled along with the others and its revents filled in.
+ * A timeout or a signal is sticky, every later call reports it right away.
+ */
+enum loop_status
+loop_dispatch(struct wlrctl *state, struct pollfd *extra)
+{
+	struct wlrctl_loop *loop = &state->loop;
+	struct wl_display *display = state->display;
+	struct wlrctl_watch *watch = loop->watch;
+
+	if (loop->interrupted) {
+		return LOOP_INTERRUPTED;
+	} else if (loop->timed_out) {
+		return LOOP_TIMEOUT;
+	}
+
+	while (wl_display_prepare_read(display) != 0) {
+		if (dispatch_pending(display) < 0) {
+			return LOOP_ERROR;
+		}
+	}
+
+	int ret;
+	while ((ret = wl_display_flush(display)) < 0 && errno == EINTR) {
+		// Try again
+	}
+	if (ret < 0 && errno != EAGAIN) {
+		wl_display_cancel_read(display);
+		return LOOP_ERROR;
+	}
+
+	struct pollfd fds[] = {
+		{
+			.fd = wl_display_get_fd(display),
+			// Wait for room in the socket if the flush was partial
+			.events = POLLIN | (ret < 0 ? POLLOUT : 0),
+		},
+		{ .fd = loop->signal_fd, .events = POLLIN },
+		{ .fd = loop->deadline_fd, .events = POLLIN },
+		{ .fd = loop->timer_fd, .events = POLLIN },
+		{ .fd = extra ? extra->fd : -1, .events = extra ? extra->events : 0 },
+		{ .fd = watch ? watch->fd : -1, .events = watch ? watch->events : 0 },
+	};
+	if (poll(fds, sizeof fds / sizeof fds[0], -1) < 0) {
+		wl_display_cancel_read(display);
+		return errno == EINTR ? LOOP_OK : LOOP_ERROR;
+	}
+
+	if (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
+		if (wl_display_read_events(display) < 0) {
+			return LOOP_ERROR;
+		}
+	} else {
+		wl_display_cancel_read(display);
+	}
+	if (dispatch_pending(display) < 0) {
+		return LOOP_ERROR;
+	}
+	if (extra) {
+		extra->revents = fds[4].revents;
+	}
+
+	if (fds[1].revents) {
+		drain(loop->signal_fd);
+		loop->interrupted = true;
+		return LOOP_INTERRUPTED;
+	}
+	if (fds[2].revents) {
+		drain(loop->deadline_fd);
+		loop->timed_out = true;
+		fprintf(state->err, "Timed out\n");
+		return LOOP_TIMEOUT;
+	}
+	if (fds[3].revents || timers_due(loop)) {
+		run_timers(state);
+	}
+	// Events or timers may have put the watch away already
+	if (fds[5].revents && loop->watch == watch) {
+		watch->func(state, watch->data);
+	}
+	return LOOP_OK;
+}
+
+static void
+roundtrip_done(void *data, struct wl_callback *callback, uint32_t serial)
+{
+	bool *done = data;
+	*done = true;
+	wl_callback_destroy(callback);
+}
+
+static const struct wl_callback_listener roundtrip_listener = {
+	.done = roundtrip_done,
+};
+
+/*
+ * Like wl_display_roundtrip, but gives up on a timeout or signal.
+ */
+enum loop_status
+loop_roundtrip(struct wlrctl *state)
+{
+	bool done = false;
+	struct wl_callback *callback = wl_display_sync(state->display);
+	wl_callback_add_listener(callback, &roundtrip_listener, &done);
+
+	enum loop_status status = LOOP_OK;
+	while (!done && (status = loop_dispatch(state, NULL)) == LOOP_OK) {
+		// Dispatch until the callback is done
+	}
+	if (!done) {
+		wl_callback_destroy(callback);
+	}
+	return status;
+}
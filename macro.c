@@ -0,0 +1,639 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/input-event-codes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <wayland-client.h>
+#include "clock.h"
+#include "common.h"
+#include "keyboard.h"
+#include "keymap.h"
+#include "loop.h"
+#include "macro.h"
+#include "pointer.h"
+#include "utf8.h"
+#include "util.h"
+
+#include "virtual-keyboard-unstable-v1-client-protocol.h"
+#include "wlr-virtual-pointer-unstable-v1-client-protocol.h"
+
+/*
+ * Macros are compiled from a text form, one action per line:
+ *
+ *   type <text>
+ *   modifiers <SHIFT,CTRL,ALT,SUPER|none>
+ *   move <dx> <dy>
+ *   click [button]
+ *   press <button>
+ *   release <button>
+ *   scroll <dy> [dx]
+ *   wait <milliseconds>
+ *
+ * Everything that takes thought, from keymaps to modifier levels, is done
+ * by the compiler. Replaying is a walk over the events.
+ */
+
+extern const char keymap_ascii_raw[];
+
+// Events sent between sync barriers when nothing waits in between
+#define REPLAY_CHUNK 512
+#define NO_KEYMAP SIZE_MAX
+
+struct compiler {
+	struct macro_event *events;
+	size_t count, capacity;
+	// Keymap texts, one after the other
+	char *data;
+	size_t data_size;
+	size_t keymap; // offset of the current one in data
+	uint32_t user_mods, sent_mods;
+	bool mods_sent;
+	uint32_t devices;
+	int lineno;
+};
+
+static void
+emit(struct compiler *c, uint32_t op, uint32_t a, uint32_t b)
+{
+	if (c->count == c->capacity) {
+		c->capacity = c->capacity ? c->capacity * 2 : 256;
+		struct macro_event *events =
+			realloc(c->events, c->capacity * sizeof *events);
+		if (!events) {
+			die("Failed to allocate macro\n");
+		}
+		c->events = events;
+	}
+	c->events[c->count++] = (struct macro_event){ .op = op, .a = a, .b = b };
+}
+
+static void
+use_keymap(struct compiler *c, const char *text, size_t size)
+{
+	// Keymaps that come back are stored once
+	size_t offset = 0;
+	while (offset < c->data_size) {
+		size_t len = strlen(c->data + offset) + 1;
+		if (len == size && memcmp(c->data + offset, text, size) == 0) {
+			break;
+		}
+		offset += len;
+	}
+	if (offset == c->data_size) {
+		char *data = realloc(c->data, c->data_size + size);
+		if (!data) {
+			die("Failed to allocate macro\n");
+		}
+		memcpy(data + c->data_size, text, size);
+		c->data = data;
+		c->data_size += size;
+	}
+	if (offset != c->keymap) {
+		emit(c, MACRO_KEYMAP, offset, size);
+		c->keymap = offset;
+		// The modifiers are those of the old keymap
+		c->mods_sent = false;
+	}
+	c->devices |= MACRO_KEYBOARD;
+}
+
+static void
+set_mods(struct compiler *c, uint32_t mods)
+{
+	if (c->keymap == NO_KEYMAP) {
+		use_keymap(c, keymap_ascii_raw, strlen(keymap_ascii_raw) + 1);
+	}
+	if (!c->mods_sent || c->sent_mods != mods) {
+		emit(c, MACRO_MODIFIERS, mods, 0);
+		c->sent_mods = mods;
+		c->mods_sent = true;
+	}
+}
+
+static void
+emit_key(struct compiler *c, uint32_t keycode)
+{
+	emit(c, MACRO_KEY, keycode, WL_KEYBOARD_KEY_STATE_PRESSED);
+	emit(c, MACRO_KEY, keycode, WL_KEYBOARD_KEY_STATE_RELEASED);
+}
+
+static void
+compile_type(struct compiler *c, const char *text)
+{
+	size_t size = strlen(text), error;
+	uint32_t *codepoints = malloc((size ? size : 1) * sizeof *codepoints);
+	if (!codepoints) {
+		die("Failed to allocate text\n");
+	}
+	size_t len = utf8_decode(text, size, codepoints, &error);
+	if (error != size) {
+		die("Line %d: invalid UTF-8 at byte %zu\n", c->lineno, error);
+	}
+
+	bool ascii = true;
+	for (size_t i = 0; i < len; i++) {
+		ascii &= codepoints[i] < 0x80;
+	}
+	if (ascii) {
+		use_keymap(c, keymap_ascii_raw, strlen(keymap_ascii_raw) + 1);
+		set_mods(c, c->user_mods);
+		for (size_t i = 0; i < len; i++) {
+			emit_key(c, codepoints[i] - 8);
+		}
+		free(codepoints);
+		return;
+	}
+
+	size_t pos = 0;
+	while (pos < len) {
+		size_t segment = keymap_segment(codepoints + pos, len - pos);
+		struct keymap keymap;
+		keymap_generate(&keymap, codepoints + pos, segment);
+		use_keymap(c, keymap.text, keymap.size);
+		for (size_t i = pos; i < pos + segment; i++) {
+			uint32_t keycode, mods;
+			keymap_lookup(&keymap, codepoints[i], &keycode, &mods);
+			set_mods(c, c->user_mods | mods);
+			emit_key(c, keycode);
+		}
+		set_mods(c, c->user_mods);
+		keymap_finish(&keymap);
+		pos += segment;
+	}
+	free(codepoints);
+}
+
+static wl_fixed_t
+parse_fixed(const struct compiler *c, const char *value)
+{
+	char *end;
+	double d = strtod(value, &end);
+	if (end == value || *end) {
+		die("Line %d: bad value: '%s'\n", c->lineno, value);
+	}
+	return wl_fixed_from_double(d);
+}
+
+static uint32_t
+parse_button(const struct compiler *c, const char *name)
+{
+	uint32_t button = pointer_parse_button(name);
+	if (!button) {
+		die("Line %d: unknown button: '%s'\n", c->lineno, name);
+	}
+	return button;
+}
+
+static void
+emit_scroll(struct compiler *c, uint32_t op, wl_fixed_t dx, wl_fixed_t dy)
+{
+	emit(c, MACRO_AXIS_SOURCE, WL_POINTER_AXIS_SOURCE_FINGER, 0);
+	if (dx) {
+		emit(c, op, WL_POINTER_AXIS_HORIZONTAL_SCROLL, op == MACRO_AXIS ? dx : 0);
+	}
+	if (dy) {
+		emit(c, op, WL_POINTER_AXIS_VERTICAL_SCROLL, op == MACRO_AXIS ? dy : 0);
+	}
+	emit(c, MACRO_FRAME, 0, 0);
+}
+
+static void
+compile_line(struct compiler *c, int argc, char *argv[])
+{
+	enum {
+		ACTION_UNSPEC = 0, ACTION_TYPE, ACTION_MODIFIERS, ACTION_MOVE,
+		ACTION_CLICK, ACTION_PRESS, ACTION_RELEASE, ACTION_SCROLL, ACTION_WAIT,
+	};
+	static const struct token actions[] = {
+		{"type", ACTION_TYPE},
+		{"modifiers", ACTION_MODIFIERS},
+		{"move", ACTION_MOVE},
+		{"click", ACTION_CLICK},
+		{"press", ACTION_PRESS},
+		{"release", ACTION_RELEASE},
+		{"scroll", ACTION_SCROLL},
+		{"wait", ACTION_WAIT},
+		{NULL, ACTION_UNSPEC},
+	};
+	// Most actions take exactly one argument
+	static const int min_args[] = {0, 2, 2, 3, 1, 2, 2, 2, 2};
+	static const int max_args[] = {0, 2, 2, 3, 2, 2, 2, 3, 2};
+
+	int action = matchtok(actions, argv[0]);
+	if (action == ACTION_UNSPEC) {
+		die("Line %d: unknown action: '%s'\n", c->lineno, argv[0]);
+	} else if (argc < min_args[action]) {
+		die("Line %d: missing argument to '%s'\n", c->lineno, argv[0]);
+	} else if (argc > max_args[action]) {
+		die("Line %d: extra argument: '%s'\n", c->lineno, argv[max_args[action]]);
+	}
+
+	wl_fixed_t dx, dy;
+	uint32_t button;
+	switch (action) {
+	case ACTION_TYPE:
+		compile_type(c, argv[1]);
+		break;
+	case ACTION_MODIFIERS:
+		c->user_mods = strcmp(argv[1], "none") == 0 ?
+			0 : keyboard_parse_modifiers(argv[1]);
+		set_mods(c, c->user_mods);
+		break;
+	case ACTION_MOVE:
+		dx = parse_fixed(c, argv[1]);
+		dy = parse_fixed(c, argv[2]);
+		emit(c, MACRO_MOTION, dx, dy);
+		emit(c, MACRO_FRAME, 0, 0);
+		c->devices |= MACRO_POINTER;
+		break;
+	case ACTION_CLICK:
+		button = argc > 1 ? parse_button(c, argv[1]) : BTN_LEFT;
+		emit(c, MACRO_BUTTON, button, WL_POINTER_BUTTON_STATE_PRESSED);
+		emit(c, MACRO_FRAME, 0, 0);
+		emit(c, MACRO_BUTTON, button, WL_POINTER_BUTTON_STATE_RELEASED);
+		emit(c, MACRO_FRAME, 0, 0);
+		c->devices |= MACRO_POINTER;
+		break;
+	case ACTION_PRESS:
+	case ACTION_RELEASE:
+		button = parse_button(c, argv[1]);
+		emit(c, MACRO_BUTTON, button, action == ACTION_PRESS ?
+			WL_POINTER_BUTTON_STATE_PRESSED : WL_POINTER_BUTTON_STATE_RELEASED);
+		emit(c, MACRO_FRAME, 0, 0);
+		c->devices |= MACRO_POINTER;
+		break;
+	case ACTION_SCROLL:
+		dy = parse_fixed(c, argv[1]);
+		dx = argc > 2 ? parse_fixed(c, argv[2]) : 0;
+		// Like a finger on a touchpad, lifted at the end
+		emit_scroll(c, MACRO_AXIS, dx, dy);
+		emit_scroll(c, MACRO_AXIS_STOP, dx, dy);
+		c->devices |= MACRO_POINTER;
+		break;
+	case ACTION_WAIT:;
+		char *end;
+		double ms = strtod(argv[1], &end);
+		if (end == argv[1] || *end || !(ms >= 0)) {
+			die("Line %d: bad wait: '%s'\n", c->lineno, argv[1]);
+		}
+		uint64_t ns = ms * 1e6;
+		emit(c, MACRO_WAIT, (uint32_t)ns, (uint32_t)(ns >> 32));
+		break;
+	}
+}
+
+static void
+write_macro(struct compiler *c, const char *path)
+{
+	struct macro_header header = {
+		.version = MACRO_VERSION,
+		.devices = c->devices,
+		.count = c->count,
+	};
+	memcpy(header.magic, MACRO_MAGIC, sizeof header.magic);
+
+	// Keymap offsets are from the start of the file
+	size_t data_offset = sizeof header + c->count * sizeof *c->events;
+	for (size_t i = 0; i < c->count; i++) {
+		if (c->events[i].op == MACRO_KEYMAP) {
+			c->events[i].a += data_offset;
+		}
+	}
+
+	FILE *out = strcmp(path, "-") == 0 ? stdout : fopen(path, "wb");
+	if (!out) {
+		die("Could not open '%s': %s\n", path, strerror(errno));
+	}
+	fwrite(&header, sizeof header, 1, out);
+	fwrite(c->events, sizeof *c->events, c->count, out);
+	fwrite(c->data, 1, c->data_size, out);
+	if (fflush(out) != 0 || ferror(out)) {
+		die("Could not write '%s'\n", path);
+	}
+	if (out != stdout) {
+		fclose(out);
+	}
+}
+
+/*
+ * wlrctl macro compile <source> <output>
+ */
+int
+compile_macro(int argc, char *argv[])
+{
+	if (argc != 4 || strcmp(argv[1], "compile") != 0) {
+		die("Usage: wlrctl macro compile <source> <output>\n");
+	}
+	FILE *source = strcmp(argv[2], "-") == 0 ? stdin : fopen(argv[2], "r");
+	if (!source) {
+		die("Could not open '%s': %s\n", argv[2], strerror(errno));
+	}
+
+	struct compiler c = { .keymap = NO_KEYMAP };
+	char *line = NULL;
+	size_t size = 0;
+	while (getline(&line, &size, source) >= 0) {
+		c.lineno++;
+		char *args[MAX_ARGS];
+		int count = split_args(line, args, MAX_ARGS);
+		if (count < 0) {
+			die("Line %d: malformed action\n", c.lineno);
+		} else if (count > 0) {
+			compile_line(&c, count, args);
+		}
+	}
+	free(line);
+	if (source != stdin) {
+		fclose(source);
+	}
+
+	write_macro(&c, argv[3]);
+	free(c.events);
+	free(c.data);
+	return EXIT_SUCCESS;
+}
+
+// Replay
+
+/*
+ * Check everything the events point at once, so that replaying them can
+ * trust them.
+ */
+static void
+check_macro(struct wlrctl_replay_command *cmd)
+{
+	const struct macro_header *header = (const void *)cmd->map;
+	if (cmd->size < sizeof *header ||
+			memcmp(header->magic, MACRO_MAGIC, sizeof header->magic) != 0) {
+		die("'%s' is not a compiled macro\n", cmd->path);
+	} else if (header->version != MACRO_VERSION) {
+		die("'%s' is a macro of version %u, recompile it\n",
+			cmd->path, header->version);
+	} else if (header->count > (cmd->size - sizeof *header) / sizeof *cmd->events) {
+		die("'%s' is cut short\n", cmd->path);
+	}
+	cmd->events = (const void *)(cmd->map + sizeof *header);
+	cmd->count = header->count;
+	cmd->devices = header->devices;
+
+	// Only the devices in the header get created, and a keyboard without
+	// a keymap is a protocol error
+	bool keymap = false;
+	for (size_t i = 0; i < cmd->count; i++) {
+		const struct macro_event *event = &cmd->events[i];
+		if (event->op < MACRO_KEYMAP || event->op > MACRO_WAIT) {
+			die("'%s' has an unknown event\n", cmd->path);
+		}
+		uint32_t device = event->op == MACRO_WAIT ? 0 :
+			event->op <= MACRO_MODIFIERS ? MACRO_KEYBOARD : MACRO_POINTER;
+		if (device && !(cmd->devices & device)) {
+			die("'%s' has an event for a device it does not use\n", cmd->path);
+		}
+		if (event->op == MACRO_KEYMAP && (event->b == 0 ||
+				event->a > cmd->size || event->b > cmd->size - event->a ||
+				cmd->map[event->a + event->b - 1] != '\0')) {
+			die("'%s' has a broken keymap\n", cmd->path);
+		}
+		if (event->op == MACRO_KEYMAP) {
+			keymap = true;
+		} else if (device == MACRO_KEYBOARD && !keymap) {
+			die("'%s' has a key before its keymap\n", cmd->path);
+		}
+	}
+}
+
+void
+prepare_replay(struct wlrctl *state, int argc, char *argv[])
+{
+	if (argc < 1) {
+		die("Missing macro to replay\n");
+	} else if (argc > 1) {
+		die("Extra argument: '%s'\n", argv[1]);
+	}
+	struct wlrctl_replay_command *cmd = calloc(1, sizeof *cmd);
+	if (!cmd) {
+		die("Failed to allocate command\n");
+	}
+	wl_list_init(&cmd->timer.link);
+	cmd->state = state;
+	state->cmd = cmd;
+	cmd->path = strdup(argv[0]);
+
+	int fd = open(cmd->path, O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		int error = errno;
+		if (fd >= 0) {
+			close(fd);
+		}
+		die("Could not open '%s': %s\n", cmd->path, strerror(error));
+	}
+	cmd->size = st.st_size;
+	void *map = cmd->size > 0 ?
+		mmap(NULL, cmd->size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+	int error = errno;
+	close(fd);
+	if (map == MAP_FAILED) {
+		die("Could not map '%s': %s\n", cmd->path, strerror(error));
+	}
+	cmd->map = map;
+	check_macro(cmd);
+}
+
+static void replay_pump(struct wlrctl_replay_command *cmd);
+
+static void
+replay_resume(struct wlrctl *state, void *data)
+{
+	replay_pump(data);
+}
+
+static void
+replay_done(void *data, struct wl_callback *callback, uint32_t serial)
+{
+	struct wlrctl_replay_command *cmd = data;
+	wl_callback_destroy(callback);
+	if (cmd->state->cmd != cmd) {
+		return;
+	}
+	if (cmd->pos < cmd->count) {
+		replay_pump(cmd);
+		return;
+	}
+	cmd->state->running = false;
+	destroy_replay(cmd->state);
+}
+
+static const struct wl_callback_listener replay_listener = {
+	.done = replay_done,
+};
+
+/*
+ * Press or release a button, and remember it both for the replay and for
+ * the process, so that none is left stuck.
+ */
+static void
+replay_button(struct wlrctl_replay_command *cmd, uint32_t time, uint32_t button,
+		uint32_t button_state)
+{
+	bool pressed = button_state == WL_POINTER_BUTTON_STATE_PRESSED;
+	zwlr_virtual_pointer_v1_button(cmd->state->vptr, time, button, button_state);
+	pointer_track_button(cmd->state, button, pressed);
+	if (button >= BTN_MOUSE && button < BTN_MOUSE + 16) {
+		uint16_t bit = 1 << (button - BTN_MOUSE);
+		cmd->buttons = pressed ? cmd->buttons | bit : cmd->buttons & ~bit;
+	}
+}
+
+/*
+ * Send events until the next wait, then sleep until it is over. The waits
+ * add up from the start, so the replay doesn't drift.
+ */
+static void
+replay_pump(struct wlrctl_replay_command *cmd)
+{
+	struct wlrctl *state = cmd->state;
+	if (state->cmd != cmd) {
+		// The command failed and was given up on
+		return;
+	}
+	struct zwp_virtual_keyboard_v1 *kbd = state->vkbd;
+	struct zwlr_virtual_pointer_v1 *ptr = state->vptr;
+	uint32_t time = clock_resume(&state->clock, cmd->slept);
+	cmd->slept = 0;
+
+	for (int sent = 0; cmd->pos < cmd->count; sent++) {
+		if (sent == REPLAY_CHUNK) {
+			// Let the compositor catch up before the socket fills
+			struct wl_callback *callback = wl_display_sync(state->display);
+			wl_callback_add_listener(callback, &replay_listener, cmd);
+			return;
+		}
+
+		const struct macro_event *event = &cmd->events[cmd->pos++];
+		int fd;
+		switch ((enum macro_op)event->op) {
+		case MACRO_KEYMAP:
+			fd = keymap_open_anonymous((const char *)cmd->map + event->a,
+				event->b);
+			zwp_virtual_keyboard_v1_keymap(kbd,
+				WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1, fd, event->b);
+			close(fd);
+			// Not one that keyboard commands know the keys of
+			state->vkbd_keymap = WLRCTL_KEYMAP_NONE;
+			break;
+		case MACRO_KEY:
+			zwp_virtual_keyboard_v1_key(kbd, time, event->a, event->b);
+			break;
+		case MACRO_MODIFIERS:
+			zwp_virtual_keyboard_v1_modifiers(kbd, event->a, 0, 0, 0);
+			cmd->mods = event->a;
+			break;
+		case MACRO_MOTION:
+			zwlr_virtual_pointer_v1_motion(ptr, time, event->a, event->b);
+			break;
+		case MACRO_BUTTON:
+			replay_button(cmd, time, event->a, event->b);
+			break;
+		case MACRO_AXIS_SOURCE:
+			zwlr_virtual_pointer_v1_axis_source(ptr, event->a);
+			break;
+		case MACRO_AXIS:
+			zwlr_virtual_pointer_v1_axis(ptr, time, event->a, event->b);
+			break;
+		case MACRO_AXIS_STOP:
+			zwlr_virtual_pointer_v1_axis_stop(ptr, time, event->a);
+			break;
+		case MACRO_FRAME:
+			zwlr_virtual_pointer_v1_frame(ptr);
+			break;
+		case MACRO_WAIT:
+			cmd->slept = event->a | (uint64_t)event->b << 32;
+			cmd->elapsed += cmd->slept;
+			cmd->timer.deadline = cmd->start + cmd->elapsed;
+			cmd->timer.func = replay_resume;
+			cmd->timer.data = cmd;
+			loop_add_timer(state, &cmd->timer);
+			wl_display_flush(state->display);
+			return;
+		}
+	}
+
+	if (cmd->mods) {
+		// The device may outlive this command
+		zwp_virtual_keyboard_v1_modifiers(kbd, 0, 0, 0, 0);
+		cmd->mods = 0;
+	}
+	struct wl_callback *callback = wl_display_sync(state->display);
+	wl_callback_add_listener(callback, &replay_listener, cmd);
+}
+
+void
+run_replay(struct wlrctl *state)
+{
+	struct wlrctl_replay_command *cmd = state->cmd;
+	if ((cmd->devices & MACRO_KEYBOARD) && !state->vkbd) {
+		state->vkbd =
+		zwp_virtual_keyboard_manager_v1_create_virtual_keyboard(
+			state->vkbd_mgr, state->seat
+		);
+	}
+	if ((cmd->devices & MACRO_POINTER) && !state->vptr) {
+		state->vptr =
+		zwlr_virtual_pointer_manager_v1_create_virtual_pointer(
+			state->vp_mgr, state->seat
+		);
+	}
+	cmd->start = now_ns();
+	clock_begin_batch(&state->clock);
+	replay_pump(cmd);
+}
+
+/*
+ * Stop a replay that took too long, letting go of the buttons and the
+ * modifiers it holds down.
+ */
+void
+cancel_replay(struct wlrctl *state)
+{
+	struct wlrctl_replay_command *cmd = state->cmd;
+	if (!wl_list_empty(&cmd->timer.link)) {
+		loop_remove_timer(state, &cmd->timer);
+	}
+	uint32_t time = clock_begin_batch(&state->clock);
+	if (cmd->buttons) {
+		for (uint32_t i = 0; i < 16; i++) {
+			if (cmd->buttons & (1 << i)) {
+				replay_button(cmd, time, BTN_MOUSE + i,
+					WL_POINTER_BUTTON_STATE_RELEASED);
+			}
+		}
+		zwlr_virtual_pointer_v1_frame(state->vptr);
+	}
+	if (cmd->mods) {
+		zwp_virtual_keyboard_v1_modifiers(state->vkbd, 0, 0, 0, 0);
+		cmd->mods = 0;
+	}
+	wl_display_flush(state->display);
+}
+
+void
+destroy_replay(struct wlrctl *state)
+{
+	struct wlrctl_replay_command *cmd = state->cmd;
+	if (!wl_list_empty(&cmd->timer.link)) {
+		loop_remove_timer(state, &cmd->timer);
+	}
+	if (cmd->map) {
+		munmap((void *)cmd->map, cmd->size);
+	}
+	free(cmd->path);
+	free(cmd);
+}
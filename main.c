@@ -1,3 +1,4 @@
+#define _POSIX_C_SOURCE 200809L
 #include <assert.h>
 #include <getopt.h>
 #include <stdbool.h>
@@ -5,10 +6,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <xkbcommon/xkbcommon.h>
 #include <wayland-client.h>
 #include "common.h"
+#include "daemon.h"
+#include "fleet.h"
+#include "loadgen.h"
 #include "keyboard.h"
+#include "keymap.h"
+#include "layout.h"
+#include "loop.h"
+#include "macro.h"
 #include "pointer.h"
 #include "toplevel.h"
 #include "output.h"
@@ -19,8 +26,251 @@
 #include "wlr-foreign-toplevel-management-unstable-v1-client-protocol.h"
 #include "wlr-output-management-unstable-v1-client-protocol.h"
 
+#define CANCEL_TIMEOUT (UINT64_C(1000) * 1000000)
+
 static void noop() {}
 
+static uint64_t
+lap(struct wlrctl *state)
+{
+	uint64_t now = now_ns();
+	uint64_t elapsed = now - state->timing.mark;
+	state->timing.mark = now;
+	return elapsed;
+}
+
+static bool
+command_ready(struct wlrctl *state)
+{
+	switch (state->cmd_type) {
+	case WLRCTL_COMMAND_KEYBOARD:
+		return state->vkbd_mgr && state->seat;
+	case WLRCTL_COMMAND_POINTER:
+		return state->vp_mgr && state->seat &&
+			(state->output_mgr_name || !pointer_needs_outputs(state->cmd));
+	case WLRCTL_COMMAND_TOPLEVEL:
+		return state->ftl_mgr_name;
+	case WLRCTL_COMMAND_OUTPUT:
+		return state->output_mgr_name;
+	case WLRCTL_COMMAND_REPLAY:;
+		const struct wlrctl_replay_command *replay = state->cmd;
+		return state->seat &&
+			(state->vkbd_mgr || !(replay->devices & MACRO_KEYBOARD)) &&
+			(state->vp_mgr || !(replay->devices & MACRO_POINTER));
+	case WLRCTL_COMMAND_LOAD:
+		return load_ready(state);
+	case WLRCTL_COMMAND_UNSPEC:
+		break;
+	}
+	return false;
+}
+
+/*
+ * Bind what the prepared command needs and send its requests.
+ */
+static void
+start_command(struct wlrctl *state)
+{
+	if (state->persistent) {
+		lap(state);
+	} else {
+		state->timing.registry += lap(state);
+	}
+	state->started = true;
+	state->running = true;
+	state->failed = false;
+
+	switch (state->cmd_type) {
+	case WLRCTL_COMMAND_KEYBOARD:
+		if (!state->vkbd_mgr) {
+			die("Virtual Keyboard interface not found!\n");
+		}
+		run_keyboard(state);
+		break;
+	case WLRCTL_COMMAND_POINTER:
+		if (!state->vp_mgr) {
+			die("Virtual Pointer interface not found!\n");
+		}
+		run_pointer(state);
+		break;
+	case WLRCTL_COMMAND_TOPLEVEL:
+		if (!state->ftl_mgr_name) {
+			die("Foreign Toplevel Management interface not found!\n");
+		}
+		state->ftl_mgr = wl_registry_bind(state->registry, state->ftl_mgr_name,
+			&zwlr_foreign_toplevel_manager_v1_interface, 3
+		);
+		run_toplevel(state);
+		break;
+	case WLRCTL_COMMAND_OUTPUT:
+		if (!state->output_mgr_name) {
+			die("Output Management interface not found!\n");
+		}
+		state->output_mgr = wl_registry_bind(state->registry, state->output_mgr_name,
+			&zwlr_output_manager_v1_interface, 2
+		);
+		run_output(state);
+		break;
+	case WLRCTL_COMMAND_REPLAY:;
+		struct wlrctl_replay_command *replay = state->cmd;
+		if ((replay->devices & MACRO_KEYBOARD) && !state->vkbd_mgr) {
+			die("Virtual Keyboard interface not found!\n");
+		}
+		if ((replay->devices & MACRO_POINTER) && !state->vp_mgr) {
+			die("Virtual Pointer interface not found!\n");
+		}
+		run_replay(state);
+		break;
+	case WLRCTL_COMMAND_LOAD:
+		run_load(state);
+		break;
+	case WLRCTL_COMMAND_UNSPEC:
+		// unreachable
+		assert(false);
+	}
+	state->timing.action += lap(state);
+}
+
+/*
+ * The connection outlives a command that timed out, so stop whatever it was
+ * waiting for before the next one comes along. Input commands stop right
+ * away. A toplevel command needs the compositor to confirm, and if it does
+ * not in time, the command is left running.
+ */
+static void
+cancel_command(struct wlrctl *state)
+{
+	if (state->cmd_type != WLRCTL_COMMAND_TOPLEVEL) {
+		abandon_command(state);
+		return;
+	}
+	cancel_toplevel(state);
+	loop_set_timeout(state, CANCEL_TIMEOUT);
+	while (state->running && loop_dispatch(state, NULL) == LOOP_OK) {
+		// Wait for the manager to finish
+	}
+	loop_set_timeout(state, 0);
+}
+
+static void
+destroy_command(struct wlrctl *state)
+{
+	switch (state->cmd_type) {
+	case WLRCTL_COMMAND_KEYBOARD:
+		destroy_keyboard(state);
+		break;
+	case WLRCTL_COMMAND_POINTER:
+		destroy_pointer(state);
+		break;
+	case WLRCTL_COMMAND_TOPLEVEL:
+		destroy_toplevel(state);
+		if (state->ftl_mgr) {
+			zwlr_foreign_toplevel_manager_v1_destroy(state->ftl_mgr);
+			state->ftl_mgr = NULL;
+		}
+		break;
+	case WLRCTL_COMMAND_OUTPUT:
+		destroy_output(state);
+		if (state->output_mgr) {
+			zwlr_output_manager_v1_destroy(state->output_mgr);
+			state->output_mgr = NULL;
+		}
+		break;
+	case WLRCTL_COMMAND_REPLAY:
+		destroy_replay(state);
+		break;
+	case WLRCTL_COMMAND_LOAD:
+	case WLRCTL_COMMAND_UNSPEC:
+		break;
+	}
+	state->cmd = NULL;
+}
+
+/*
+ * Stop a command that failed or took too long, on a connection that
+ * outlives it, and free it. Input commands first let go of what they hold
+ * down, and are only freed once the compositor has answered everything
+ * that could still call back into them.
+ */
+void
+abandon_command(struct wlrctl *state)
+{
+	void *cmd = state->cmd;
+	state->running = false;
+	if (!cmd) {
+		return;
+	}
+	loop_set_watch(state, NULL);
+	loop_clear_timers(state);
+
+	switch (state->cmd_type) {
+	case WLRCTL_COMMAND_KEYBOARD:
+		cancel_keyboard(state);
+		break;
+	case WLRCTL_COMMAND_POINTER:
+		cancel_pointer(state);
+		break;
+	case WLRCTL_COMMAND_REPLAY:
+		cancel_replay(state);
+		break;
+	default:
+		// Nothing of theirs outlives their managers
+		destroy_command(state);
+		return;
+	}
+
+	// The callbacks see that it is not the command any more, and if the
+	// compositor does not answer, one may still come and it is left be
+	state->cmd = NULL;
+	loop_set_timeout(state, CANCEL_TIMEOUT);
+	enum loop_status status = loop_roundtrip(state);
+	loop_set_timeout(state, 0);
+	if (status == LOOP_OK) {
+		state->cmd = cmd;
+		destroy_command(state);
+	}
+}
+
+/*
+ * Dispatch events until the command is complete.
+ */
+static void
+finish_command(struct wlrctl *state)
+{
+	while (state->running) {
+		enum loop_status status = loop_dispatch(state, NULL);
+		if (status == LOOP_OK) {
+			continue;
+		}
+		state->failed = true;
+		// A watch belongs to the command, which is given up on
+		loop_set_watch(state, NULL);
+		if (status == LOOP_TIMEOUT && state->persistent) {
+			cancel_command(state);
+		} else if (state->cmd_type == WLRCTL_COMMAND_LOAD) {
+			// A load usually ends with a signal, and its key must still come up
+			cancel_load(state);
+		}
+		break;
+	}
+	state->timing.drain += lap(state);
+	state->started = false;
+	state->cmd = NULL;
+}
+
+static void
+seat_handle_capabilities(void *data, struct wl_seat *seat, uint32_t caps)
+{
+	struct wlrctl *state = data;
+	state->seat_caps = caps;
+	state->seat_caps_known = true;
+}
+
+static const struct wl_seat_listener seat_listener = {
+	.capabilities = seat_handle_capabilities,
+	.name = noop,
+};
+
 static void
 registry_handle_global(void *data, struct wl_registry *registry,
 		uint32_t name, const char *interface, uint32_t version)
@@ -28,15 +278,18 @@ registry_handle_global(void *data, struct wl_registry *registry,
 	struct wlrctl *state = data;
 
 	// Bind wl_seat
-	if (strcmp(interface, wl_seat_interface.name) == 0) {
+	if (strcmp(interface, wl_seat_interface.name) == 0 && !state->seat) {
 		state->seat = wl_registry_bind(
-			registry, name, &wl_seat_interface, 7
+			registry, name, &wl_seat_interface, version < 7 ? version : 7
 		);
+		wl_seat_add_listener(state->seat, &seat_listener, state);
 	}
 
 	// Bind zwp_virtual_keyboard_manager_v1
 	if (strcmp(interface, zwp_virtual_keyboard_manager_v1_interface.name) == 0) {
-		if (state->cmd_type == WLRCTL_COMMAND_KEYBOARD) {
+		if (state->persistent || state->cmd_type == WLRCTL_COMMAND_KEYBOARD ||
+				state->cmd_type == WLRCTL_COMMAND_REPLAY ||
+				state->cmd_type == WLRCTL_COMMAND_LOAD) {
 			state->vkbd_mgr = wl_registry_bind(
 				registry, name, &zwp_virtual_keyboard_manager_v1_interface, 1
 			);
@@ -45,29 +298,32 @@ registry_handle_global(void *data, struct wl_registry *registry,
 	
 	// Bind zwlr_virtual_pointer_manager_v1
 	if (strcmp(interface, zwlr_virtual_pointer_manager_v1_interface.name) == 0) {
-		if (state->cmd_type == WLRCTL_COMMAND_POINTER) {
+		if (state->persistent || state->cmd_type == WLRCTL_COMMAND_POINTER ||
+				state->cmd_type == WLRCTL_COMMAND_REPLAY ||
+				state->cmd_type == WLRCTL_COMMAND_LOAD) {
 			state->vp_mgr = wl_registry_bind(
 				registry, name, &zwlr_virtual_pointer_manager_v1_interface, 2
 			);
 		}
 	}
 
-	// Bind zwlr_foreign_toplevel_manager_v1
+	// The toplevel and output managers are stopped when a command is done
+	// with them, so just remember them and let run_command bind them.
 	if (strcmp(interface, zwlr_foreign_toplevel_manager_v1_interface.name) == 0) {
-		if (state->cmd_type == WLRCTL_COMMAND_TOPLEVEL) {
-			state->ftl_mgr = wl_registry_bind(
-				registry, name, &zwlr_foreign_toplevel_manager_v1_interface, 3
-			);
-		}
+		state->ftl_mgr_name = name;
 	}
-
-	// Bind zwlr_output_manager_v1
 	if (strcmp(interface, zwlr_output_manager_v1_interface.name) == 0) {
-		if (state->cmd_type == WLRCTL_COMMAND_OUTPUT) {
-			state->output_mgr = wl_registry_bind(
-				registry, name, &zwlr_output_manager_v1_interface, 2
-			);
-		}
+		state->output_mgr_name = name;
+	}
+
+	// Don't wait for the rest of the registry, the command's requests and
+	// its sync barrier can be on their way while we read it. The command
+	// may fail, so it starts from a timer once this dispatch is over.
+	if (state->cmd && !state->persistent && !state->started &&
+			wl_list_empty(&state->start_timer.link) &&
+			command_ready(state)) {
+		state->start_timer.deadline = 0;
+		loop_add_timer(state, &state->start_timer);
 	}
 }
 
@@ -77,7 +333,7 @@ wl_registry_listener = {
 	.global_remove = noop,
 };
 
-static bool
+bool
 prepare_command(struct wlrctl *state, int argc, char *argv[])
 {
 	char *command = argv[0];
@@ -87,6 +343,7 @@ prepare_command(struct wlrctl *state, int argc, char *argv[])
 		{"toplevel", WLRCTL_COMMAND_TOPLEVEL},
 		{"window",   WLRCTL_COMMAND_TOPLEVEL},
 		{"output",   WLRCTL_COMMAND_OUTPUT  },
+		{"replay",   WLRCTL_COMMAND_REPLAY  },
 		{NULL, WLRCTL_COMMAND_UNSPEC},
 	};
 
@@ -104,31 +361,232 @@ prepare_command(struct wlrctl *state, int argc, char *argv[])
 	case WLRCTL_COMMAND_OUTPUT:
 		prepare_output(state, argc - 1, argv + 1);
 		break;
+	case WLRCTL_COMMAND_REPLAY:
+		prepare_replay(state, argc - 1, argv + 1);
+		break;
+	case WLRCTL_COMMAND_LOAD:
 	case WLRCTL_COMMAND_UNSPEC:
 		return false;
 	}
 	return true;
 }
 
+void
+run_command(struct wlrctl *state)
+{
+	start_command(state);
+	finish_command(state);
+}
+
+static void
+start_timer_handle(struct wlrctl *state, void *data)
+{
+	if (!state->started && !state->failed) {
+		start_command(state);
+		wl_display_flush(state->display);
+	}
+}
+
+static void
+connect_display(struct wlrctl *state, const char *name)
+{
+	state->start_timer.func = start_timer_handle;
+	wl_list_init(&state->start_timer.link);
+	lap(state);
+	state->display = wl_display_connect(name);
+	if (!state->display) {
+		die("Could not connect to the wayland display\n");
+	}
+	state->timing.connect += lap(state);
+
+	state->registry = wl_display_get_registry(state->display);
+	wl_registry_add_listener(state->registry, &wl_registry_listener, state);
+	if (loop_roundtrip(state) != LOOP_OK) {
+		state->failed = true;
+	}
+	if (state->persistent) {
+		state->timing.registry += lap(state);
+	}
+}
+
+static void
+sync_barrier(struct wlrctl *state)
+{
+	lap(state);
+	if (loop_roundtrip(state) != LOOP_OK) {
+		state->failed = true;
+	}
+	state->timing.drain += lap(state);
+}
+
+static void
+print_timing(struct wlrctl *state)
+{
+	const struct wlrctl_timing *t = &state->timing;
+	fprintf(stderr,
+		"connect   %10.3f ms\n"
+		"registry  %10.3f ms\n"
+		"action    %10.3f ms\n"
+		"drain     %10.3f ms\n"
+		"total     %10.3f ms\n"
+		"arena     %10.1f KiB\n"
+		"keymaps   %10u\n",
+		t->connect / 1e6, t->registry / 1e6, t->action / 1e6, t->drain / 1e6,
+		(t->connect + t->registry + t->action + t->drain) / 1e6,
+		t->arena_peak / 1024.0, t->keymap_switches
+	);
+}
+
+static bool
+is_input_command(enum wlrctl_command cmd_type)
+{
+	return cmd_type == WLRCTL_COMMAND_KEYBOARD ||
+		cmd_type == WLRCTL_COMMAND_POINTER;
+}
+
+/*
+ * Run one command per line from input. Consecutive keyboard and pointer
+ * commands are sent as a group with a single sync barrier at the end of
+ * the group, other commands wait for their results as usual.
+ */
+static void
+run_batch(struct wlrctl *state, FILE *input)
+{
+	char *line = NULL;
+	size_t size = 0;
+	int lineno = 0;
+	bool pending = false;
+
+	state->batch = true;
+	while (!state->failed && getline(&line, &size, input) >= 0) {
+		lineno++;
+		char *argv[MAX_ARGS];
+		int argc = split_args(line, argv, MAX_ARGS);
+		// Stop there, but still let go of what earlier lines hold down
+		if (argc == 0) {
+			continue;
+		} else if (argc < 0) {
+			fprintf(stderr, "Malformed command on line %d\n", lineno);
+			state->failed = true;
+			break;
+		}
+		if (!prepare_command(state, argc, argv)) {
+			fprintf(stderr, "Unknown command on line %d: '%s'\n", lineno, argv[0]);
+			state->failed = true;
+			break;
+		}
+
+		if (pending && !is_input_command(state->cmd_type)) {
+			sync_barrier(state);
+			pending = false;
+		}
+		run_command(state);
+		if (state->failed) {
+			fprintf(stderr, "Command on line %d failed\n", lineno);
+			break;
+		}
+		pending |= is_input_command(state->cmd_type);
+	}
+	free(line);
+
+	if (pending) {
+		sync_barrier(state);
+	}
+}
+
+static void
+disconnect_display(struct wlrctl *state)
+{
+	// Even after a failure or a signal, no key or button stays held down
+	keyboard_release_all(state);
+	pointer_release_all(state);
+	free(state->keys);
+	state->keys = NULL;
+	if (state->vkbd) {
+		zwp_virtual_keyboard_v1_destroy(state->vkbd);
+	}
+	if (state->vptr) {
+		zwlr_virtual_pointer_v1_destroy(state->vptr);
+	}
+	wl_display_flush(state->display);
+	wl_display_disconnect(state->display);
+	state->display = NULL;
+	if (state->layout) {
+		layout_finish(state->layout);
+		free(state->layout);
+		state->layout = NULL;
+	}
+	if (state->generated) {
+		keymap_finish(state->generated);
+		free(state->generated);
+		state->generated = NULL;
+	}
+}
+
+/*
+ * Run the prepared command on a connection of its own to the named display,
+ * or the default one if name is NULL. The event loop must be set up.
+ */
+void
+run_oneshot(struct wlrctl *state, const char *name)
+{
+	// Bind globals, the command starts as soon as its globals show up
+	loop_set_timeout(state, state->timeout);
+	connect_display(state, name);
+	// The registry may not have been enough to start it
+	loop_remove_timer(state, &state->start_timer);
+	if (!state->started && !state->failed) {
+		start_command(state);
+	}
+	finish_command(state);
+	disconnect_display(state);
+}
+
 int
 main(int argc, char *argv[])
 {
-	struct wlrctl state = {0};
+	struct wlrctl state = {
+		.out = stdout,
+		.err = stderr,
+	};
+	bool daemon_mode = false, client_mode = false;
+	const char *batch_file = NULL;
+	const char *displays = NULL;
+	bool timing = false;
 
 	// Usage
 	static struct option long_options[] = {
 		{"help", no_argument, 0, 'h'},
 		{"version", no_argument, 0, 'v'},
+		{"daemon", no_argument, 0, 'd'},
+		{"client", no_argument, 0, 'c'},
+		{"file", required_argument, 0, 'f'},
+		{"timing", no_argument, 0, 't'},
+		{"timeout", required_argument, 0, 'T'},
+		{"displays", required_argument, 0, 'D'},
 		{0, 0, 0, 0}
 	};
 
 	const char *usage = 
-		"Usage: wlrctl [options] [keyboard|pointer|toplevel] <action>\n"
+		"Usage: wlrctl [options] [keyboard|pointer|toplevel|output] <action>\n"
+		"       wlrctl [options] { -f <file> | - }\n"
+		"       wlrctl [options] replay <macro>\n"
+		"       wlrctl macro compile <source> <output>\n"
+		"       wlrctl [options] loadgen [keyboards N] [pointers N] [rate N] ...\n"
 		"\n"
 		"  -h, --help     Show a help message and quit\n"
 		"  -v, --version  Show a version number and quit\n"
+		"  -d, --daemon   Serve commands on a socket in $XDG_RUNTIME_DIR\n"
+		"  -c, --client   Send the command to a running daemon, if any\n"
+		"  -f, --file     Run the commands in a file, one per line\n"
+		"  -t, --timing   Report where the time was spent on exit\n"
+		"  -T, --timeout  Give up on a command after this many seconds\n"
+		"  -D, --displays Run the command on every display in a comma\n"
+		"                 separated list, which may contain wildcards\n"
 		;
 
+	clock_init(&state.clock);
+
 	// Only allow options up front, so getopt doesn't
 	// get mad about negative numbers
 	int cmd_idx = 1;
@@ -136,13 +594,21 @@ main(int argc, char *argv[])
 		if (*argv[cmd_idx] != '-') {
 			break;
 		}
+		if (strcmp(argv[cmd_idx], "-f") == 0 ||
+				strcmp(argv[cmd_idx], "--file") == 0 ||
+				strcmp(argv[cmd_idx], "-T") == 0 ||
+				strcmp(argv[cmd_idx], "--timeout") == 0 ||
+				strcmp(argv[cmd_idx], "-D") == 0 ||
+				strcmp(argv[cmd_idx], "--displays") == 0) {
+			cmd_idx++;
+		}
 	}
 
 	// Option args
 	int c;
 	while (true) {
 		int optind = 0;
-		c = getopt_long(cmd_idx, argv, "hv", long_options, &optind);
+		c = getopt_long(cmd_idx, argv, "hvdcf:tT:D:", long_options, &optind);
 		if (c == -1) {
 			break;
 		}
@@ -154,16 +620,107 @@ main(int argc, char *argv[])
 		case 'v':
 			printf("wlrctl v%s\n", WLRCTL_VERSION);
 			return EXIT_SUCCESS;
+		case 'd':
+			daemon_mode = true;
+			break;
+		case 'c':
+			client_mode = true;
+			break;
+		case 'f':
+			batch_file = optarg;
+			break;
+		case 't':
+			timing = true;
+			break;
+		case 'T':;
+			char *end;
+			double seconds = strtod(optarg, &end);
+			if (*end || !(seconds > 0)) {
+				die("Invalid timeout: '%s'\n", optarg);
+			}
+			state.timeout = seconds * 1e9;
+			break;
+		case 'D':
+			displays = optarg;
+			break;
 		default:
 			puts(usage);
 			return EXIT_FAILURE;
 		}
 	}
+
+	if (displays && (daemon_mode || client_mode || batch_file)) {
+		fprintf(stderr, "--displays only works with a single command\n");
+		return EXIT_FAILURE;
+	}
+
+	if (daemon_mode) {
+		if (optind != argc) {
+			puts(usage);
+			return EXIT_FAILURE;
+		}
+		state.persistent = true;
+		loop_init(&state);
+		connect_display(&state, NULL);
+		int status = state.failed ? EXIT_FAILURE : run_daemon(&state);
+		disconnect_display(&state);
+		loop_finish(&state);
+		return status;
+	}
+
+	if (!batch_file && optind < argc && strcmp(argv[optind], "-") == 0) {
+		batch_file = argv[optind++];
+	}
+	if (batch_file) {
+		if (optind != argc) {
+			puts(usage);
+			return EXIT_FAILURE;
+		}
+		FILE *input = strcmp(batch_file, "-") == 0 ? stdin : fopen(batch_file, "r");
+		if (!input) {
+			die("Could not open '%s'\n", batch_file);
+		}
+		state.persistent = true;
+		loop_init(&state);
+		loop_set_timeout(&state, state.timeout);
+		connect_display(&state, NULL);
+		run_batch(&state, input);
+		disconnect_display(&state);
+		loop_finish(&state);
+		fclose(input);
+		if (timing) {
+			print_timing(&state);
+		}
+		return state.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
 	if (optind == argc) {
 		puts(usage);
 		return EXIT_FAILURE;
 	}
 
+	// Compiling doesn't need a display
+	if (strcmp(argv[optind], "macro") == 0) {
+		return compile_macro(argc - optind, argv + optind);
+	}
+
+	if (strcmp(argv[optind], "loadgen") == 0) {
+		if (displays) {
+			fprintf(stderr, "--displays doesn't work with loadgen\n");
+			return EXIT_FAILURE;
+		}
+		return run_loadgen(&state, argc - optind, argv + optind);
+	}
+
+	if (displays) {
+		return run_fleet(&state, displays, argc - optind, argv + optind);
+	}
+
+	int status;
+	if (client_mode && run_client(argc - optind, argv + optind, &status)) {
+		return status;
+	}
+
 	// Positional args
 	if (!prepare_command(&state, argc - optind, argv + optind)) {
 		fprintf(stderr, "Unknown command: '%s'\n", argv[optind]);
@@ -171,48 +728,11 @@ main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
-	// Bind Globals
-	state.running = true;
-	state.display = wl_display_connect(NULL);
-	assert(state.display);
-	state.registry = wl_display_get_registry(state.display);
-	wl_registry_add_listener(state.registry, &wl_registry_listener, &state);
-	wl_display_roundtrip(state.display);
-
-	switch (state.cmd_type) {
-	case WLRCTL_COMMAND_KEYBOARD:
-		if (!state.vkbd_mgr) {
-			die("Virtual Keyboard interface not found!\n");
-		}
-		run_keyboard(&state);
-		break;
-	case WLRCTL_COMMAND_POINTER:
-		if (!state.vp_mgr) {
-			die("Virtual Pointer interface not found!\n");
-		}
-		run_pointer(&state);
-		break;
-	case WLRCTL_COMMAND_TOPLEVEL:
-		if (!state.ftl_mgr) {
-			die("Foreign Toplevel Management interface not found!\n");
-		}
-		run_toplevel(&state);
-		break;
-	case WLRCTL_COMMAND_OUTPUT:
-		if (!state.output_mgr) {
-			die("Output Management interface not found!\n");
-		}
-		run_output(&state);
-		break;
-	case WLRCTL_COMMAND_UNSPEC:
-		// unreachable
-		assert(false);
-	}
-
-	while (state.running) {
-		if (wl_display_dispatch(state.display) < 0) {
-			break;
-		};
+	loop_init(&state);
+	run_oneshot(&state, NULL);
+	loop_finish(&state);
+	if (timing) {
+		print_timing(&state);
 	}
 
 	return state.failed ? EXIT_FAILURE : EXIT_SUCCESS;
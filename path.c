@@ -0,0 +1,136 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "path.h"
+#include "util.h"
+
+enum path_curve
+path_parse_curve(const char *name)
+{
+	static const struct token curves[] = {
+		{"linear", PATH_CURVE_LINEAR},
+		{"bezier", PATH_CURVE_BEZIER},
+		{"spline", PATH_CURVE_SPLINE},
+		{NULL, PATH_CURVE_UNSPEC},
+	};
+	return matchtok(curves, name);
+}
+
+void
+path_init(struct path *path, enum path_curve curve,
+		const struct path_point *points, size_t count)
+{
+	memset(path, 0, sizeof *path);
+	path->curve = curve;
+	path->count = count;
+	path->points = malloc(count * sizeof *path->points);
+	path->lengths = malloc(count * sizeof *path->lengths);
+	path->scratch = malloc(count * sizeof *path->scratch);
+	if (!path->points || !path->lengths || !path->scratch) {
+		die("Failed to allocate path\n");
+	}
+	memcpy(path->points, points, count * sizeof *points);
+
+	path->lengths[0] = 0;
+	for (size_t i = 1; i < count; i++) {
+		path->lengths[i] = path->lengths[i - 1] + hypot(
+			points[i].x - points[i - 1].x, points[i].y - points[i - 1].y);
+	}
+}
+
+static struct path_point
+lerp(struct path_point a, struct path_point b, double u)
+{
+	return (struct path_point){
+		.x = a.x + (b.x - a.x) * u,
+		.y = a.y + (b.y - a.y) * u,
+	};
+}
+
+static struct path_point
+eval_linear(const struct path *path, double t)
+{
+	double total = path->lengths[path->count - 1];
+	double s = t * total;
+	for (size_t i = 1; i < path->count; i++) {
+		double length = path->lengths[i] - path->lengths[i - 1];
+		if (s <= path->lengths[i] && length > 0) {
+			return lerp(path->points[i - 1], path->points[i],
+				(s - path->lengths[i - 1]) / length);
+		}
+	}
+	return path->points[path->count - 1];
+}
+
+static struct path_point
+eval_bezier(const struct path *path, double t)
+{
+	struct path_point *p = path->scratch;
+	memcpy(p, path->points, path->count * sizeof *p);
+	for (size_t n = path->count - 1; n > 0; n--) {
+		for (size_t i = 0; i < n; i++) {
+			p[i] = lerp(p[i], p[i + 1], t);
+		}
+	}
+	return p[0];
+}
+
+static double
+catmull_rom(double p0, double p1, double p2, double p3, double u)
+{
+	return 0.5 * (2 * p1 + (p2 - p0) * u +
+		(2 * p0 - 5 * p1 + 4 * p2 - p3) * u * u +
+		(3 * p1 - p0 - 3 * p2 + p3) * u * u * u);
+}
+
+static struct path_point
+eval_spline(const struct path *path, double t)
+{
+	size_t segments = path->count - 1;
+	double pos = t * segments;
+	size_t k = pos >= segments ? segments - 1 : (size_t)pos;
+	double u = pos - k;
+	// The ends count twice, so the curve starts and stops on them
+	const struct path_point *p0 = &path->points[k > 0 ? k - 1 : 0];
+	const struct path_point *p1 = &path->points[k];
+	const struct path_point *p2 = &path->points[k + 1];
+	const struct path_point *p3 = &path->points[k + 2 < path->count ? k + 2 : k + 1];
+	return (struct path_point){
+		.x = catmull_rom(p0->x, p1->x, p2->x, p3->x, u),
+		.y = catmull_rom(p0->y, p1->y, p2->y, p3->y, u),
+	};
+}
+
+/*
+ * The point t of the way along the path, for t from 0 to 1.
+ */
+struct path_point
+path_eval(const struct path *path, double t)
+{
+	if (path->count == 1 || t <= 0) {
+		return path->points[0];
+	} else if (t >= 1) {
+		// Every curve ends on the last point
+		return path->points[path->count - 1];
+	}
+	switch (path->curve) {
+	case PATH_CURVE_LINEAR:
+		return eval_linear(path, t);
+	case PATH_CURVE_BEZIER:
+		return eval_bezier(path, t);
+	case PATH_CURVE_SPLINE:
+		return eval_spline(path, t);
+	case PATH_CURVE_UNSPEC:
+		break;
+	}
+	return path->points[0];
+}
+
+void
+path_finish(struct path *path)
+{
+	free(path->points);
+	free(path->lengths);
+	free(path->scratch);
+	memset(path, 0, sizeof *path);
+}
@@ -1,16 +1,38 @@
+#define _POSIX_C_SOURCE 200809L
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <linux/input-event-codes.h>
+#include <math.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <wayland-client.h>
 #include <wayland-util.h>
+#include "clock.h"
 #include "common.h"
+#include "extents.h"
+#include "path.h"
 #include "pointer.h"
 #include "util.h"
 
 #include "wlr-virtual-pointer-unstable-v1-client-protocol.h"
 
+#define PATH_DURATION (UINT64_C(500) * 1000000)
+// When the output doesn't say how fast it refreshes
+#define PATH_RATE 60.0
+#define PATH_MAX_POINTS (MAX_ARGS / 2)
+#define SCROLL_RATE 60.0
+#define KINETIC_DURATION (UINT64_C(400) * 1000000)
+// How quickly a swipe slows down, the speed at the end is e^-DECAY of that
+// at the start
+#define KINETIC_DECAY 4.0
+// The distance of a detent, as libinput has it for most mice
+#define WHEEL_DETENT 15.0
+// Between the clicks of a double or triple click
+#define CLICK_INTERVAL (UINT64_C(100) * 1000000)
 
 static enum pointer_action
 parse_action(const char *action)
@@ -20,14 +42,28 @@ parse_action(const char *action)
 		{"motion", POINTER_ACTION_MOTION},
 		{"move",   POINTER_ACTION_MOTION},
 		{"scroll", POINTER_ACTION_SCROLL},
+		{"moveto", POINTER_ACTION_MOVETO},
+		{"clickat", POINTER_ACTION_CLICKAT},
+		{"path", POINTER_ACTION_PATH},
+		{"stream", POINTER_ACTION_STREAM},
+		{"drag", POINTER_ACTION_DRAG},
+		{"press", POINTER_ACTION_PRESS},
+		{"release", POINTER_ACTION_RELEASE},
+		{"doubleclick", POINTER_ACTION_DOUBLECLICK},
+		{"tripleclick", POINTER_ACTION_TRIPLECLICK},
+		{"wheel", POINTER_ACTION_WHEEL},
+		{"kinetic", POINTER_ACTION_KINETIC},
 		{NULL, POINTER_ACTION_UNSPEC}
 	};
 
 	return matchtok(actions, action);
 }
 
-static uint32_t
-parse_button(const char *button)
+/*
+ * Return the evdev code of a button name, or 0 if there is no such button.
+ */
+uint32_t
+pointer_parse_button(const char *button)
 {
 	static const struct token buttons[] = {
 		{"left",    BTN_LEFT   },
@@ -47,7 +83,7 @@ static void
 parse_fixed(const char *d, wl_fixed_t *fixed)
 {
 	char *end;
-	int val = strtod(d, &end);
+	double val = strtod(d, &end);
 	if (end == d || *end){
 		die("Bad value: '%s'\n", d);
 	} else {
@@ -55,27 +91,302 @@ parse_fixed(const char *d, wl_fixed_t *fixed)
 	}
 }
 
+static double
+parse_coordinate(const char *d)
+{
+	char *end;
+	double val = strtod(d, &end);
+	if (end == d || *end) {
+		die("Bad coordinate: '%s'\n", d);
+	}
+	return val;
+}
+
+static uint32_t
+parse_button(int argc, char *argv[])
+{
+	if (argc < 1) {
+		return BTN_LEFT;
+	}
+	uint32_t button = pointer_parse_button(argv[0]);
+	if (!button) {
+		die("Unknown button: '%s'\n", argv[0]);
+	}
+	return button;
+}
+
+static double
+parse_positive(const char *d)
+{
+	char *end;
+	double val = strtod(d, &end);
+	if (end == d || *end || !(val > 0)) {
+		die("Bad value: '%s'\n", d);
+	}
+	return val;
+}
+
+/*
+ * Parse a duration in milliseconds or a rate in Hz for a path, and return
+ * false if name is neither.
+ */
+static bool
+parse_path_option(struct pointer_path *p, const char *name, const char *value)
+{
+	if (strcmp(name, "duration") == 0) {
+		p->duration = parse_positive(value) * 1e6;
+	} else if (strcmp(name, "rate") == 0) {
+		p->rate = parse_positive(value);
+	} else {
+		return false;
+	}
+	return true;
+}
+
+/*
+ * A curve, then points as x y pairs, with the duration in milliseconds and
+ * the rate in Hz anywhere in between.
+ */
+static void
+parse_path(struct wlrctl_pointer_command *cmd, int argc, char *argv[])
+{
+	struct pointer_path *p = &cmd->path;
+	if (argc < 1) {
+		die("Missing path curve\n");
+	}
+	enum path_curve curve = path_parse_curve(argv[0]);
+	if (curve == PATH_CURVE_UNSPEC) {
+		die("Unknown path curve: '%s'\n", argv[0]);
+	}
+
+	p->duration = PATH_DURATION;
+	struct path_point points[PATH_MAX_POINTS];
+	size_t count = 0;
+	for (int i = 1; i < argc; i += 2) {
+		if (i + 1 == argc) {
+			die("Missing value after '%s'\n", argv[i]);
+		}
+		if (parse_path_option(p, argv[i], argv[i + 1])) {
+			continue;
+		} else if (count == PATH_MAX_POINTS) {
+			die("Too many points\n");
+		} else {
+			points[count].x = parse_coordinate(argv[i]);
+			points[count].y = parse_coordinate(argv[i + 1]);
+			count++;
+		}
+	}
+	if (count < 2) {
+		die("A path needs at least two points\n");
+	}
+	path_init(&p->path, curve, points, count);
+}
+
+/*
+ * From x1 y1 to x2 y2 with a button held, left by default, and then the
+ * options of a path.
+ */
+static void
+parse_drag(struct wlrctl_pointer_command *cmd, int argc, char *argv[])
+{
+	struct pointer_path *p = &cmd->path;
+	if (argc < 4) {
+		die("Missing position\n");
+	}
+	struct path_point points[2];
+	for (int i = 0; i < 2; i++) {
+		points[i].x = parse_coordinate(argv[2 * i]);
+		points[i].y = parse_coordinate(argv[2 * i + 1]);
+	}
+	int i = 4;
+	p->button = BTN_LEFT;
+	if (i < argc && pointer_parse_button(argv[i])) {
+		p->button = pointer_parse_button(argv[i++]);
+	}
+	p->duration = PATH_DURATION;
+	for (; i < argc; i += 2) {
+		if (i + 1 == argc || !parse_path_option(p, argv[i], argv[i + 1])) {
+			die("Bad argument: '%s'\n", argv[i]);
+		}
+	}
+	path_init(&p->path, PATH_CURVE_LINEAR, points, 2);
+}
+
+/*
+ * Vertical and maybe horizontal amounts, whole detents for the wheel, then
+ * options: the rate, detents per frame for the wheel, and the duration of
+ * a swipe.
+ */
+static void
+parse_scroll(struct wlrctl_pointer_command *cmd, int argc, char *argv[])
+{
+	struct pointer_scroll *sc = &cmd->scroll;
+	bool wheel = cmd->action == POINTER_ACTION_WHEEL;
+	sc->rate = SCROLL_RATE;
+	sc->per_frame = 1;
+	sc->duration = KINETIC_DURATION;
+
+	int i = 0;
+	for (; i < argc && i < 2; i++) {
+		char *end;
+		double val = wheel ? strtol(argv[i], &end, 10) : strtod(argv[i], &end);
+		if (end == argv[i] || *end) {
+			break;
+		}
+		if (fabs(val) > (wheel ? INT32_MAX / 2 : 1e6)) {
+			die("Too much to scroll: '%s'\n", argv[i]);
+		}
+		*(i == 0 ? &sc->dy : &sc->dx) = val;
+	}
+	if (argc == 0) {
+		die("Missing amount to scroll\n");
+	} else if (i == 0) {
+		die("Bad amount to scroll: '%s'\n", argv[0]);
+	}
+	for (; i < argc; i += 2) {
+		if (i + 1 == argc) {
+			die("Missing value after '%s'\n", argv[i]);
+		}
+		if (strcmp(argv[i], "rate") == 0) {
+			sc->rate = parse_positive(argv[i + 1]);
+		} else if (wheel && strcmp(argv[i], "per-frame") == 0) {
+			sc->per_frame = parse_positive(argv[i + 1]);
+			sc->per_frame = sc->per_frame ? sc->per_frame : 1;
+		} else if (!wheel && strcmp(argv[i], "duration") == 0) {
+			sc->duration = parse_positive(argv[i + 1]) * 1e6;
+		} else {
+			die("Bad argument: '%s'\n", argv[i]);
+		}
+	}
+}
+
+/*
+ * A button, left by default, then a time in milliseconds after the word
+ * name: how long to hold it, or how long between clicks. Each click has
+ * its press and release at the same time, like click.
+ */
+static void
+parse_steps(struct wlrctl_pointer_command *cmd, int argc, char *argv[],
+		const char *name, int clicks)
+{
+	int i = 0;
+	cmd->button = BTN_LEFT;
+	if (i < argc && pointer_parse_button(argv[i])) {
+		cmd->button = pointer_parse_button(argv[i++]);
+	}
+	bool timed = false;
+	uint64_t ns = CLICK_INTERVAL;
+	if (i < argc && strcmp(argv[i], name) == 0) {
+		if (i + 1 == argc) {
+			die("Missing value after '%s'\n", argv[i]);
+		}
+		ns = parse_positive(argv[i + 1]) * 1e6;
+		timed = true;
+		i += 2;
+	}
+	if (i < argc) {
+		die("Bad argument: '%s'\n", argv[i]);
+	}
+
+	if (clicks == 0) {
+		// A press, let go of after the hold if there is one
+		cmd->steps[cmd->step_count++] = (struct pointer_step){ 0, true };
+		if (timed) {
+			cmd->steps[cmd->step_count++] = (struct pointer_step){ ns, false };
+		}
+		return;
+	}
+	for (int c = 0; c < clicks; c++) {
+		cmd->steps[cmd->step_count++] = (struct pointer_step){ c * ns, true };
+		cmd->steps[cmd->step_count++] = (struct pointer_step){ c * ns, false };
+	}
+}
 
 void
 prepare_pointer(struct wlrctl *state, int argc, char *argv[])
 {
+	if (argc == 0) {
+		die("Missing pointer action\n");
+	}
 	struct wlrctl_pointer_command *cmd = calloc(1, sizeof (struct wlrctl_pointer_command));
 	assert(cmd);
+	// Set up to be destroyed, should the rest fail
+	wl_list_init(&cmd->path.timer.link);
+	wl_list_init(&cmd->timer.link);
+	wl_list_init(&cmd->scroll.timer.link);
+	wl_list_init(&cmd->stream.pump.link);
+	cmd->stream.fd = -1;
+	state->cmd = cmd;
+	cmd->state = state;
 
 	const char *action = argv[0];
 	cmd->action = parse_action(action);
 	switch (cmd->action) {
 	case POINTER_ACTION_CLICK:
-		if (argc < 2) {
-			cmd->button = BTN_LEFT;
-		} else {
-			const char *button = argv[1];
-			cmd->button = parse_button(button);
-			if (!cmd->button) {
-				die("Unknown button: '%s'\n", button);
-			}
+		cmd->button = parse_button(argc - 1, argv + 1);
+		break;
+	case POINTER_ACTION_MOVETO:
+	case POINTER_ACTION_CLICKAT:
+		if (argc < 3) {
+			die("Missing position\n");
+		}
+		cmd->x = parse_coordinate(argv[1]);
+		cmd->y = parse_coordinate(argv[2]);
+		if (cmd->action == POINTER_ACTION_CLICKAT) {
+			cmd->button = parse_button(argc - 3, argv + 3);
+		} else if (argc > 3) {
+			die("Extra argument: '%s'\n", argv[3]);
+		}
+		if (argc > 4) {
+			die("Extra argument: '%s'\n", argv[4]);
+		}
+		break;
+	case POINTER_ACTION_PATH:
+		parse_path(cmd, argc - 1, argv + 1);
+		break;
+	case POINTER_ACTION_DRAG:
+		parse_drag(cmd, argc - 1, argv + 1);
+		break;
+	case POINTER_ACTION_PRESS:
+		parse_steps(cmd, argc - 1, argv + 1, "hold", 0);
+		break;
+	case POINTER_ACTION_DOUBLECLICK:
+	case POINTER_ACTION_TRIPLECLICK:
+		parse_steps(cmd, argc - 1, argv + 1, "interval",
+			cmd->action == POINTER_ACTION_DOUBLECLICK ? 2 : 3);
+		break;
+	case POINTER_ACTION_WHEEL:
+	case POINTER_ACTION_KINETIC:
+		parse_scroll(cmd, argc - 1, argv + 1);
+		break;
+	case POINTER_ACTION_RELEASE:
+		// Without a button, every button wlrctl holds down
+		if (argc > 1) {
+			cmd->button = parse_button(argc - 1, argv + 1);
+		}
+		if (argc > 2) {
+			die("Extra argument: '%s'\n", argv[2]);
+		}
+		break;
+	case POINTER_ACTION_STREAM: {
+		int arg = 1;
+		if (arg < argc && (strcmp(argv[arg], "text") == 0 ||
+				strcmp(argv[arg], "binary") == 0)) {
+			cmd->stream.binary = strcmp(argv[arg], "binary") == 0;
+			arg++;
+		}
+		if (arg < argc && strcmp(argv[arg], "-") != 0) {
+			cmd->stream.path = strdup(argv[arg]);
+		}
+		if (arg + 1 < argc) {
+			die("Extra argument: '%s'\n", argv[arg + 1]);
+		}
+		// The daemon's stdin is not the client's
+		if (!cmd->stream.path && state->daemon) {
+			die("A stream needs a file when the daemon runs it\n");
 		}
 		break;
+	}
 	case POINTER_ACTION_MOTION:
 		switch (argc) {
 		case 1:
@@ -109,16 +420,18 @@ prepare_pointer(struct wlrctl *state, int argc, char *argv[])
 	case POINTER_ACTION_UNSPEC:
 		die("Unknown pointer action: '%s'\n", action);
 	}
-
-	state->cmd = cmd;
-	cmd->state = state;
 }
 
 static void
 complete_pointer(void *data, struct wl_callback *callback, uint32_t serial)
 {
-	struct wlrctl *state = data;
+	struct wlrctl_pointer_command *cmd = data;
+	struct wlrctl *state = cmd->state;
 	wl_callback_destroy(callback);
+	if (state->cmd != cmd) {
+		// The command failed and was given up on
+		return;
+	}
 	state->running = false;
 	destroy_pointer(state);
 }
@@ -128,87 +441,968 @@ static struct wl_callback_listener completed_listener = {
 };
 
 static void
-pointer_press(struct zwlr_virtual_pointer_v1 *vptr, uint32_t button)
+pointer_press(struct zwlr_virtual_pointer_v1 *vptr, uint32_t time, uint32_t button)
 {
-	zwlr_virtual_pointer_v1_button(vptr, timestamp(), button, WL_POINTER_BUTTON_STATE_PRESSED);
+	zwlr_virtual_pointer_v1_button(vptr, time, button, WL_POINTER_BUTTON_STATE_PRESSED);
 	zwlr_virtual_pointer_v1_frame(vptr);
 }
 
 static void
-pointer_release(struct zwlr_virtual_pointer_v1 *vptr, uint32_t button)
+pointer_release(struct zwlr_virtual_pointer_v1 *vptr, uint32_t time, uint32_t button)
 {
-	zwlr_virtual_pointer_v1_button(vptr, timestamp(), button, WL_POINTER_BUTTON_STATE_RELEASED);
+	zwlr_virtual_pointer_v1_button(vptr, time, button, WL_POINTER_BUTTON_STATE_RELEASED);
 	zwlr_virtual_pointer_v1_frame(vptr);
 }
 
+void
+pointer_track_button(struct wlrctl *state, uint32_t button, bool pressed)
+{
+	if (button < BTN_MOUSE || button >= BTN_MOUSE + 16) {
+		return;
+	}
+	uint16_t bit = 1 << (button - BTN_MOUSE);
+	state->buttons = pressed ? state->buttons | bit : state->buttons & ~bit;
+}
+
+/*
+ * Press or release a button in a frame of its own, and remember which are
+ * held down so that none is left stuck.
+ */
 static void
-pointer_move(struct zwlr_virtual_pointer_v1 *vptr, wl_fixed_t dx, wl_fixed_t dy)
+set_button(struct wlrctl *state, uint32_t time, uint32_t button, bool pressed)
+{
+	zwlr_virtual_pointer_v1_button(state->vptr, time, button, pressed ?
+		WL_POINTER_BUTTON_STATE_PRESSED : WL_POINTER_BUTTON_STATE_RELEASED);
+	zwlr_virtual_pointer_v1_frame(state->vptr);
+	pointer_track_button(state, button, pressed);
+}
+
+static void
+pointer_move(struct zwlr_virtual_pointer_v1 *vptr, uint32_t time,
+		wl_fixed_t dx, wl_fixed_t dy)
 {
 	if (!dx && !dy) {
 		return;
 	} else {
-		zwlr_virtual_pointer_v1_motion(vptr, timestamp(), dx, dy);
+		zwlr_virtual_pointer_v1_motion(vptr, time, dx, dy);
 		zwlr_virtual_pointer_v1_frame(vptr);
 	}
 }
 
 static void
-pointer_scroll(struct zwlr_virtual_pointer_v1 *vptr, wl_fixed_t dy, wl_fixed_t dx)
+pointer_scroll(struct zwlr_virtual_pointer_v1 *vptr, uint32_t time,
+		wl_fixed_t dy, wl_fixed_t dx)
 {
 	if (!dx && !dy) {
 		return;
 	}
 	if (dx) {
 		zwlr_virtual_pointer_v1_axis_source(vptr, WL_POINTER_AXIS_SOURCE_FINGER);
-		zwlr_virtual_pointer_v1_axis(vptr, timestamp(), WL_POINTER_AXIS_HORIZONTAL_SCROLL, dx);
+		zwlr_virtual_pointer_v1_axis(vptr, time, WL_POINTER_AXIS_HORIZONTAL_SCROLL, dx);
 	}
 	if (dy) {
 		zwlr_virtual_pointer_v1_axis_source(vptr, WL_POINTER_AXIS_SOURCE_FINGER);
-		zwlr_virtual_pointer_v1_axis(vptr, timestamp(), WL_POINTER_AXIS_VERTICAL_SCROLL, dy);
+		zwlr_virtual_pointer_v1_axis(vptr, time, WL_POINTER_AXIS_VERTICAL_SCROLL, dy);
 	}
 	zwlr_virtual_pointer_v1_frame(vptr);
 	if (dx) {
 		zwlr_virtual_pointer_v1_axis_source(vptr, WL_POINTER_AXIS_SOURCE_FINGER);
-		zwlr_virtual_pointer_v1_axis_stop(vptr, timestamp(), WL_POINTER_AXIS_HORIZONTAL_SCROLL);
+		zwlr_virtual_pointer_v1_axis_stop(vptr, time, WL_POINTER_AXIS_HORIZONTAL_SCROLL);
 	}
 	if (dy) {
 		zwlr_virtual_pointer_v1_axis_source(vptr, WL_POINTER_AXIS_SOURCE_FINGER);
-		zwlr_virtual_pointer_v1_axis_stop(vptr, timestamp(), WL_POINTER_AXIS_VERTICAL_SCROLL);
+		zwlr_virtual_pointer_v1_axis_stop(vptr, time, WL_POINTER_AXIS_VERTICAL_SCROLL);
 	}
 	zwlr_virtual_pointer_v1_frame(vptr);
 }
 
+/*
+ * Absolute positions are fractions of the box around the outputs, which
+ * the output manager knows about.
+ */
+bool
+pointer_needs_outputs(const struct wlrctl_pointer_command *cmd)
+{
+	return cmd->action == POINTER_ACTION_MOVETO ||
+		cmd->action == POINTER_ACTION_CLICKAT ||
+		cmd->action == POINTER_ACTION_PATH ||
+		cmd->action == POINTER_ACTION_DRAG;
+}
+
+static void
+fetch_extents(struct wlrctl_pointer_command *cmd)
+{
+	if (!output_extents_fetch(cmd->state, &cmd->extents)) {
+		die("Can't tell where the outputs are without the Output Management interface\n");
+	}
+}
+
+static bool
+is_inside(const struct output_extents *extents, double x, double y)
+{
+	return x >= extents->x && x < extents->x + extents->width &&
+		y >= extents->y && y < extents->y + extents->height;
+}
+
+/*
+ * Send the cursor to x, y in the layout, or as close as the outputs allow.
+ * The frame is left to the caller.
+ */
+static void
+send_position(struct wlrctl_pointer_command *cmd, uint32_t time, double x, double y)
+{
+	const struct output_extents *extents = &cmd->extents;
+	x -= extents->x;
+	y -= extents->y;
+	x = x < 0 ? 0 : x > extents->width - 1 ? extents->width - 1 : x;
+	y = y < 0 ? 0 : y > extents->height - 1 ? extents->height - 1 : y;
+	zwlr_virtual_pointer_v1_motion_absolute(cmd->device, time,
+		(uint32_t)(x + 0.5), (uint32_t)(y + 0.5), extents->width, extents->height);
+}
+
+/*
+ * Warp the cursor to x, y in the layout, and press the button in the same
+ * frame if there is one, so that the click lands where it was meant to.
+ */
+static void
+pointer_move_to(struct wlrctl_pointer_command *cmd, uint32_t time, uint32_t button)
+{
+	const struct output_extents *extents = &cmd->extents;
+	fetch_extents(cmd);
+	if (!is_inside(extents, cmd->x, cmd->y)) {
+		die("%g,%g is outside of the outputs, which span %d,%d %dx%d\n",
+			cmd->x, cmd->y, extents->x, extents->y, extents->width, extents->height);
+	}
+	send_position(cmd, time, cmd->x, cmd->y);
+	if (button) {
+		zwlr_virtual_pointer_v1_button(cmd->device, time, button,
+			WL_POINTER_BUTTON_STATE_PRESSED);
+	}
+	zwlr_virtual_pointer_v1_frame(cmd->device);
+	if (button) {
+		pointer_release(cmd->device, time, button);
+	}
+}
+
+/*
+ * End the command once the compositor has seen it, or right away in a batch,
+ * which has a sync barrier of its own.
+ */
+static void
+finish_pointer(struct wlrctl_pointer_command *cmd)
+{
+	struct wlrctl *state = cmd->state;
+	if (state->batch) {
+		state->running = false;
+		destroy_pointer(state);
+		return;
+	}
+	struct wl_callback *callback = wl_display_sync(state->display);
+	wl_callback_add_listener(callback, &completed_listener, cmd);
+}
+
+static void
+path_report(struct wlrctl_pointer_command *cmd)
+{
+	const struct pointer_path *p = &cmd->path;
+	double elapsed = (p->last - p->start) / 1e9;
+	double rate = elapsed > 0 ? (p->sent - 1) / elapsed : 0;
+	double mean = p->late_sum / p->sent;
+	double jitter = sqrt(fmax(p->late_sq / p->sent - mean * mean, 0));
+	fprintf(cmd->state->err, "Moved through %zu frames in %.3f s, %.2f Hz of "
+		"%.2f Hz, jitter %.1f us, latest %.1f us, %zu dropped\n",
+		p->sent, elapsed, rate, p->rate, jitter / 1e3, p->late_max / 1e3,
+		p->dropped);
+}
+
+static void path_pump(struct wlrctl_pointer_command *cmd);
+
+static void
+path_frame(struct wlrctl *state, void *data)
+{
+	path_pump(data);
+}
+
+/*
+ * Send the frame that is due and sleep until the next one. Frames the loop
+ * woke up too late for are dropped, so the cursor keeps to the speed it was
+ * asked for, except on the virtual clock, where every frame counts.
+ */
+static void
+path_pump(struct wlrctl_pointer_command *cmd)
+{
+	struct wlrctl *state = cmd->state;
+	struct pointer_path *p = &cmd->path;
+	if (state->cmd != cmd) {
+		// The command failed and was given up on
+		return;
+	}
+
+	uint64_t now = now_ns();
+	size_t frame = p->frame;
+	if (state->clock.type == WLRCTL_CLOCK_MONOTONIC && frame > 0) {
+		size_t due = (now - p->start) / p->period;
+		due = due < p->frames ? due : p->frames;
+		if (due > frame) {
+			p->dropped += due - frame;
+			frame = due;
+		}
+	}
+	uint64_t deadline = p->start + frame * p->period;
+	uint64_t late = now > deadline ? now - deadline : 0;
+	p->late_sum += late;
+	p->late_sq += (double)late * late;
+	p->late_max = late > p->late_max ? late : p->late_max;
+
+	uint32_t time = frame == 0 ? clock_begin_batch(&state->clock) :
+		clock_resume(&state->clock, (frame + 1 - p->frame) * p->period);
+	struct path_point point = path_eval(&p->path, (double)frame / p->frames);
+	send_position(cmd, time, point.x, point.y);
+	if (frame == 0 && p->button) {
+		// Pressed where the drag starts, in the same frame
+		zwlr_virtual_pointer_v1_button(cmd->device, time, p->button,
+			WL_POINTER_BUTTON_STATE_PRESSED);
+		pointer_track_button(state, p->button, true);
+		cmd->holding = true;
+	}
+	zwlr_virtual_pointer_v1_frame(cmd->device);
+	p->sent++;
+	p->last = now;
+
+	p->frame = frame + 1;
+	if (p->frame > p->frames) {
+		if (p->button) {
+			set_button(state, time, p->button, false);
+			cmd->holding = false;
+		}
+		path_report(cmd);
+		finish_pointer(cmd);
+		return;
+	}
+	p->timer.deadline = p->start + p->frame * p->period;
+	p->timer.func = path_frame;
+	p->timer.data = cmd;
+	loop_add_timer(state, &p->timer);
+	wl_display_flush(state->display);
+}
+
+static void
+path_start(struct wlrctl_pointer_command *cmd)
+{
+	struct pointer_path *p = &cmd->path;
+	fetch_extents(cmd);
+	// Points in between may stray off the outputs and get clamped, but the
+	// ends are where the cursor is meant to be
+	struct path_point first = p->path.points[0];
+	struct path_point last = p->path.points[p->path.count - 1];
+	if (!is_inside(&cmd->extents, first.x, first.y) ||
+			!is_inside(&cmd->extents, last.x, last.y)) {
+		die("The path has an end outside of the outputs\n");
+	}
+	if (!p->rate) {
+		int32_t refresh = output_extents_refresh_at(&cmd->extents, first.x, first.y);
+		p->rate = refresh > 0 ? refresh / 1000.0 : PATH_RATE;
+	}
+	p->period = 1e9 / p->rate;
+	// Rounded up, less a little for the period having been rounded down
+	p->frames = ceil(p->duration / 1e9 * p->rate - 1e-6);
+	p->frames = p->frames ? p->frames : 1;
+	p->start = now_ns();
+	path_pump(cmd);
+}
+
+static void steps_pump(struct wlrctl_pointer_command *cmd);
+
+static void
+steps_timer(struct wlrctl *state, void *data)
+{
+	steps_pump(data);
+}
+
+/*
+ * Press and release the button as each step comes due, on the timer in
+ * between, and finish after the last one.
+ */
+static void
+steps_pump(struct wlrctl_pointer_command *cmd)
+{
+	struct wlrctl *state = cmd->state;
+	if (state->cmd != cmd) {
+		// The command failed and was given up on
+		return;
+	}
+
+	uint64_t now = now_ns();
+	for (; cmd->step < cmd->step_count; cmd->step++) {
+		const struct pointer_step *step = &cmd->steps[cmd->step];
+		if (cmd->start + step->at > now) {
+			cmd->timer.deadline = cmd->start + step->at;
+			cmd->timer.func = steps_timer;
+			cmd->timer.data = cmd;
+			loop_add_timer(state, &cmd->timer);
+			wl_display_flush(state->display);
+			return;
+		}
+		// Steps at the same time share the event time
+		if (cmd->step == 0) {
+			cmd->time = clock_begin_batch(&state->clock);
+		} else if (step->at != step[-1].at) {
+			cmd->time = clock_resume(&state->clock, step->at - step[-1].at);
+		}
+		set_button(state, cmd->time, cmd->button, step->pressed);
+		cmd->holding = step->pressed && cmd->step + 1 < cmd->step_count;
+	}
+	finish_pointer(cmd);
+}
+
+/*
+ * Turn the wheel by the detents due by the frame, in one frame, so that a
+ * frame the loop was late for is caught up on rather than lost.
+ */
+static void
+wheel_send(struct wlrctl_pointer_command *cmd, uint32_t time, size_t frame)
+{
+	struct pointer_scroll *sc = &cmd->scroll;
+	const double amounts[] = { sc->dy, sc->dx };
+	int32_t *sent[] = { &sc->sent_y, &sc->sent_x };
+	const uint32_t axes[] = {
+		WL_POINTER_AXIS_VERTICAL_SCROLL, WL_POINTER_AXIS_HORIZONTAL_SCROLL
+	};
+	bool any = false;
+	for (int i = 0; i < 2; i++) {
+		int32_t total = fabs(amounts[i]);
+		int32_t due = frame * sc->per_frame < (size_t)total ?
+			(int32_t)(frame * sc->per_frame) : total;
+		int32_t steps = (amounts[i] < 0 ? -due : due) - *sent[i];
+		if (!steps) {
+			continue;
+		}
+		if (!any) {
+			zwlr_virtual_pointer_v1_axis_source(cmd->device,
+				WL_POINTER_AXIS_SOURCE_WHEEL);
+			any = true;
+		}
+		zwlr_virtual_pointer_v1_axis_discrete(cmd->device, time, axes[i],
+			wl_fixed_from_double(steps * WHEEL_DETENT), steps);
+		*sent[i] += steps;
+	}
+	if (any) {
+		zwlr_virtual_pointer_v1_frame(cmd->device);
+	}
+}
+
+/*
+ * Scroll by as much of the swipe as is due by the frame. The speed falls
+ * off exponentially, and the last frame stops the scroll, so that clients
+ * that scroll on by themselves know where to start from.
+ */
+static void
+kinetic_send(struct wlrctl_pointer_command *cmd, uint32_t time, size_t frame)
+{
+	struct pointer_scroll *sc = &cmd->scroll;
+	double t = (double)frame / sc->frames;
+	double done = (1 - exp(-KINETIC_DECAY * t)) / (1 - exp(-KINETIC_DECAY));
+	const double amounts[] = { sc->dy, sc->dx };
+	int32_t *sent[] = { &sc->sent_y, &sc->sent_x };
+	const uint32_t axes[] = {
+		WL_POINTER_AXIS_VERTICAL_SCROLL, WL_POINTER_AXIS_HORIZONTAL_SCROLL
+	};
+	bool any = false;
+	for (int i = 0; i < 2; i++) {
+		wl_fixed_t value = wl_fixed_from_double(amounts[i] * done) - *sent[i];
+		if (!value) {
+			continue;
+		}
+		if (!any) {
+			zwlr_virtual_pointer_v1_axis_source(cmd->device,
+				WL_POINTER_AXIS_SOURCE_FINGER);
+			any = true;
+		}
+		zwlr_virtual_pointer_v1_axis(cmd->device, time, axes[i], value);
+		*sent[i] += value;
+	}
+	if (any) {
+		zwlr_virtual_pointer_v1_frame(cmd->device);
+	}
+	if (frame < sc->frames) {
+		return;
+	}
+	// Only an axis that scrolled at all has a scroll to stop
+	any = false;
+	for (int i = 0; i < 2; i++) {
+		if (!*sent[i]) {
+			continue;
+		}
+		if (!any) {
+			zwlr_virtual_pointer_v1_axis_source(cmd->device,
+				WL_POINTER_AXIS_SOURCE_FINGER);
+			any = true;
+		}
+		zwlr_virtual_pointer_v1_axis_stop(cmd->device, time, axes[i]);
+	}
+	if (any) {
+		zwlr_virtual_pointer_v1_frame(cmd->device);
+	}
+}
+
+static void scroll_pump(struct wlrctl_pointer_command *cmd);
+
+static void
+scroll_timer(struct wlrctl *state, void *data)
+{
+	scroll_pump(data);
+}
+
+/*
+ * Send what is due and sleep until the next frame. On the monotonic clock,
+ * frames the loop woke up too late for are merged into the one it sends.
+ */
+static void
+scroll_pump(struct wlrctl_pointer_command *cmd)
+{
+	struct wlrctl *state = cmd->state;
+	struct pointer_scroll *sc = &cmd->scroll;
+	if (state->cmd != cmd) {
+		// The command failed and was given up on
+		return;
+	}
+
+	size_t frame = sc->frame + 1;
+	if (state->clock.type == WLRCTL_CLOCK_MONOTONIC && sc->frame > 0) {
+		size_t due = (now_ns() - sc->start) / sc->period + 1;
+		due = due < sc->frames ? due : sc->frames;
+		frame = due > frame ? due : frame;
+	}
+	uint32_t time = sc->frame == 0 ? clock_begin_batch(&state->clock) :
+		clock_resume(&state->clock, (frame - sc->frame) * sc->period);
+	if (cmd->action == POINTER_ACTION_WHEEL) {
+		wheel_send(cmd, time, frame);
+	} else {
+		kinetic_send(cmd, time, frame);
+	}
+	sc->frame = frame;
+
+	if (sc->frame == sc->frames) {
+		finish_pointer(cmd);
+		return;
+	}
+	sc->timer.deadline = sc->start + sc->frame * sc->period;
+	sc->timer.func = scroll_timer;
+	sc->timer.data = cmd;
+	loop_add_timer(state, &sc->timer);
+	wl_display_flush(state->display);
+}
+
+static void
+scroll_start(struct wlrctl_pointer_command *cmd)
+{
+	struct pointer_scroll *sc = &cmd->scroll;
+	sc->period = 1e9 / sc->rate;
+	if (cmd->action == POINTER_ACTION_WHEEL) {
+		double detents = fmax(fabs(sc->dy), fabs(sc->dx));
+		sc->frames = ceil(detents / sc->per_frame);
+	} else {
+		sc->frames = ceil(sc->duration / 1e9 * sc->rate - 1e-6);
+	}
+	sc->frames = sc->frames ? sc->frames : 1;
+	sc->start = now_ns();
+	scroll_pump(cmd);
+}
+
+/*
+ * Streamed events are read STREAM_CHUNK bytes at a time, and each read goes
+ * out as a batch of frames with a sync behind it. Nothing is read while
+ * STREAM_WINDOW batches wait on the compositor, so the motions that pile up
+ * in the meantime come in one read and are merged into one frame.
+ */
+#define STREAM_CHUNK 4096
+#define STREAM_WINDOW 2
+
+static void stream_pump(struct wlrctl_pointer_command *cmd);
+
+static void
+stream_finish(struct wlrctl_pointer_command *cmd)
+{
+	struct pointer_stream *stream = &cmd->stream;
+	struct wlrctl *state = cmd->state;
+	double elapsed = (now_ns() - stream->start) / 1e9;
+	fprintf(state->err, "Sent %zu events in %zu frames in %.3f s, %.0f events/s\n",
+		stream->records, stream->frames, elapsed,
+		elapsed > 0 ? stream->records / elapsed : 0);
+	state->running = false;
+	destroy_pointer(state);
+}
+
+static void
+stream_acked(void *data, struct wl_callback *callback, uint32_t serial)
+{
+	struct wlrctl_pointer_command *cmd = data;
+	struct pointer_stream *stream = &cmd->stream;
+	wl_callback_destroy(callback);
+	if (cmd->state->cmd != cmd) {
+		// The command failed and was given up on
+		return;
+	}
+	stream->outstanding--;
+	// The events may be bad, which must not come up in a listener
+	if (wl_list_empty(&stream->pump.link)) {
+		stream->pump.deadline = now_ns();
+		loop_add_timer(cmd->state, &stream->pump);
+	}
+}
+
+static struct wl_callback_listener stream_listener = {
+	.done = stream_acked
+};
+
+static void
+stream_readable(struct wlrctl *state, void *data)
+{
+	struct wlrctl_pointer_command *cmd = data;
+	cmd->stream.readable = true;
+	stream_pump(cmd);
+}
+
+static void
+stream_pumped(struct wlrctl *state, void *data)
+{
+	stream_pump(data);
+}
+
+/*
+ * Send the motion gathered so far as one frame. The part too fine for
+ * wl_fixed_t is kept for the next one, so slow motions don't get lost.
+ */
+static void
+stream_flush_motion(struct wlrctl_pointer_command *cmd, uint32_t time)
+{
+	struct pointer_stream *stream = &cmd->stream;
+	if (!stream->moving) {
+		return;
+	}
+	stream->moving = false;
+	wl_fixed_t dx = wl_fixed_from_double(stream->dx);
+	wl_fixed_t dy = wl_fixed_from_double(stream->dy);
+	stream->dx -= wl_fixed_to_double(dx);
+	stream->dy -= wl_fixed_to_double(dy);
+	if (dx || dy) {
+		zwlr_virtual_pointer_v1_motion(cmd->device, time, dx, dy);
+		zwlr_virtual_pointer_v1_frame(cmd->device);
+		stream->frames++;
+	}
+}
+
+static void
+stream_motion(struct wlrctl_pointer_command *cmd, double dx, double dy)
+{
+	struct pointer_stream *stream = &cmd->stream;
+	stream->dx += dx;
+	stream->dy += dy;
+	stream->moving = true;
+}
+
+static void
+stream_button(struct wlrctl_pointer_command *cmd, uint32_t time,
+		uint32_t button, bool pressed)
+{
+	struct pointer_stream *stream = &cmd->stream;
+	stream_flush_motion(cmd, time);
+	set_button(cmd->state, time, button, pressed);
+	stream->frames++;
+
+	size_t i = 0;
+	while (i < stream->held_count && stream->held[i] != button) {
+		i++;
+	}
+	if (pressed && i == stream->held_count && i < POINTER_STREAM_BUTTONS) {
+		stream->held[stream->held_count++] = button;
+	} else if (!pressed && i < stream->held_count) {
+		stream->held[i] = stream->held[--stream->held_count];
+	}
+}
+
+static void
+stream_scroll(struct wlrctl_pointer_command *cmd, uint32_t time,
+		wl_fixed_t dy, wl_fixed_t dx)
+{
+	struct pointer_stream *stream = &cmd->stream;
+	stream_flush_motion(cmd, time);
+	if (dx) {
+		zwlr_virtual_pointer_v1_axis_source(cmd->device, WL_POINTER_AXIS_SOURCE_WHEEL);
+		zwlr_virtual_pointer_v1_axis(cmd->device, time,
+			WL_POINTER_AXIS_HORIZONTAL_SCROLL, dx);
+	}
+	if (dy) {
+		zwlr_virtual_pointer_v1_axis_source(cmd->device, WL_POINTER_AXIS_SOURCE_WHEEL);
+		zwlr_virtual_pointer_v1_axis(cmd->device, time,
+			WL_POINTER_AXIS_VERTICAL_SCROLL, dy);
+	}
+	if (dx || dy) {
+		zwlr_virtual_pointer_v1_frame(cmd->device);
+		stream->frames++;
+	}
+}
+
+static double
+stream_number(struct pointer_stream *stream, const char *d)
+{
+	char *end;
+	double val = strtod(d, &end);
+	if (end == d || *end) {
+		die("Bad value on line %zu: '%s'\n", stream->line, d);
+	}
+	return val;
+}
+
+static uint32_t
+stream_button_code(struct pointer_stream *stream, const char *name)
+{
+	uint32_t button = pointer_parse_button(name);
+	if (!button) {
+		char *end;
+		unsigned long code = strtoul(name, &end, 0);
+		if (end == name || *end || code == 0 || code > UINT16_MAX) {
+			die("Unknown button on line %zu: '%s'\n", stream->line, name);
+		}
+		button = code;
+	}
+	return button;
+}
+
+/*
+ * One line of text: m dx dy, p button, r button or s dy [dx]. Blank lines
+ * and lines starting with # are skipped.
+ */
+static void
+stream_text_record(struct wlrctl_pointer_command *cmd, uint32_t time, char *line)
+{
+	struct pointer_stream *stream = &cmd->stream;
+	char *argv[4];
+	int argc = 0;
+	char *saveptr;
+	for (char *word = strtok_r(line, " \t\r", &saveptr); word;
+			word = strtok_r(NULL, " \t\r", &saveptr)) {
+		if (argc == 4) {
+			die("Extra argument on line %zu: '%s'\n", stream->line, word);
+		}
+		argv[argc++] = word;
+	}
+	if (argc == 0 || argv[0][0] == '#') {
+		return;
+	}
+
+	char type = strlen(argv[0]) == 1 ? argv[0][0] : 0;
+	int want = type == 'm' ? 3 : type == 's' ? argc : 2;
+	if (!type || !strchr("mprs", type) || argc != want || argc < 2 || argc > 3) {
+		die("Bad record on line %zu\n", stream->line);
+	}
+	stream->records++;
+	switch (type) {
+	case 'm':
+		stream_motion(cmd, stream_number(stream, argv[1]),
+			stream_number(stream, argv[2]));
+		break;
+	case 'p':
+	case 'r':
+		stream_button(cmd, time, stream_button_code(stream, argv[1]), type == 'p');
+		break;
+	case 's':
+		stream_scroll(cmd, time, wl_fixed_from_double(stream_number(stream, argv[1])),
+			argc == 3 ? wl_fixed_from_double(stream_number(stream, argv[2])) : 0);
+		break;
+	}
+}
+
+static void
+stream_binary_record(struct wlrctl_pointer_command *cmd, uint32_t time,
+		const struct pointer_record *record)
+{
+	struct pointer_stream *stream = &cmd->stream;
+	stream->records++;
+	switch (record->type) {
+	case POINTER_RECORD_MOTION:
+		stream_motion(cmd, wl_fixed_to_double(record->a), wl_fixed_to_double(record->b));
+		break;
+	case POINTER_RECORD_BUTTON:
+		stream_button(cmd, time, record->code,
+			record->a == WL_POINTER_BUTTON_STATE_PRESSED);
+		break;
+	case POINTER_RECORD_AXIS:
+		if (record->code == WL_POINTER_AXIS_VERTICAL_SCROLL) {
+			stream_scroll(cmd, time, record->a, 0);
+		} else if (record->code == WL_POINTER_AXIS_HORIZONTAL_SCROLL) {
+			stream_scroll(cmd, time, 0, record->a);
+		} else {
+			die("Unknown axis %u in record %zu\n", record->code, stream->records);
+		}
+		break;
+	default:
+		die("Unknown type %u in record %zu\n", record->type, stream->records);
+	}
+}
+
+/*
+ * Send the whole records in the buffer and keep the rest for the next read.
+ */
+static void
+stream_send(struct wlrctl_pointer_command *cmd, uint32_t time)
+{
+	struct pointer_stream *stream = &cmd->stream;
+	size_t used = 0;
+	if (stream->binary) {
+		struct pointer_record record;
+		for (; stream->buffered - used >= sizeof record; used += sizeof record) {
+			memcpy(&record, stream->buf + used, sizeof record);
+			stream_binary_record(cmd, time, &record);
+		}
+		if (stream->eof && used != stream->buffered) {
+			die("The stream ends in the middle of a record\n");
+		}
+	} else {
+		char *nl;
+		while ((nl = memchr(stream->buf + used, '\n', stream->buffered - used))) {
+			*nl = '\0';
+			stream->line++;
+			stream_text_record(cmd, time, stream->buf + used);
+			used = nl + 1 - stream->buf;
+		}
+		if (stream->eof && used != stream->buffered) {
+			// The last line has no newline
+			stream->buf[stream->buffered] = '\0';
+			stream->line++;
+			stream_text_record(cmd, time, stream->buf + used);
+			used = stream->buffered;
+		} else if (stream->buffered - used >= STREAM_CHUNK) {
+			die("Line %zu is too long\n", stream->line + 1);
+		}
+	}
+	stream_flush_motion(cmd, time);
+	stream->buffered -= used;
+	memmove(stream->buf, stream->buf + used, stream->buffered);
+}
+
+/*
+ * Send what can be read until the window is full or the input runs out,
+ * and finish once the compositor has seen all of it.
+ */
+static void
+stream_pump(struct wlrctl_pointer_command *cmd)
+{
+	struct pointer_stream *stream = &cmd->stream;
+	struct wlrctl *state = cmd->state;
+	if (state->cmd != cmd) {
+		// The command failed and was given up on
+		return;
+	}
+
+	while (stream->outstanding < STREAM_WINDOW && !stream->eof && stream->readable) {
+		stream->readable = false;
+		// Less than a chunk is left over from a line or record cut in half
+		ssize_t n = read(stream->fd, stream->buf + stream->buffered, STREAM_CHUNK);
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN) {
+				break;
+			}
+			die("Could not read the events: %s\n", strerror(errno));
+		}
+		stream->buffered += n;
+		stream->eof = n == 0;
+
+		uint32_t time = clock_begin_batch(&state->clock);
+		stream_send(cmd, time);
+		if (stream->eof) {
+			for (size_t i = 0; i < stream->held_count; i++) {
+				set_button(state, time, stream->held[i], false);
+			}
+			stream->held_count = 0;
+		}
+		struct wl_callback *callback = wl_display_sync(state->display);
+		wl_callback_add_listener(callback, &stream_listener, cmd);
+		stream->outstanding++;
+		wl_display_flush(state->display);
+	}
+
+	// Stop reading while the compositor is behind
+	bool want_input = !stream->eof && stream->outstanding < STREAM_WINDOW;
+	loop_set_watch(state, want_input ? &stream->watch : NULL);
+
+	if (stream->eof && stream->outstanding == 0) {
+		stream_finish(cmd);
+	}
+}
+
+static void
+stream_open(struct wlrctl_pointer_command *cmd)
+{
+	struct pointer_stream *stream = &cmd->stream;
+	if (stream->path) {
+		stream->fd = open(stream->path, O_RDONLY | O_CLOEXEC);
+		if (stream->fd < 0) {
+			die("Could not open '%s': %s\n", stream->path, strerror(errno));
+		}
+	} else {
+		stream->fd = STDIN_FILENO;
+	}
+	// Room for a chunk, what was left of the last one, and a terminator
+	stream->buf = malloc(2 * STREAM_CHUNK + 1);
+	if (!stream->buf) {
+		die("Failed to allocate stream buffer\n");
+	}
+	stream->watch.fd = stream->fd;
+	stream->watch.events = POLLIN;
+	stream->watch.func = stream_readable;
+	stream->watch.data = cmd;
+	stream->pump.func = stream_pumped;
+	stream->pump.data = cmd;
+	stream->start = now_ns();
+}
+
 void
 run_pointer(struct wlrctl *state)
 {
 	struct wlrctl_pointer_command *cmd = state->cmd;
-	cmd->device =
-	zwlr_virtual_pointer_manager_v1_create_virtual_pointer(
-		state->vp_mgr, state->seat
-	);
+	if (!state->vptr) {
+		state->vptr =
+		zwlr_virtual_pointer_manager_v1_create_virtual_pointer(
+			state->vp_mgr, state->seat
+		);
+	}
+	cmd->device = state->vptr;
+	uint32_t time = clock_begin_batch(&state->clock);
 	switch (cmd->action) {
 	case POINTER_ACTION_CLICK:
-		pointer_press(cmd->device, cmd->button);
-		pointer_release(cmd->device, cmd->button);
+		pointer_press(cmd->device, time, cmd->button);
+		pointer_release(cmd->device, time, cmd->button);
 		break;
 	case POINTER_ACTION_MOTION:
-		pointer_move(cmd->device, cmd->dx, cmd->dy);
+		pointer_move(cmd->device, time, cmd->dx, cmd->dy);
 		break;
 	case POINTER_ACTION_SCROLL:
-		pointer_scroll(cmd->device, cmd->dy, cmd->dx);
+		pointer_scroll(cmd->device, time, cmd->dy, cmd->dx);
+		break;
+	case POINTER_ACTION_MOVETO:
+		pointer_move_to(cmd, time, 0);
+		break;
+	case POINTER_ACTION_CLICKAT:
+		pointer_move_to(cmd, time, cmd->button);
+		break;
+	case POINTER_ACTION_PATH:
+		// Finishes once the last frame is out
+		path_start(cmd);
+		return;
+	case POINTER_ACTION_STREAM:
+		// Even in a batch, the stream is done once the compositor says so
+		stream_open(cmd);
+		stream_pump(cmd);
+		return;
+	case POINTER_ACTION_DRAG:
+		path_start(cmd);
+		return;
+	case POINTER_ACTION_WHEEL:
+	case POINTER_ACTION_KINETIC:
+		scroll_start(cmd);
+		return;
+	case POINTER_ACTION_PRESS:
+	case POINTER_ACTION_DOUBLECLICK:
+	case POINTER_ACTION_TRIPLECLICK:
+		cmd->start = now_ns();
+		steps_pump(cmd);
+		return;
+	case POINTER_ACTION_RELEASE:
+		if (cmd->button) {
+			// Whoever pressed it
+			set_button(state, time, cmd->button, false);
+		} else {
+			pointer_release_all(state);
+		}
 		break;
 	case POINTER_ACTION_UNSPEC:
 		// Unreachable
 		assert(false);
 	}
-	struct wl_callback *callback = wl_display_sync(state->display);
-	wl_callback_add_listener(callback, &completed_listener, state);
+	finish_pointer(cmd);
+}
+
+/*
+ * Release every button wlrctl holds down, so that nothing is left stuck
+ * when it goes away.
+ */
+void
+pointer_release_all(struct wlrctl *state)
+{
+	if (!state->vptr) {
+		return;
+	}
+	uint32_t time = clock_begin_batch(&state->clock);
+	for (uint32_t i = 0; i < 16; i++) {
+		if (state->buttons & (1 << i)) {
+			set_button(state, time, BTN_MOUSE + i, false);
+		}
+	}
+}
+
+/*
+ * Stop a command that took too long, letting go of the button it was
+ * holding down.
+ */
+void
+cancel_pointer(struct wlrctl *state)
+{
+	struct wlrctl_pointer_command *cmd = state->cmd;
+	if (!wl_list_empty(&cmd->path.timer.link)) {
+		loop_remove_timer(state, &cmd->path.timer);
+	}
+	if (!wl_list_empty(&cmd->timer.link)) {
+		loop_remove_timer(state, &cmd->timer);
+	}
+	if (!wl_list_empty(&cmd->scroll.timer.link)) {
+		loop_remove_timer(state, &cmd->scroll.timer);
+	}
+	if (!wl_list_empty(&cmd->stream.pump.link)) {
+		loop_remove_timer(state, &cmd->stream.pump);
+	}
+	if (cmd->holding) {
+		uint32_t button = cmd->action == POINTER_ACTION_DRAG ?
+			cmd->path.button : cmd->button;
+		set_button(state, clock_begin_batch(&state->clock), button, false);
+		cmd->holding = false;
+		wl_display_flush(state->display);
+	}
+	struct pointer_stream *stream = &cmd->stream;
+	if (stream->held_count) {
+		uint32_t time = clock_begin_batch(&state->clock);
+		for (size_t i = 0; i < stream->held_count; i++) {
+			set_button(state, time, stream->held[i], false);
+		}
+		stream->held_count = 0;
+		wl_display_flush(state->display);
+	}
 }
 
 void
 destroy_pointer(struct wlrctl *state)
 {
 	struct wlrctl_pointer_command *cmd = state->cmd;
-	zwlr_virtual_pointer_v1_destroy(cmd->device);
+	if (!wl_list_empty(&cmd->path.timer.link)) {
+		loop_remove_timer(state, &cmd->path.timer);
+	}
+	if (!wl_list_empty(&cmd->timer.link)) {
+		loop_remove_timer(state, &cmd->timer);
+	}
+	if (!wl_list_empty(&cmd->scroll.timer.link)) {
+		loop_remove_timer(state, &cmd->scroll.timer);
+	}
+	if (!wl_list_empty(&cmd->stream.pump.link)) {
+		loop_remove_timer(state, &cmd->stream.pump);
+	}
+	if (cmd->path.path.points) {
+		path_finish(&cmd->path.path);
+	}
+	struct pointer_stream *stream = &cmd->stream;
+	if (stream->path && stream->fd >= 0) {
+		close(stream->fd);
+	}
+	free(stream->path);
+	free(stream->buf);
 	free(cmd);
 }
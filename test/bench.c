@@ -0,0 +1,379 @@
+#define _POSIX_C_SOURCE 200809L
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "util.h"
+
+/*
+ * End to end benchmarks, running the wlrctl binary against the mock
+ * compositor. Results are printed as one JSON object per line.
+ *
+ * Usage: bench <wlrctl> <mock-compositor> [latency|throughput|toplevels|startup]
+ *
+ * The startup suite also measures every wlrctl binary listed, separated by
+ * colons, in WLRCTL_BENCH_COMPARE, e.g. builds with different profiles.
+ */
+
+#define SOCKET_NAME "wlrctl-bench"
+
+struct bench {
+	const char *wlrctl;
+	const char *compositor;
+	char runtime_dir[64];
+	pid_t compositor_pid;
+	int iterations;
+};
+
+static void
+start_compositor(struct bench *bench, int toplevels)
+{
+	int fds[2];
+	if (pipe(fds) < 0) {
+		die("Could not create pipe\n");
+	}
+
+	char count[16];
+	snprintf(count, sizeof count, "%d", toplevels);
+	bench->compositor_pid = fork();
+	if (bench->compositor_pid == 0) {
+		dup2(fds[1], STDOUT_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		execl(bench->compositor, bench->compositor,
+			"-s", SOCKET_NAME, "-t", count, (char *)NULL);
+		_exit(127);
+	}
+	close(fds[1]);
+
+	// The compositor prints its socket name once it is listening
+	char buf[64];
+	ssize_t n = read(fds[0], buf, sizeof buf);
+	close(fds[0]);
+	if (n <= 0) {
+		die("Mock compositor did not start\n");
+	}
+}
+
+static void
+stop_compositor(struct bench *bench)
+{
+	kill(bench->compositor_pid, SIGTERM);
+	waitpid(bench->compositor_pid, NULL, 0);
+}
+
+/*
+ * Run wlrctl to completion and return how long it took. If faults is not
+ * NULL, it is set to the number of minor and major page faults it caused.
+ */
+static uint64_t
+run_wlrctl(struct bench *bench, const char *const args[], const char *input,
+		long faults[2])
+{
+	struct rusage before, after;
+	getrusage(RUSAGE_CHILDREN, &before);
+
+	const char *argv[16] = { bench->wlrctl };
+	for (int i = 0; args[i]; i++) {
+		argv[i + 1] = args[i];
+	}
+
+	uint64_t start = now_ns();
+	pid_t pid = fork();
+	if (pid == 0) {
+		int null = open("/dev/null", O_WRONLY);
+		dup2(null, STDOUT_FILENO);
+		if (input) {
+			int fd = open(input, O_RDONLY);
+			dup2(fd, STDIN_FILENO);
+		}
+		execv(bench->wlrctl, (char *const *)argv);
+		_exit(127);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	uint64_t elapsed = now_ns() - start;
+	getrusage(RUSAGE_CHILDREN, &after);
+	if (faults) {
+		faults[0] = after.ru_minflt - before.ru_minflt;
+		faults[1] = after.ru_majflt - before.ru_majflt;
+	}
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		stop_compositor(bench);
+		die("wlrctl %s %s failed\n", args[0], args[1] ? args[1] : "");
+	}
+	return elapsed;
+}
+
+static int
+compare_samples(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * Time a command over the configured number of iterations, after a few
+ * warmup runs, and return the median in nanoseconds.
+ */
+static uint64_t
+measure(struct bench *bench, const char *name, const char *const args[],
+		const char *input, int iterations)
+{
+	for (int i = 0; i < 3; i++) {
+		run_wlrctl(bench, args, input, NULL);
+	}
+
+	uint64_t *samples = calloc(iterations, sizeof *samples);
+	uint64_t total = 0;
+	for (int i = 0; i < iterations; i++) {
+		samples[i] = run_wlrctl(bench, args, input, NULL);
+		total += samples[i];
+	}
+	qsort(samples, iterations, sizeof *samples, compare_samples);
+
+	uint64_t median = samples[iterations / 2];
+	printf("{\"benchmark\": \"%s\", \"unit\": \"ms\", \"iterations\": %d, "
+		"\"min\": %.3f, \"median\": %.3f, \"p90\": %.3f, \"mean\": %.3f}\n",
+		name, iterations, samples[0] / 1e6, median / 1e6,
+		samples[iterations * 9 / 10] / 1e6, total / 1e6 / iterations);
+	fflush(stdout);
+	free(samples);
+	return median;
+}
+
+static void
+report_rate(const char *name, const char *unit, double count, uint64_t ns)
+{
+	printf("{\"benchmark\": \"%s\", \"unit\": \"%s\", \"value\": %.1f}\n",
+		name, unit, count / (ns / 1e9));
+	fflush(stdout);
+}
+
+static void
+bench_latency(struct bench *bench)
+{
+	static const struct {
+		const char *name;
+		const char *args[8];
+	} commands[] = {
+		{"keyboard type", {"keyboard", "type", "hello", NULL}},
+		{"pointer click", {"pointer", "click", NULL}},
+		{"pointer move", {"pointer", "move", "10", "10", NULL}},
+		{"pointer scroll", {"pointer", "scroll", "10", NULL}},
+		{"toplevel list", {"toplevel", "list", NULL}},
+		{"toplevel find", {"toplevel", "find", "app0", NULL}},
+		{"toplevel focus", {"toplevel", "focus", "app0", NULL}},
+		{"output list", {"output", "list", NULL}},
+	};
+
+	start_compositor(bench, 10);
+	for (size_t i = 0; i < sizeof commands / sizeof commands[0]; i++) {
+		measure(bench, commands[i].name, commands[i].args, NULL,
+			bench->iterations);
+	}
+	stop_compositor(bench);
+}
+
+static void
+bench_throughput(struct bench *bench)
+{
+	int iterations = bench->iterations / 5 > 3 ? bench->iterations / 5 : 3;
+	start_compositor(bench, 10);
+
+	enum { KEYS = 1000 };
+	char text[KEYS + 1];
+	for (int i = 0; i < KEYS; i++) {
+		text[i] = 'a' + i % 26;
+	}
+	text[KEYS] = '\0';
+	const char *type[] = {"keyboard", "type", text, NULL};
+	uint64_t ns = measure(bench, "keyboard type 1000 keys", type, NULL, iterations);
+	report_rate("keystrokes", "keys/s", KEYS, ns);
+
+	enum { MOTIONS = 10000 };
+	char path[128];
+	snprintf(path, sizeof path, "%s/motions", bench->runtime_dir);
+	FILE *batch = fopen(path, "w");
+	if (!batch) {
+		die("Could not write '%s'\n", path);
+	}
+	for (int i = 0; i < MOTIONS; i++) {
+		fprintf(batch, "pointer move %d %d\n", i % 2 ? 1 : -1, 1);
+	}
+	fclose(batch);
+	const char *motions[] = {"-", NULL};
+	ns = measure(bench, "pointer move 10000 events", motions, path, iterations);
+	report_rate("pointer events", "events/s", MOTIONS, ns);
+	unlink(path);
+
+	stop_compositor(bench);
+}
+
+static void
+bench_toplevels(struct bench *bench)
+{
+	static const int counts[] = {10, 1000, 10000};
+	const char *list[] = {"toplevel", "list", NULL};
+	for (size_t i = 0; i < sizeof counts / sizeof counts[0]; i++) {
+		char name[64];
+		snprintf(name, sizeof name, "toplevel list %d windows", counts[i]);
+		int iterations = counts[i] >= 10000 ? 5 : bench->iterations;
+		start_compositor(bench, counts[i]);
+		measure(bench, name, list, NULL, iterations);
+		stop_compositor(bench);
+	}
+}
+
+static int
+compare_faults(const void *a, const void *b)
+{
+	long x = *(const long *)a, y = *(const long *)b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * Time from exec to exit and page faults, for a command that never talks
+ * to the compositor and for one that does.
+ */
+static void
+measure_startup(struct bench *bench)
+{
+	static const struct {
+		const char *name;
+		const char *args[8];
+	} commands[] = {
+		{"startup version", {"--version", NULL}},
+		{"startup pointer move", {"pointer", "move", "0", "0", NULL}},
+	};
+
+	for (size_t c = 0; c < sizeof commands / sizeof commands[0]; c++) {
+		int iterations = bench->iterations;
+		uint64_t *samples = calloc(iterations, sizeof *samples);
+		long *minor = calloc(iterations, sizeof *minor);
+		long *major = calloc(iterations, sizeof *major);
+		if (!samples || !minor || !major) {
+			die("Out of memory\n");
+		}
+
+		for (int i = 0; i < 3; i++) {
+			run_wlrctl(bench, commands[c].args, NULL, NULL);
+		}
+		for (int i = 0; i < iterations; i++) {
+			long faults[2];
+			samples[i] = run_wlrctl(bench, commands[c].args, NULL, faults);
+			minor[i] = faults[0];
+			major[i] = faults[1];
+		}
+		qsort(samples, iterations, sizeof *samples, compare_samples);
+		qsort(minor, iterations, sizeof *minor, compare_faults);
+		qsort(major, iterations, sizeof *major, compare_faults);
+
+		printf("{\"benchmark\": \"%s\", \"binary\": \"%s\", \"unit\": \"ms\", "
+			"\"iterations\": %d, \"min\": %.3f, \"median\": %.3f, "
+			"\"p90\": %.3f, \"minor_faults\": %ld, \"major_faults\": %ld}\n",
+			commands[c].name, bench->wlrctl, iterations, samples[0] / 1e6,
+			samples[iterations / 2] / 1e6, samples[iterations * 9 / 10] / 1e6,
+			minor[iterations / 2], major[iterations / 2]);
+		fflush(stdout);
+		free(samples);
+		free(minor);
+		free(major);
+	}
+}
+
+static void
+bench_startup(struct bench *bench)
+{
+	start_compositor(bench, 10);
+	measure_startup(bench);
+
+	const char *compare = getenv("WLRCTL_BENCH_COMPARE");
+	char *binaries = compare ? strdup(compare) : NULL;
+	const char *wlrctl = bench->wlrctl;
+	char *saveptr;
+	for (char *binary = binaries ? strtok_r(binaries, ":", &saveptr) : NULL;
+			binary; binary = strtok_r(NULL, ":", &saveptr)) {
+		bench->wlrctl = binary;
+		measure_startup(bench);
+	}
+	bench->wlrctl = wlrctl;
+	free(binaries);
+	stop_compositor(bench);
+}
+
+/*
+ * Remove the runtime dir along with the keymaps wlrctl cached in it.
+ */
+static void
+remove_runtime_dir(struct bench *bench)
+{
+	char dir[128], path[384];
+	snprintf(dir, sizeof dir, "%s/wlrctl", bench->runtime_dir);
+	DIR *cache = opendir(dir);
+	if (cache) {
+		struct dirent *entry;
+		while ((entry = readdir(cache))) {
+			if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..")) {
+				snprintf(path, sizeof path, "%s/%s", dir, entry->d_name);
+				unlink(path);
+			}
+		}
+		closedir(cache);
+		rmdir(dir);
+	}
+	if (rmdir(bench->runtime_dir) < 0) {
+		die("Could not remove '%s': %s\n", bench->runtime_dir, strerror(errno));
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	if (argc < 3) {
+		die("Usage: bench <wlrctl> <mock-compositor> [suite]\n");
+	}
+
+	struct bench bench = {
+		.wlrctl = argv[1],
+		.compositor = argv[2],
+		.iterations = 50,
+	};
+	const char *suite = argc > 3 ? argv[3] : NULL;
+	const char *iterations = getenv("WLRCTL_BENCH_ITERATIONS");
+	if (iterations && atoi(iterations) > 0) {
+		bench.iterations = atoi(iterations);
+	}
+
+	strcpy(bench.runtime_dir, "/tmp/wlrctl-bench-XXXXXX");
+	if (!mkdtemp(bench.runtime_dir)) {
+		die("Could not create runtime directory\n");
+	}
+	setenv("XDG_RUNTIME_DIR", bench.runtime_dir, true);
+	setenv("WAYLAND_DISPLAY", SOCKET_NAME, true);
+
+	if (!suite || strcmp(suite, "latency") == 0) {
+		bench_latency(&bench);
+	}
+	if (!suite || strcmp(suite, "throughput") == 0) {
+		bench_throughput(&bench);
+	}
+	if (!suite || strcmp(suite, "toplevels") == 0) {
+		bench_toplevels(&bench);
+	}
+	if (!suite || strcmp(suite, "startup") == 0) {
+		bench_startup(&bench);
+	}
+
+	remove_runtime_dir(&bench);
+	return EXIT_SUCCESS;
+}
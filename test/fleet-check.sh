@@ -0,0 +1,50 @@
+#!/bin/sh
+# Run a command that fails on one display of a fleet, and check that the
+# other display still runs it and the failure is reported with its name.
+#
+# Usage: fleet-check.sh <wlrctl> <mock-compositor>
+set -e
+
+wlrctl=$1
+compositor=$2
+
+runtime_dir=$(mktemp -d)
+export XDG_RUNTIME_DIR="$runtime_dir"
+
+# One output on a, two side by side on b
+"$compositor" -s wlrctl-fleet-a -o 1 -R "$runtime_dir/a.log" > "$runtime_dir/a.ready" &
+pid_a=$!
+"$compositor" -s wlrctl-fleet-b -o 2 -R "$runtime_dir/b.log" > "$runtime_dir/b.ready" &
+pid_b=$!
+trap 'kill $pid_a $pid_b 2> /dev/null; rm -rf "$runtime_dir"' EXIT
+
+# The compositors print their socket names once they are listening
+while [ ! -s "$runtime_dir/a.ready" ] || [ ! -s "$runtime_dir/b.ready" ]; do
+	sleep 0.01
+done
+
+fail() {
+	echo "fleet-check: $*" >&2
+	cat "$runtime_dir/err" >&2
+	exit 1
+}
+
+# Only b reaches past the first output
+if "$wlrctl" --timeout 5 --displays wlrctl-fleet-a,wlrctl-fleet-b \
+		pointer moveto 3000 500 2> "$runtime_dir/err"; then
+	fail "the fleet succeeded although a could not move the pointer"
+fi
+
+kill $pid_a $pid_b
+wait $pid_a $pid_b || true
+
+grep -q '^wlrctl-fleet-a: .*outside of the outputs' "$runtime_dir/err" ||
+	fail "the error on a is missing its display name"
+if grep -q '^wlrctl-fleet-b: ' "$runtime_dir/err"; then
+	fail "b reported an error"
+fi
+grep -q 'motion_absolute' "$runtime_dir/b.log" ||
+	fail "b never got the pointer motion"
+if grep -q 'motion_absolute' "$runtime_dir/a.log"; then
+	fail "a got a pointer motion outside of its outputs"
+fi
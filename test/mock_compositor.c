@@ -0,0 +1,949 @@
+#define _POSIX_C_SOURCE 200809L
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <wayland-server.h>
+#include "util.h"
+
+#include "virtual-keyboard-unstable-v1-server-protocol.h"
+#include "wlr-virtual-pointer-unstable-v1-server-protocol.h"
+#include "wlr-foreign-toplevel-management-unstable-v1-server-protocol.h"
+#include "wlr-output-management-unstable-v1-server-protocol.h"
+
+/*
+ * A stand-in compositor for testing and benchmarking wlrctl without a
+ * wlroots session. It advertises the globals wlrctl uses, keeps a model of
+ * toplevels and heads that honours the toplevel requests, can churn that
+ * state on a timer, and can record every request it receives. Input from
+ * the virtual devices is otherwise discarded, but the last keymap a virtual
+ * keyboard set becomes the seat's, as on a real compositor.
+ */
+
+#define MODE_COUNT 2
+
+static const struct {
+	int32_t width, height, refresh;
+} modes[MODE_COUNT] = {
+	{1920, 1080, 60000},
+	{1280, 720, 60000},
+};
+
+struct mock {
+	struct wl_display *display;
+	struct wl_list toplevels; // mock_toplevel::link
+	struct wl_list toplevel_managers; // wl_resource links
+	struct wl_list output_bindings; // output_binding::link
+	struct mock_head *heads;
+	int head_count;
+	int next_toplevel;
+
+	struct wl_event_source *churn_timer;
+	int churn_interval, churn_steps, churn_step;
+
+	FILE *record;
+	bool record_times;
+	uint64_t start;
+
+	// The seat's keymap, sent to every wl_keyboard
+	int keymap_fd;
+	uint32_t keymap_size;
+};
+
+struct mock_toplevel {
+	int id;
+	char app_id[32];
+	char title[64];
+	uint32_t state; // bit per zwlr_foreign_toplevel_handle_v1_state
+	struct wl_list resources; // wl_resource links
+	struct wl_list link;
+	struct mock *mock;
+};
+
+struct mock_head {
+	char name[24];
+	int32_t x;
+	int current_mode;
+};
+
+// The heads and modes sent to one zwlr_output_manager_v1
+struct output_binding {
+	struct wl_resource *manager;
+	struct wl_resource **heads;
+	struct wl_resource **modes; // MODE_COUNT per head
+	struct wl_list link;
+	struct mock *mock;
+};
+
+static void noop() {}
+
+static void
+destroy_resource(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+remove_resource(struct wl_resource *resource)
+{
+	wl_list_remove(wl_resource_get_link(resource));
+}
+
+static struct wl_resource *
+create_resource(struct wl_client *client, const struct wl_interface *interface,
+		int version, uint32_t id, const void *impl, void *data)
+{
+	struct wl_resource *resource =
+		wl_resource_create(client, interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return NULL;
+	}
+	wl_resource_set_implementation(resource, impl, data, NULL);
+	return resource;
+}
+
+// wl_seat
+
+static const struct wl_pointer_interface pointer_impl = {
+	.set_cursor = noop,
+	.release = destroy_resource,
+};
+
+static const struct wl_keyboard_interface keyboard_impl = {
+	.release = destroy_resource,
+};
+
+static const struct wl_touch_interface touch_impl = {
+	.release = destroy_resource,
+};
+
+static void
+seat_get_pointer(struct wl_client *client, struct wl_resource *resource,
+		uint32_t id)
+{
+	create_resource(client, &wl_pointer_interface,
+		wl_resource_get_version(resource), id, &pointer_impl, NULL);
+}
+
+static void
+seat_get_keyboard(struct wl_client *client, struct wl_resource *resource,
+		uint32_t id)
+{
+	struct mock *mock = wl_resource_get_user_data(resource);
+	struct wl_resource *keyboard = create_resource(client, &wl_keyboard_interface,
+		wl_resource_get_version(resource), id, &keyboard_impl, NULL);
+	if (keyboard) {
+		wl_keyboard_send_keymap(keyboard, WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1,
+			mock->keymap_fd, mock->keymap_size);
+	}
+}
+
+static void
+seat_get_touch(struct wl_client *client, struct wl_resource *resource,
+		uint32_t id)
+{
+	create_resource(client, &wl_touch_interface,
+		wl_resource_get_version(resource), id, &touch_impl, NULL);
+}
+
+static const struct wl_seat_interface seat_impl = {
+	.get_pointer = seat_get_pointer,
+	.get_keyboard = seat_get_keyboard,
+	.get_touch = seat_get_touch,
+	.release = destroy_resource,
+};
+
+static void
+bind_seat(struct wl_client *client, void *data, uint32_t version, uint32_t id)
+{
+	struct wl_resource *resource = create_resource(client,
+		&wl_seat_interface, version, id, &seat_impl, data);
+	if (!resource) {
+		return;
+	}
+	wl_seat_send_capabilities(resource,
+		WL_SEAT_CAPABILITY_POINTER | WL_SEAT_CAPABILITY_KEYBOARD);
+	if (version >= WL_SEAT_NAME_SINCE_VERSION) {
+		wl_seat_send_name(resource, "seat0");
+	}
+}
+
+// zwp_virtual_keyboard_manager_v1
+
+static void
+virtual_keyboard_keymap(struct wl_client *client, struct wl_resource *resource,
+		uint32_t format, int32_t fd, uint32_t size)
+{
+	struct mock *mock = wl_resource_get_user_data(resource);
+	close(mock->keymap_fd);
+	mock->keymap_fd = fd;
+	mock->keymap_size = size;
+}
+
+static const struct zwp_virtual_keyboard_v1_interface virtual_keyboard_impl = {
+	.keymap = virtual_keyboard_keymap,
+	.key = noop,
+	.modifiers = noop,
+	.destroy = destroy_resource,
+};
+
+static void
+create_virtual_keyboard(struct wl_client *client, struct wl_resource *resource,
+		struct wl_resource *seat, uint32_t id)
+{
+	create_resource(client, &zwp_virtual_keyboard_v1_interface,
+		wl_resource_get_version(resource), id, &virtual_keyboard_impl,
+		wl_resource_get_user_data(resource));
+}
+
+static const struct zwp_virtual_keyboard_manager_v1_interface
+virtual_keyboard_manager_impl = {
+	.create_virtual_keyboard = create_virtual_keyboard,
+};
+
+static void
+bind_virtual_keyboard_manager(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id)
+{
+	create_resource(client, &zwp_virtual_keyboard_manager_v1_interface,
+		version, id, &virtual_keyboard_manager_impl, data);
+}
+
+// zwlr_virtual_pointer_manager_v1
+
+static const struct zwlr_virtual_pointer_v1_interface virtual_pointer_impl = {
+	.motion = noop,
+	.motion_absolute = noop,
+	.button = noop,
+	.axis = noop,
+	.frame = noop,
+	.axis_source = noop,
+	.axis_stop = noop,
+	.axis_discrete = noop,
+	.destroy = destroy_resource,
+};
+
+static void
+create_virtual_pointer(struct wl_client *client, struct wl_resource *resource,
+		struct wl_resource *seat, uint32_t id)
+{
+	create_resource(client, &zwlr_virtual_pointer_v1_interface,
+		wl_resource_get_version(resource), id, &virtual_pointer_impl, NULL);
+}
+
+static void
+create_virtual_pointer_with_output(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *seat,
+		struct wl_resource *output, uint32_t id)
+{
+	create_virtual_pointer(client, resource, seat, id);
+}
+
+static const struct zwlr_virtual_pointer_manager_v1_interface
+virtual_pointer_manager_impl = {
+	.create_virtual_pointer = create_virtual_pointer,
+	.destroy = destroy_resource,
+	.create_virtual_pointer_with_output = create_virtual_pointer_with_output,
+};
+
+static void
+bind_virtual_pointer_manager(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id)
+{
+	create_resource(client, &zwlr_virtual_pointer_manager_v1_interface,
+		version, id, &virtual_pointer_manager_impl, data);
+}
+
+// zwlr_foreign_toplevel_manager_v1
+
+static void toplevel_destroy(struct mock_toplevel *toplevel);
+
+static void
+toplevel_send_state(struct mock_toplevel *toplevel, struct wl_resource *resource)
+{
+	struct wl_array state;
+	wl_array_init(&state);
+	for (uint32_t bit = 0; bit < 32; bit++) {
+		if (toplevel->state & (1u << bit)) {
+			uint32_t *value = wl_array_add(&state, sizeof *value);
+			if (value) {
+				*value = bit;
+			}
+		}
+	}
+	zwlr_foreign_toplevel_handle_v1_send_state(resource, &state);
+	wl_array_release(&state);
+}
+
+static void
+toplevel_send_all(struct mock_toplevel *toplevel, struct wl_resource *resource)
+{
+	zwlr_foreign_toplevel_handle_v1_send_app_id(resource, toplevel->app_id);
+	zwlr_foreign_toplevel_handle_v1_send_title(resource, toplevel->title);
+	toplevel_send_state(toplevel, resource);
+	zwlr_foreign_toplevel_handle_v1_send_done(resource);
+}
+
+static void
+toplevel_broadcast_state(struct mock_toplevel *toplevel)
+{
+	struct wl_resource *resource;
+	wl_resource_for_each(resource, &toplevel->resources) {
+		toplevel_send_state(toplevel, resource);
+		zwlr_foreign_toplevel_handle_v1_send_done(resource);
+	}
+}
+
+static void
+toplevel_set_state(struct mock_toplevel *toplevel, uint32_t state, bool enabled)
+{
+	uint32_t bit = 1u << state;
+	if (!!(toplevel->state & bit) == enabled) {
+		return;
+	}
+	toplevel->state ^= bit;
+	toplevel_broadcast_state(toplevel);
+}
+
+static void
+toplevel_activate(struct mock_toplevel *toplevel)
+{
+	struct mock_toplevel *other;
+	wl_list_for_each(other, &toplevel->mock->toplevels, link) {
+		toplevel_set_state(other, ZWLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_ACTIVATED,
+			other == toplevel);
+	}
+}
+
+static struct mock_toplevel *
+toplevel_from_resource(struct wl_resource *resource)
+{
+	return wl_resource_get_user_data(resource);
+}
+
+static void
+toplevel_handle_set_maximized(struct wl_client *client,
+		struct wl_resource *resource)
+{
+	struct mock_toplevel *toplevel = toplevel_from_resource(resource);
+	if (toplevel) {
+		toplevel_set_state(toplevel,
+			ZWLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_MAXIMIZED, true);
+	}
+}
+
+static void
+toplevel_handle_unset_maximized(struct wl_client *client,
+		struct wl_resource *resource)
+{
+	struct mock_toplevel *toplevel = toplevel_from_resource(resource);
+	if (toplevel) {
+		toplevel_set_state(toplevel,
+			ZWLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_MAXIMIZED, false);
+	}
+}
+
+static void
+toplevel_handle_set_minimized(struct wl_client *client,
+		struct wl_resource *resource)
+{
+	struct mock_toplevel *toplevel = toplevel_from_resource(resource);
+	if (toplevel) {
+		toplevel_set_state(toplevel,
+			ZWLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_MINIMIZED, true);
+	}
+}
+
+static void
+toplevel_handle_unset_minimized(struct wl_client *client,
+		struct wl_resource *resource)
+{
+	struct mock_toplevel *toplevel = toplevel_from_resource(resource);
+	if (toplevel) {
+		toplevel_set_state(toplevel,
+			ZWLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_MINIMIZED, false);
+	}
+}
+
+static void
+toplevel_handle_activate(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *seat)
+{
+	struct mock_toplevel *toplevel = toplevel_from_resource(resource);
+	if (toplevel) {
+		toplevel_activate(toplevel);
+	}
+}
+
+static void
+toplevel_handle_close(struct wl_client *client, struct wl_resource *resource)
+{
+	struct mock_toplevel *toplevel = toplevel_from_resource(resource);
+	if (toplevel) {
+		toplevel_destroy(toplevel);
+	}
+}
+
+static void
+toplevel_handle_set_fullscreen(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *output)
+{
+	struct mock_toplevel *toplevel = toplevel_from_resource(resource);
+	if (toplevel) {
+		toplevel_set_state(toplevel,
+			ZWLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_FULLSCREEN, true);
+	}
+}
+
+static void
+toplevel_handle_unset_fullscreen(struct wl_client *client,
+		struct wl_resource *resource)
+{
+	struct mock_toplevel *toplevel = toplevel_from_resource(resource);
+	if (toplevel) {
+		toplevel_set_state(toplevel,
+			ZWLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_FULLSCREEN, false);
+	}
+}
+
+static const struct zwlr_foreign_toplevel_handle_v1_interface toplevel_impl = {
+	.set_maximized = toplevel_handle_set_maximized,
+	.unset_maximized = toplevel_handle_unset_maximized,
+	.set_minimized = toplevel_handle_set_minimized,
+	.unset_minimized = toplevel_handle_unset_minimized,
+	.activate = toplevel_handle_activate,
+	.close = toplevel_handle_close,
+	.set_rectangle = noop,
+	.destroy = destroy_resource,
+	.set_fullscreen = toplevel_handle_set_fullscreen,
+	.unset_fullscreen = toplevel_handle_unset_fullscreen,
+};
+
+static void
+toplevel_send_to_manager(struct mock_toplevel *toplevel,
+		struct wl_resource *manager)
+{
+	struct wl_client *client = wl_resource_get_client(manager);
+	struct wl_resource *resource = wl_resource_create(client,
+		&zwlr_foreign_toplevel_handle_v1_interface,
+		wl_resource_get_version(manager), 0);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &toplevel_impl, toplevel,
+		remove_resource);
+	wl_list_insert(toplevel->resources.prev, wl_resource_get_link(resource));
+
+	zwlr_foreign_toplevel_manager_v1_send_toplevel(manager, resource);
+	toplevel_send_all(toplevel, resource);
+}
+
+static struct mock_toplevel *
+toplevel_create(struct mock *mock)
+{
+	struct mock_toplevel *toplevel = calloc(1, sizeof *toplevel);
+	if (!toplevel) {
+		die("Failed to allocate toplevel\n");
+	}
+	toplevel->mock = mock;
+	toplevel->id = mock->next_toplevel++;
+	snprintf(toplevel->app_id, sizeof toplevel->app_id, "app%d", toplevel->id);
+	snprintf(toplevel->title, sizeof toplevel->title, "Window %d", toplevel->id);
+	wl_list_init(&toplevel->resources);
+	wl_list_insert(mock->toplevels.prev, &toplevel->link);
+
+	struct wl_resource *manager;
+	wl_resource_for_each(manager, &mock->toplevel_managers) {
+		toplevel_send_to_manager(toplevel, manager);
+	}
+	return toplevel;
+}
+
+static void
+toplevel_destroy(struct mock_toplevel *toplevel)
+{
+	struct wl_resource *resource, *tmp;
+	wl_resource_for_each_safe(resource, tmp, &toplevel->resources) {
+		zwlr_foreign_toplevel_handle_v1_send_closed(resource);
+		wl_resource_set_user_data(resource, NULL);
+		wl_list_remove(wl_resource_get_link(resource));
+		wl_list_init(wl_resource_get_link(resource));
+	}
+	wl_list_remove(&toplevel->link);
+	free(toplevel);
+}
+
+static void
+toplevel_manager_stop(struct wl_client *client, struct wl_resource *resource)
+{
+	zwlr_foreign_toplevel_manager_v1_send_finished(resource);
+	wl_resource_destroy(resource);
+}
+
+static const struct zwlr_foreign_toplevel_manager_v1_interface
+toplevel_manager_impl = {
+	.stop = toplevel_manager_stop,
+};
+
+static void
+bind_toplevel_manager(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id)
+{
+	struct mock *mock = data;
+	struct wl_resource *resource = wl_resource_create(client,
+		&zwlr_foreign_toplevel_manager_v1_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &toplevel_manager_impl, mock,
+		remove_resource);
+	wl_list_insert(mock->toplevel_managers.prev, wl_resource_get_link(resource));
+
+	struct mock_toplevel *toplevel;
+	wl_list_for_each(toplevel, &mock->toplevels, link) {
+		toplevel_send_to_manager(toplevel, resource);
+	}
+}
+
+// zwlr_output_manager_v1
+
+static void
+configuration_enable_head(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id, struct wl_resource *head)
+{
+	static const struct zwlr_output_configuration_head_v1_interface impl = {
+		.set_mode = noop,
+		.set_custom_mode = noop,
+		.set_position = noop,
+		.set_transform = noop,
+		.set_scale = noop,
+	};
+	create_resource(client, &zwlr_output_configuration_head_v1_interface,
+		wl_resource_get_version(resource), id, &impl, NULL);
+}
+
+static void
+configuration_cancel(struct wl_client *client, struct wl_resource *resource)
+{
+	zwlr_output_configuration_v1_send_cancelled(resource);
+}
+
+static const struct zwlr_output_configuration_v1_interface configuration_impl = {
+	.enable_head = configuration_enable_head,
+	.disable_head = noop,
+	.apply = configuration_cancel,
+	.test = configuration_cancel,
+	.destroy = destroy_resource,
+};
+
+static void
+output_manager_create_configuration(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id, uint32_t serial)
+{
+	create_resource(client, &zwlr_output_configuration_v1_interface,
+		wl_resource_get_version(resource), id, &configuration_impl, NULL);
+}
+
+static void
+output_manager_stop(struct wl_client *client, struct wl_resource *resource)
+{
+	zwlr_output_manager_v1_send_finished(resource);
+	wl_resource_destroy(resource);
+}
+
+static const struct zwlr_output_manager_v1_interface output_manager_impl = {
+	.create_configuration = output_manager_create_configuration,
+	.stop = output_manager_stop,
+};
+
+static void
+output_binding_destroy(struct wl_resource *resource)
+{
+	struct output_binding *binding = wl_resource_get_user_data(resource);
+	wl_list_remove(&binding->link);
+	free(binding->heads);
+	free(binding->modes);
+	free(binding);
+}
+
+static void
+output_binding_send_head(struct output_binding *binding, int i)
+{
+	struct mock_head *head = &binding->mock->heads[i];
+	struct wl_resource *resource = binding->heads[i];
+	struct wl_resource **mode = &binding->modes[i * MODE_COUNT];
+	int version = wl_resource_get_version(binding->manager);
+
+	zwlr_output_manager_v1_send_head(binding->manager, resource);
+	zwlr_output_head_v1_send_name(resource, head->name);
+	zwlr_output_head_v1_send_description(resource, "Mock output");
+	zwlr_output_head_v1_send_physical_size(resource, 600, 340);
+	for (int m = 0; m < MODE_COUNT; m++) {
+		zwlr_output_head_v1_send_mode(resource, mode[m]);
+		zwlr_output_mode_v1_send_size(mode[m], modes[m].width, modes[m].height);
+		zwlr_output_mode_v1_send_refresh(mode[m], modes[m].refresh);
+		if (m == 0) {
+			zwlr_output_mode_v1_send_preferred(mode[m]);
+		}
+	}
+	zwlr_output_head_v1_send_enabled(resource, 1);
+	zwlr_output_head_v1_send_current_mode(resource, mode[head->current_mode]);
+	zwlr_output_head_v1_send_position(resource, head->x, 0);
+	zwlr_output_head_v1_send_transform(resource, WL_OUTPUT_TRANSFORM_NORMAL);
+	zwlr_output_head_v1_send_scale(resource, wl_fixed_from_int(1));
+	if (version >= ZWLR_OUTPUT_HEAD_V1_MAKE_SINCE_VERSION) {
+		zwlr_output_head_v1_send_make(resource, "wlrctl");
+		zwlr_output_head_v1_send_model(resource, "Mock");
+		zwlr_output_head_v1_send_serial_number(resource, "0");
+	}
+}
+
+static void
+bind_output_manager(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id)
+{
+	struct mock *mock = data;
+	struct output_binding *binding = calloc(1, sizeof *binding);
+	if (binding) {
+		binding->heads = calloc(mock->head_count, sizeof *binding->heads);
+		binding->modes = calloc(mock->head_count * MODE_COUNT,
+			sizeof *binding->modes);
+	}
+	if (!binding || !binding->heads || !binding->modes) {
+		die("Failed to allocate output binding\n");
+	}
+	binding->mock = mock;
+	binding->manager = wl_resource_create(client,
+		&zwlr_output_manager_v1_interface, version, id);
+	if (!binding->manager) {
+		wl_client_post_no_memory(client);
+		free(binding->heads);
+		free(binding->modes);
+		free(binding);
+		return;
+	}
+	wl_list_insert(&mock->output_bindings, &binding->link);
+	wl_resource_set_implementation(binding->manager, &output_manager_impl,
+		binding, output_binding_destroy);
+
+	for (int i = 0; i < mock->head_count; i++) {
+		binding->heads[i] = create_resource(client,
+			&zwlr_output_head_v1_interface, version, 0, NULL, NULL);
+		for (int m = 0; m < MODE_COUNT; m++) {
+			binding->modes[i * MODE_COUNT + m] = create_resource(client,
+				&zwlr_output_mode_v1_interface, version, 0, NULL, NULL);
+		}
+		output_binding_send_head(binding, i);
+	}
+	zwlr_output_manager_v1_send_done(binding->manager,
+		wl_display_next_serial(mock->display));
+}
+
+static void
+head_set_mode(struct mock *mock, int i, int mode)
+{
+	mock->heads[i].current_mode = mode;
+	uint32_t serial = wl_display_next_serial(mock->display);
+	struct output_binding *binding;
+	wl_list_for_each(binding, &mock->output_bindings, link) {
+		zwlr_output_head_v1_send_current_mode(binding->heads[i],
+			binding->modes[i * MODE_COUNT + mode]);
+		zwlr_output_manager_v1_send_done(binding->manager, serial);
+	}
+}
+
+// State churn
+
+/*
+ * Every step changes one thing, cycling through retitling a toplevel,
+ * activating one, replacing the oldest one with a new one and switching
+ * the mode of a head. The sequence only depends on the step number.
+ */
+static int
+churn(void *data)
+{
+	struct mock *mock = data;
+	int step = mock->churn_step++;
+	int count = wl_list_length(&mock->toplevels);
+
+	struct mock_toplevel *toplevel = NULL;
+	if (count > 0) {
+		int target = (step / 4) % count;
+		wl_list_for_each(toplevel, &mock->toplevels, link) {
+			if (target-- == 0) {
+				break;
+			}
+		}
+	}
+
+	switch (step % 4) {
+	case 0:
+		if (toplevel) {
+			snprintf(toplevel->title, sizeof toplevel->title,
+				"Window %d (%d)", toplevel->id, step);
+			struct wl_resource *resource;
+			wl_resource_for_each(resource, &toplevel->resources) {
+				zwlr_foreign_toplevel_handle_v1_send_title(resource,
+					toplevel->title);
+				zwlr_foreign_toplevel_handle_v1_send_done(resource);
+			}
+		}
+		break;
+	case 1:
+		if (toplevel) {
+			toplevel_activate(toplevel);
+		}
+		break;
+	case 2:
+		if (count > 0) {
+			toplevel_destroy(wl_container_of(mock->toplevels.next,
+				toplevel, link));
+		}
+		toplevel_create(mock);
+		break;
+	case 3:
+		if (mock->head_count > 0) {
+			int head = (step / 4) % mock->head_count;
+			head_set_mode(mock, head,
+				(mock->heads[head].current_mode + 1) % MODE_COUNT);
+		}
+		break;
+	}
+
+	if (mock->churn_steps == 0 || mock->churn_step < mock->churn_steps) {
+		wl_event_source_timer_update(mock->churn_timer, mock->churn_interval);
+	}
+	return 0;
+}
+
+// Request recording
+
+static void
+record_request(void *data, enum wl_protocol_logger_type direction,
+		const struct wl_protocol_logger_message *message)
+{
+	struct mock *mock = data;
+	if (direction != WL_PROTOCOL_LOGGER_REQUEST) {
+		return;
+	}
+
+	if (mock->record_times) {
+		uint64_t elapsed = now_ns() - mock->start;
+		fprintf(mock->record, "%llu.%06llu ",
+			(unsigned long long)(elapsed / 1000000000),
+			(unsigned long long)(elapsed % 1000000000 / 1000));
+	}
+	fprintf(mock->record, "%s@%u.%s(",
+		wl_resource_get_class(message->resource),
+		wl_resource_get_id(message->resource),
+		message->message->name);
+
+	const char *signature = message->message->signature;
+	for (int i = 0; i < message->arguments_count; i++) {
+		while (*signature == '?' || (*signature >= '0' && *signature <= '9')) {
+			signature++;
+		}
+		const union wl_argument *arg = &message->arguments[i];
+		fputs(i ? ", " : "", mock->record);
+		switch (*signature++) {
+		case 'i':
+			fprintf(mock->record, "%d", arg->i);
+			break;
+		case 'u':
+			fprintf(mock->record, "%u", arg->u);
+			break;
+		case 'f':
+			fprintf(mock->record, "%f", wl_fixed_to_double(arg->f));
+			break;
+		case 's':
+			fprintf(mock->record, "\"%s\"", arg->s ? arg->s : "");
+			break;
+		case 'o':
+			if (arg->o) {
+				// Objects in requests are always resources
+				struct wl_resource *resource = (struct wl_resource *)arg->o;
+				fprintf(mock->record, "%s@%u", wl_resource_get_class(resource),
+					wl_resource_get_id(resource));
+			} else {
+				fputs("nil", mock->record);
+			}
+			break;
+		case 'n':
+			fprintf(mock->record, "new id %u", arg->n);
+			break;
+		case 'a':
+			fprintf(mock->record, "array[%zu]", arg->a ? arg->a->size : 0);
+			break;
+		case 'h':
+			fprintf(mock->record, "fd %d", arg->h);
+			break;
+		}
+	}
+	fputs(")\n", mock->record);
+}
+
+static int
+handle_terminate(int signal, void *data)
+{
+	struct mock *mock = data;
+	wl_display_terminate(mock->display);
+	return 0;
+}
+
+extern const char keymap_ascii_raw[];
+
+// Until a virtual keyboard sets one, the seat has wlrctl's own ASCII keymap
+static void
+init_keymap(struct mock *mock)
+{
+	char name[] = "/tmp/mock-keymap-XXXXXX";
+	mock->keymap_fd = mkstemp(name);
+	if (mock->keymap_fd < 0) {
+		die("Could not create the keymap\n");
+	}
+	unlink(name);
+	mock->keymap_size = strlen(keymap_ascii_raw) + 1;
+	if (write(mock->keymap_fd, keymap_ascii_raw, mock->keymap_size) !=
+			(ssize_t)mock->keymap_size) {
+		die("Could not write the keymap\n");
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct mock mock = {
+		.head_count = 1,
+	};
+	int toplevels = 10;
+	const char *socket = NULL, *record = NULL;
+
+	const char *usage =
+		"Usage: mock-compositor [options]\n"
+		"\n"
+		"  -s <name>  Listen on this socket in $XDG_RUNTIME_DIR\n"
+		"  -t <n>     Number of toplevels to start with (default 10)\n"
+		"  -o <n>     Number of output heads (default 1)\n"
+		"  -c <ms>    Change some toplevel or head state every <ms>\n"
+		"  -n <n>     Stop changing state after <n> changes\n"
+		"  -r <file>  Record every request with a timestamp to <file>\n"
+		"  -R <file>  Record every request to <file>, without timestamps\n"
+		;
+
+	int c;
+	while ((c = getopt(argc, argv, "hs:t:o:c:n:r:R:")) != -1) {
+		switch (c) {
+		case 's':
+			socket = optarg;
+			break;
+		case 't':
+			toplevels = atoi(optarg);
+			break;
+		case 'o':
+			mock.head_count = atoi(optarg);
+			break;
+		case 'c':
+			mock.churn_interval = atoi(optarg);
+			break;
+		case 'n':
+			mock.churn_steps = atoi(optarg);
+			break;
+		case 'r':
+			record = optarg;
+			mock.record_times = true;
+			break;
+		case 'R':
+			record = optarg;
+			mock.record_times = false;
+			break;
+		case 'h':
+			puts(usage);
+			return EXIT_SUCCESS;
+		default:
+			puts(usage);
+			return EXIT_FAILURE;
+		}
+	}
+
+	mock.display = wl_display_create();
+	if (!mock.display) {
+		die("Could not create display\n");
+	}
+	mock.start = now_ns();
+	init_keymap(&mock);
+	wl_list_init(&mock.toplevels);
+	wl_list_init(&mock.toplevel_managers);
+	wl_list_init(&mock.output_bindings);
+
+	for (int i = 0; i < toplevels; i++) {
+		toplevel_create(&mock);
+	}
+	mock.heads = calloc(mock.head_count > 0 ? mock.head_count : 1,
+		sizeof *mock.heads);
+	if (!mock.heads) {
+		die("Failed to allocate heads\n");
+	}
+	for (int i = 0; i < mock.head_count; i++) {
+		snprintf(mock.heads[i].name, sizeof mock.heads[i].name, "MOCK-%d", i + 1);
+		mock.heads[i].x = modes[0].width * i;
+	}
+
+	if (record) {
+		mock.record = fopen(record, "w");
+		if (!mock.record) {
+			die("Could not open '%s'\n", record);
+		}
+		wl_display_add_protocol_logger(mock.display, record_request, &mock);
+	}
+
+	wl_global_create(mock.display, &wl_seat_interface, 7,
+		&mock, bind_seat);
+	wl_global_create(mock.display, &zwp_virtual_keyboard_manager_v1_interface, 1,
+		&mock, bind_virtual_keyboard_manager);
+	wl_global_create(mock.display, &zwlr_virtual_pointer_manager_v1_interface, 2,
+		&mock, bind_virtual_pointer_manager);
+	wl_global_create(mock.display, &zwlr_foreign_toplevel_manager_v1_interface, 3,
+		&mock, bind_toplevel_manager);
+	wl_global_create(mock.display, &zwlr_output_manager_v1_interface, 2,
+		&mock, bind_output_manager);
+
+	if (socket) {
+		if (wl_display_add_socket(mock.display, socket) < 0) {
+			die("Could not listen on '%s'\n", socket);
+		}
+	} else if (!(socket = wl_display_add_socket_auto(mock.display))) {
+		die("Could not find a free socket\n");
+	}
+	printf("%s\n", socket);
+	fflush(stdout);
+
+	struct wl_event_loop *loop = wl_display_get_event_loop(mock.display);
+	wl_event_loop_add_signal(loop, SIGINT, handle_terminate, &mock);
+	wl_event_loop_add_signal(loop, SIGTERM, handle_terminate, &mock);
+	if (mock.churn_interval > 0) {
+		mock.churn_timer = wl_event_loop_add_timer(loop, churn, &mock);
+		wl_event_source_timer_update(mock.churn_timer, mock.churn_interval);
+	}
+
+	wl_display_run(mock.display);
+
+	wl_display_destroy_clients(mock.display);
+	struct mock_toplevel *toplevel, *tmp;
+	wl_list_for_each_safe(toplevel, tmp, &mock.toplevels, link) {
+		toplevel_destroy(toplevel);
+	}
+	wl_display_destroy(mock.display);
+	free(mock.heads);
+	close(mock.keymap_fd);
+	if (mock.record) {
+		fclose(mock.record);
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,38 @@
+#!/bin/sh
+# Run the common wlrctl commands against the mock compositor, to collect a
+# profile in a -Db_pgo=generate build.
+#
+# Usage: pgo-train.sh <wlrctl> <mock-compositor> [rounds]
+set -e
+
+wlrctl=$1
+compositor=$2
+rounds=${3:-20}
+
+runtime_dir=$(mktemp -d)
+export XDG_RUNTIME_DIR="$runtime_dir"
+export WAYLAND_DISPLAY=wlrctl-train
+
+"$compositor" -s "$WAYLAND_DISPLAY" -t 20 -o 2 > "$runtime_dir/ready" &
+compositor_pid=$!
+trap 'kill $compositor_pid; rm -rf "$runtime_dir"' EXIT
+
+# The compositor prints its socket name once it is listening
+while [ ! -s "$runtime_dir/ready" ]; do
+	sleep 0.01
+done
+
+i=0
+while [ $i -lt "$rounds" ]; do
+	"$wlrctl" keyboard type 'Hello, world!'
+	"$wlrctl" keyboard type hello modifiers CTRL,SHIFT
+	"$wlrctl" pointer move 10 -10
+	"$wlrctl" pointer click
+	"$wlrctl" pointer scroll 5 0
+	"$wlrctl" toplevel list > /dev/null
+	"$wlrctl" toplevel find app_id:app3
+	"$wlrctl" toplevel focus app_id:app3
+	"$wlrctl" output list > /dev/null
+	printf 'pointer move 1 1\nkeyboard type x\ntoplevel find app1\n' | "$wlrctl" -
+	i=$((i + 1))
+done
@@ -0,0 +1,125 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utf8.h"
+#include "util.h"
+
+/*
+ * Microbenchmark of the UTF-8 decoder on a few kinds of text, against the
+ * one byte at a time loop, and for ASCII text against the check and copy
+ * wlrctl did before it could type anything else. Results are printed as one
+ * JSON object per line, like the end to end benchmarks.
+ *
+ * Usage: utf8-bench [megabytes]
+ */
+
+typedef size_t (*decode_func)(const char *str, size_t len, uint32_t *out,
+	size_t *error);
+
+/*
+ * The original text handling: reject anything that is not all ASCII, then
+ * take the text one byte at a time.
+ */
+static size_t
+decode_baseline(const char *str, size_t len, uint32_t *out, size_t *error)
+{
+	for (size_t i = 0; i < len; i++) {
+		if ((unsigned char)str[i] >= 0x80) {
+			*error = i;
+			return 0;
+		}
+	}
+	for (size_t i = 0; i < len; i++) {
+		out[i] = (unsigned char)str[i];
+	}
+	*error = len;
+	return len;
+}
+
+static char *
+make_text(const char *pattern, size_t size)
+{
+	char *text = malloc(size);
+	if (!text) {
+		die("Failed to allocate text\n");
+	}
+	size_t len = strlen(pattern), pos = 0;
+	// Whole copies of the pattern only, so no character is cut in half
+	while (pos + len <= size) {
+		memcpy(text + pos, pattern, len);
+		pos += len;
+	}
+	memset(text + pos, ' ', size - pos);
+	return text;
+}
+
+static double
+measure(decode_func decode, const char *text, size_t size, uint32_t *out)
+{
+	enum { ROUNDS = 5 };
+	uint64_t best = UINT64_MAX;
+	for (int round = 0; round < ROUNDS; round++) {
+		size_t error;
+		uint64_t start = now_ns();
+		decode(text, size, out, &error);
+		uint64_t ns = now_ns() - start;
+		if (error != size) {
+			die("Benchmark text is not valid UTF-8\n");
+		}
+		best = ns < best ? ns : best;
+	}
+	return size / (best / 1e9) / (1 << 20);
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t size = (argc > 1 && atoi(argv[1]) > 0 ? atoi(argv[1]) : 16) << 20;
+	static const struct {
+		const char *name, *pattern;
+	} texts[] = {
+		{"ascii", "The quick brown fox jumps over the lazy dog. "},
+		{"latin", "Grüße aus Köln, où l'été est très chaud. "},
+		{"cjk", "敏捷的棕色狐狸跳过了懒狗。"},
+		{"emoji", "ok 👍 🎉 "},
+	};
+
+	uint32_t *out = malloc(size * sizeof *out);
+	uint32_t *check = malloc(size * sizeof *check);
+	if (!out || !check) {
+		die("Failed to allocate code points\n");
+	}
+	for (size_t i = 0; i < sizeof texts / sizeof texts[0]; i++) {
+		char *text = make_text(texts[i].pattern, size);
+
+		size_t error;
+		size_t count = utf8_decode(text, size, out, &error);
+		if (utf8_decode_scalar(text, size, check, &error) != count ||
+				memcmp(out, check, count * sizeof *out) != 0) {
+			die("Decoders disagree on %s text\n", texts[i].name);
+		}
+
+		// Only ASCII text got past the original check
+		bool ascii = decode_baseline(text, size, check, &error) == count &&
+			memcmp(out, check, count * sizeof *out) == 0;
+
+		double scalar = measure(utf8_decode_scalar, text, size, out);
+		double vector = measure(utf8_decode, text, size, out);
+		printf("{\"benchmark\": \"utf8 decode %s\", \"unit\": \"MiB/s\", "
+			"\"scalar\": %.1f, \"value\": %.1f, \"speedup\": %.2f",
+			texts[i].name, scalar, vector, vector / scalar);
+		if (ascii) {
+			double baseline = measure(decode_baseline, text, size, out);
+			printf(", \"baseline\": %.1f, \"baseline_speedup\": %.2f",
+				baseline, vector / baseline);
+		}
+		printf("}\n");
+		free(text);
+	}
+	free(out);
+	free(check);
+	return EXIT_SUCCESS;
+}
@@ -1,11 +1,13 @@
 #define _DEFAULT_SOURCE
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <wayland-client.h>
+#include "arena.h"
 #include "common.h"
 #include "toplevel.h"
 #include "util.h"
@@ -71,18 +73,9 @@ append(struct wl_array *arr, char *str)
 }
 
 static bool
-contains_value(struct wl_array *arr, int value) {
-	if (!value) {
-		return false;
-	}
-
-	int *cursor;
-	wl_array_for_each(cursor, arr) {
-		if (*cursor == value) {
-			return true;
-		}
-	}
-	return false;
+has_state(struct toplevel_data *data, uint32_t state)
+{
+	return state < 32 && (data->state & (UINT32_C(1) << state));
 }
 
 static bool
@@ -184,28 +177,28 @@ is_matched(struct toplevel_data *data)
 		}
 	}
 	if (matchspec->attrs & TOPLEVEL_ATTR_MAXIMIZED) {
-		if (contains_value(&data->state,
+		if (has_state(data,
 			ZWLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_MAXIMIZED) ^
 			matchspec->maximized) {
 			return false;
 		}
 	}
 	if (matchspec->attrs & TOPLEVEL_ATTR_MINIMIZED) {
-		if (contains_value(&data->state,
+		if (has_state(data,
 			ZWLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_MINIMIZED) ^
 			matchspec->minimized) {
 			return false;
 		}
 	}
 	if (matchspec->attrs & TOPLEVEL_ATTR_ACTIVATED) {
-		if (contains_value(&data->state,
+		if (has_state(data,
 			ZWLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_ACTIVATED) ^
 			matchspec->activated) {
 			return false;
 		}
 	}
 	if (matchspec->attrs & TOPLEVEL_ATTR_FULLSCREEN) {
-		if (contains_value(&data->state,
+		if (has_state(data,
 			ZWLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_FULLSCREEN) ^
 			matchspec->fullscreen) {
 			return false;
@@ -217,12 +210,7 @@ is_matched(struct toplevel_data *data)
 struct toplevel_data *
 toplevel_data_create(struct wlrctl_toplevel_command *cmd)
 {
-	struct toplevel_data *data = calloc(1, sizeof (struct toplevel_data));
-	if (!data) {
-		die("Failed to allocate toplevel data\n");
-	}
-	
-	wl_array_init(&data->state);
+	struct toplevel_data *data = arena_alloc(&cmd->arena, sizeof (struct toplevel_data));
 	data->cmd = cmd;
 	wl_list_insert(&cmd->toplevels, &data->link);
 
@@ -232,10 +220,10 @@ toplevel_data_create(struct wlrctl_toplevel_command *cmd)
 void
 toplevel_data_destroy(struct toplevel_data *data)
 {
-	free(data->app_id);
-	free(data->title);
-	wl_array_release(&data->state);
-	free(data);
+	// The record itself goes with the command's arena
+	if (data->handle) {
+		zwlr_foreign_toplevel_handle_v1_destroy(data->handle);
+	}
 }
 
 static void
@@ -245,7 +233,7 @@ zwlr_foreign_toplevel_handle_v1_handle_title(void *user_data,
 	)
 {
 	struct toplevel_data *data = user_data;
-	data->title = strdup(title);
+	data->title = arena_strset(&data->cmd->arena, data->title, title);
 }
 
 static void
@@ -255,7 +243,7 @@ zwlr_foreign_toplevel_handle_v1_handle_app_id(void *user_data,
 	)
 {
 	struct toplevel_data *data = user_data;
-	data->app_id = strdup(app_id);
+	data->app_id = arena_strset(&data->cmd->arena, data->app_id, app_id);
 }
 
 static void
@@ -265,7 +253,13 @@ zwlr_foreign_toplevel_handle_v1_handle_state(void *user_data,
 	)
 {
 	struct toplevel_data *data = user_data;
-	wl_array_copy(&data->state, state);
+	uint32_t *value;
+	data->state = 0;
+	wl_array_for_each(value, state) {
+		if (*value < 32) {
+			data->state |= UINT32_C(1) << *value;
+		}
+	}
 }
 
 static void
@@ -307,7 +301,7 @@ zwlr_foreign_toplevel_handle_v1_handle_done(void *user_data,
 		break;
 	case TOPLEVEL_ACTION_LIST:
 		if (data->app_id) {
-			printf("%s: %s\n", data->app_id, data->title ? data->title : "");
+			fprintf(data->cmd->state->out, "%s: %s\n", data->app_id, data->title ? data->title : "");
 		}
 		break;
 	case TOPLEVEL_ACTION_FIND:
@@ -330,6 +324,7 @@ zwlr_foreign_toplevel_handle_v1_handle_closed(
 {
 	struct toplevel_data *data = user_data;
 	zwlr_foreign_toplevel_handle_v1_destroy(toplevel);
+	data->handle = NULL;
 	if (data->cmd->complete || !data->matched) {
 		return;
 	}
@@ -373,6 +368,7 @@ zwlr_foreign_toplevel_manager_v1_handle_toplevel(
 	struct wlrctl *state = data;
 	struct wlrctl_toplevel_command *cmd = state->cmd;
 	struct toplevel_data *toplevel_data = toplevel_data_create(cmd);
+	toplevel_data->handle = toplevel;
 	zwlr_foreign_toplevel_handle_v1_add_listener(
 		toplevel,
 		&zwlr_foreign_toplevel_handle_v1_listener,
@@ -389,6 +385,8 @@ zwlr_foreign_toplevel_manager_v1_handle_finished(
 	struct wlrctl *state = data;
 	state->running = false;
 	destroy_toplevel(state);
+	zwlr_foreign_toplevel_manager_v1_destroy(manager);
+	state->ftl_mgr = NULL;
 }
 
 static struct zwlr_foreign_toplevel_manager_v1_listener
@@ -405,6 +403,8 @@ prepare_toplevel(struct wlrctl *state, int argc, char *argv[])
 
 	wl_list_init(&cmd->toplevels);
 	matchspec_init(&cmd->matchspec);
+	state->cmd = cmd;
+	cmd->state = state;
 
 	if (argc == 0) {
 		die("Missing toplevel action\n");
@@ -419,9 +419,6 @@ prepare_toplevel(struct wlrctl *state, int argc, char *argv[])
 	for (int i = 1; i < argc; i++) {
 		matchspec_add_match(&cmd->matchspec, argv[i]);
 	}
-
-	state->cmd = cmd;
-	cmd->state = state;
 }
 
 void
@@ -430,12 +427,27 @@ stop_toplevel(struct wlrctl *state)
 	zwlr_foreign_toplevel_manager_v1_stop(state->ftl_mgr);
 }
 
+/*
+ * Give up on the command, the manager's finished event cleans it up.
+ */
+void
+cancel_toplevel(struct wlrctl *state)
+{
+	struct wlrctl_toplevel_command *cmd = state->cmd;
+	if (!cmd->complete) {
+		cmd->complete = true;
+		cmd->state->failed = true;
+		stop_toplevel(state);
+	}
+}
+
 void
 complete_toplevel(void *data, struct wl_callback *callback, uint32_t serial)
 {
 	struct wlrctl *state = data;
 	struct wlrctl_toplevel_command *cmd = state->cmd;
 	wl_callback_destroy(callback);
+	cmd->sync = NULL;
 	if (cmd->action == TOPLEVEL_ACTION_WAITFOR ||
 		(cmd->action == TOPLEVEL_ACTION_WAIT && (cmd->waiting > 0))) {
 		return;
@@ -463,8 +475,8 @@ run_toplevel(struct wlrctl *state)
 	if (cmd->action == TOPLEVEL_ACTION_LIST) {
 		stop_toplevel(state);
 	} else {
-		struct wl_callback *complete = wl_display_sync(state->display);
-		wl_callback_add_listener(complete, &complete_listener, state);
+		cmd->sync = wl_display_sync(state->display);
+		wl_callback_add_listener(cmd->sync, &complete_listener, state);
 	}
 }
 
@@ -473,13 +485,19 @@ destroy_toplevel(struct wlrctl *state)
 {
 	struct wlrctl_toplevel_command *cmd = state->cmd;
 
+	if (cmd->sync) {
+		wl_callback_destroy(cmd->sync);
+	}
 	matchspec_release(&cmd->matchspec);
 
 	// Release toplevels
-	struct toplevel_data *data, *tmp;
-	wl_list_for_each_safe(data, tmp, &cmd->toplevels, link) {
-		wl_list_remove(&data->link);
+	struct toplevel_data *data;
+	wl_list_for_each(data, &cmd->toplevels, link) {
 		toplevel_data_destroy(data);
 	}
+	if (cmd->arena.size > cmd->state->timing.arena_peak) {
+		cmd->state->timing.arena_peak = cmd->arena.size;
+	}
+	arena_release(&cmd->arena);
 	free(cmd);
 }
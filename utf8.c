@@ -0,0 +1,189 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "utf8.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define UTF8_X86
+#endif
+
+/*
+ * Text is mostly ASCII, even in languages that aren't, thanks to spaces and
+ * punctuation. Runs of it are checked and widened to code points 16 or 32
+ * bytes at a time, everything else is decoded one sequence at a time.
+ */
+
+// Widen the ASCII at the start of s into out and return how much there was
+static size_t
+ascii_run_scalar(const unsigned char *s, size_t len, uint32_t *out)
+{
+	size_t i = 0;
+	while (i < len && s[i] < 0x80) {
+		out[i] = s[i];
+		i++;
+	}
+	return i;
+}
+
+#ifdef UTF8_X86
+static size_t
+ascii_run_sse2(const unsigned char *s, size_t len, uint32_t *out)
+{
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m128i bytes = _mm_loadu_si128((const __m128i *)(s + i));
+		if (_mm_movemask_epi8(bytes)) {
+			break;
+		}
+		__m128i lo = _mm_unpacklo_epi8(bytes, zero);
+		__m128i hi = _mm_unpackhi_epi8(bytes, zero);
+		_mm_storeu_si128((__m128i *)(out + i), _mm_unpacklo_epi16(lo, zero));
+		_mm_storeu_si128((__m128i *)(out + i + 4), _mm_unpackhi_epi16(lo, zero));
+		_mm_storeu_si128((__m128i *)(out + i + 8), _mm_unpacklo_epi16(hi, zero));
+		_mm_storeu_si128((__m128i *)(out + i + 12), _mm_unpackhi_epi16(hi, zero));
+	}
+	return i + ascii_run_scalar(s + i, len - i, out + i);
+}
+
+__attribute__((target("avx2")))
+static size_t
+ascii_run_avx2(const unsigned char *s, size_t len, uint32_t *out)
+{
+	size_t i = 0;
+	for (; i + 32 <= len; i += 32) {
+		__m256i bytes = _mm256_loadu_si256((const __m256i *)(s + i));
+		if (_mm256_movemask_epi8(bytes)) {
+			break;
+		}
+		for (int j = 0; j < 32; j += 8) {
+			__m128i eight = _mm_loadl_epi64((const __m128i *)(s + i + j));
+			_mm256_storeu_si256((__m256i *)(out + i + j), _mm256_cvtepu8_epi32(eight));
+		}
+	}
+	return i + ascii_run_sse2(s + i, len - i, out + i);
+}
+#endif
+
+// Switching to AVX2 has a cost of its own, short runs are done before it pays
+#define AVX2_MIN_RUN 64
+
+static size_t
+ascii_run(const unsigned char *s, size_t len, uint32_t *out)
+{
+#ifdef UTF8_X86
+	// Every x86-64 has SSE2
+	size_t run = ascii_run_sse2(s, len < AVX2_MIN_RUN ? len : AVX2_MIN_RUN, out);
+	if (run == AVX2_MIN_RUN && __builtin_cpu_supports("avx2")) {
+		run += ascii_run_avx2(s + run, len - run, out + run);
+	} else if (run == AVX2_MIN_RUN) {
+		run += ascii_run_sse2(s + run, len - run, out + run);
+	}
+	return run;
+#else
+	return ascii_run_scalar(s, len, out);
+#endif
+}
+
+static inline size_t
+decode(const char *str, size_t len, uint32_t *out, size_t *error, bool vector)
+{
+	const unsigned char *s = (const unsigned char *)str;
+	size_t count = 0;
+	size_t i = 0;
+	while (i < len) {
+		uint32_t c = s[i];
+		int extra;
+		uint32_t min;
+		if (c < 0x80) {
+			// A lone ASCII character between others is not worth a run
+			if (vector && i + 1 < len && s[i + 1] < 0x80) {
+				size_t run = ascii_run(s + i, len - i, out + count);
+				count += run;
+				i += run;
+			} else {
+				out[count++] = c;
+				i++;
+			}
+			continue;
+		} else if ((c & 0xe0) == 0xc0) {
+			extra = 1;
+			min = 0x80;
+			c &= 0x1f;
+		} else if ((c & 0xf0) == 0xe0) {
+			extra = 2;
+			min = 0x800;
+			c &= 0x0f;
+		} else if ((c & 0xf8) == 0xf0) {
+			extra = 3;
+			min = 0x10000;
+			c &= 0x07;
+		} else {
+			*error = i;
+			return 0;
+		}
+
+		if (len - i <= (size_t)extra) {
+			*error = i;
+			return 0;
+		}
+		for (int j = 1; j <= extra; j++) {
+			if ((s[i + j] & 0xc0) != 0x80) {
+				*error = i;
+				return 0;
+			}
+			c = c << 6 | (s[i + j] & 0x3f);
+		}
+		if (c < min || c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff)) {
+			*error = i;
+			return 0;
+		}
+		out[count++] = c;
+		i += extra + 1;
+	}
+	*error = len;
+	return count;
+}
+
+/*
+ * Decode len bytes of UTF-8 into out, which must have room for len code
+ * points, and return how many there were. Overlong forms, surrogates and
+ * code points past U+10FFFF are invalid. On invalid input, error is set to
+ * the offset of the offending byte and 0 is returned, otherwise error is set
+ * to len.
+ */
+size_t
+utf8_decode(const char *str, size_t len, uint32_t *out, size_t *error)
+{
+	return decode(str, len, out, error, true);
+}
+
+/*
+ * utf8_decode one byte at a time, for comparison.
+ */
+size_t
+utf8_decode_scalar(const char *str, size_t len, uint32_t *out, size_t *error)
+{
+	return decode(str, len, out, error, false);
+}
+
+/*
+ * Return the length of str without the sequence it ends in, if that was cut
+ * short, so that text read in pieces is only decoded in whole characters.
+ */
+size_t
+utf8_complete(const char *str, size_t len)
+{
+	const unsigned char *s = (const unsigned char *)str;
+	for (size_t back = 1; back <= 3 && back <= len; back++) {
+		unsigned char c = s[len - back];
+		if ((c & 0xc0) == 0x80) {
+			continue;
+		}
+		size_t need = (c & 0xe0) == 0xc0 ? 2 : (c & 0xf0) == 0xe0 ? 3 :
+			(c & 0xf8) == 0xf0 ? 4 : 1;
+		return need > back ? len - back : len;
+	}
+	return len;
+}
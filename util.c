@@ -1,4 +1,7 @@
 #define _POSIX_C_SOURCE 200112L
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,21 +21,112 @@ matchtok(const struct token tokens[], const char *name)
 	return tok->value;
 }
 
+/*
+ * Split a command line into arguments in place, honouring single quotes,
+ * double quotes and backslash escapes like a POSIX shell would. Parsing
+ * stops at an unquoted '#' at the start of a word. argv is terminated by a
+ * NULL like main's, so it has room for max - 1 arguments. Returns the
+ * number of arguments, or -1 on an unterminated quote or if there are more.
+ */
 int
-timestamp()
+split_args(char *line, char *argv[], int max)
+{
+	int argc = 0;
+	char *src = line, *dst = line;
+	while (true) {
+		while (*src == ' ' || *src == '\t' || *src == '\n' || *src == '\r') {
+			src++;
+		}
+		if (*src == '\0' || *src == '#') {
+			break;
+		}
+		if (argc == max - 1) {
+			return -1;
+		}
+		argv[argc++] = dst;
+
+		char quote = '\0';
+		for ( ; *src; src++) {
+			if (quote == '\'') {
+				if (*src == '\'') {
+					quote = '\0';
+				} else {
+					*dst++ = *src;
+				}
+			} else if (*src == '\\' && src[1] &&
+					(!quote || strchr("\"\\$`", src[1]))) {
+				*dst++ = *++src;
+			} else if (quote == '"') {
+				if (*src == '"') {
+					quote = '\0';
+				} else {
+					*dst++ = *src;
+				}
+			} else if (*src == '\'' || *src == '"') {
+				quote = *src;
+			} else if (strchr(" \t\n\r", *src)) {
+				break;
+			} else {
+				*dst++ = *src;
+			}
+		}
+		if (quote) {
+			return -1;
+		}
+		if (*src) {
+			src++;
+		}
+		*dst++ = '\0';
+	}
+	argv[argc] = NULL;
+	return argc;
+}
+
+uint64_t
+now_ns()
 {
 	struct timespec tp;
 	clock_gettime(CLOCK_MONOTONIC, &tp);
-	int ms = 1000 * tp.tv_sec + tp.tv_nsec / 1000000;
-	return ms;
+	return tp.tv_sec * UINT64_C(1000000000) + tp.tv_nsec;
 }
 
+// Per thread, so every thread of a fleet can recover on its own
+static _Thread_local jmp_buf *die_env;
+static _Thread_local FILE *die_stream;
+
 void
 die(const char *fmt, ...)
 {
 	va_list args;
 	va_start(args, fmt);
-	vfprintf(stderr, fmt, args);
+	vfprintf(die_stream ? die_stream : stderr, fmt, args);
 	va_end(args);
+	if (die_env) {
+		longjmp(*die_env, 1);
+	}
 	exit(EXIT_FAILURE);
 }
+
+/*
+ * Make die() unwind to env instead of exiting, so a long running process
+ * can reject a bad command and carry on. Pass NULL to restore the default.
+ * Returns the handler it replaces. Wayland event dispatch runs with no
+ * handler, see loop_dispatch.
+ */
+jmp_buf *
+set_die_handler(jmp_buf *env)
+{
+	jmp_buf *old = die_env;
+	die_env = env;
+	return old;
+}
+
+/*
+ * Make die() print to stream instead of stderr, or to stderr again if
+ * stream is NULL.
+ */
+void
+set_die_stream(FILE *stream)
+{
+	die_stream = stream;
+}
@@ -0,0 +1,64 @@
+#define _POSIX_C_SOURCE 200809L
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "util.h"
+#include "xkb.h"
+
+#define XKBCOMMON_SONAME "libxkbcommon.so.0"
+
+static struct xkb_api api;
+static bool loaded;
+static char error[256];
+// Fleet threads may all want the library at once
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool
+load(void)
+{
+#ifdef XKBCOMMON_STATIC
+	// There is no loader in a static binary, the library is linked in
+#define X(name) api.name = xkb_##name;
+	XKB_FUNCS(X)
+#undef X
+#else
+	void *lib = dlopen(XKBCOMMON_SONAME, RTLD_NOW | RTLD_LOCAL);
+	if (!lib) {
+		snprintf(error, sizeof error, "Could not load %s: %s",
+			XKBCOMMON_SONAME, dlerror());
+		return false;
+	}
+	// The library stays loaded until exit
+#define X(name) \
+	*(void **)&api.name = dlsym(lib, "xkb_" #name); \
+	if (!api.name) { \
+		snprintf(error, sizeof error, "Could not find xkb_%s in %s", \
+			#name, XKBCOMMON_SONAME); \
+		return false; \
+	}
+	XKB_FUNCS(X)
+#undef X
+#endif
+	return true;
+}
+
+/*
+ * Load libxkbcommon on first use and return its entry points. Dies if the
+ * library can't be loaded.
+ */
+const struct xkb_api *
+xkb_load(void)
+{
+	pthread_mutex_lock(&lock);
+	if (!loaded && !error[0]) {
+		loaded = load();
+	}
+	pthread_mutex_unlock(&lock);
+
+	if (!loaded) {
+		die("%s\n", error);
+	}
+	return &api;
+}